@@ -0,0 +1,63 @@
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include <cstddef>
+#include <string>
+
+// Heap accounting by call site, compiled in with -DCARDLIB_ALLOC_STATS=ON.
+// Allocations are charged to the innermost active scope of the calling thread, which is recorded
+// in front of the block, so its free is charged to the same site whichever thread releases it.
+// Only operator new is counted: bee2 allocates with malloc and is out of scope, as are the
+// over-aligned overloads, which are left to the standard library.
+enum class AllocSite {
+    Other,
+    ApduEncode,
+    Der,
+    SmWrap,
+    SmUnwrap,
+    Transmit,
+    BpaceInit,
+    BpaceStep2,
+    BpaceStep4,
+    BpaceStep6,
+    Count
+};
+
+struct AllocCounters {
+    size_t allocs = 0;
+    size_t frees = 0;
+    size_t bytes = 0;
+};
+
+class AllocStats {
+public:
+    static bool enabled();
+    static AllocCounters get(AllocSite site);
+    static void reset();
+    static std::string report();
+    static bool checkBudget(AllocSite site, size_t maxAllocs);
+
+    static const char* siteName(AllocSite site);
+};
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocSite site);
+    ~AllocScope();
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+private:
+    AllocSite previous;
+};
+
+#ifdef CARDLIB_ALLOC_STATS
+#define CARDLIB_ALLOC_CONCAT_(a, b) a##b
+#define CARDLIB_ALLOC_CONCAT(a, b) CARDLIB_ALLOC_CONCAT_(a, b)
+#define CARDLIB_ALLOC_SCOPE(site) AllocScope CARDLIB_ALLOC_CONCAT(allocScope, __LINE__)(site)
+#else
+#define CARDLIB_ALLOC_SCOPE(site)
+#endif
+
+#endif
@@ -6,11 +6,14 @@
 #include <bee2/core/mem.h>
 #include <bee2/crypto/belt.h>
 #include <bee2/defs.h>
+#include <allocStats.h>
+#include <tracer.h>
 #include <enums/apduEnum.h>
 #include <logger.h>
 
 #include <boost/optional.hpp>
 #include <limits>
+#include <span>
 #include <vector>
 
 struct APDU {
@@ -20,13 +23,21 @@ struct APDU {
     size_t cdf_len = 0;
     std::vector<octet> cdf = {};
     boost::optional<size_t> le;
+    // Logical channel carried in the low bits of CLA
+    octet channel = 0;
+
+    static const octet MAX_CHANNEL = 3;
 
     APDU(Cla cla, Instruction ins, octet p1, octet p2, std::vector<octet> data = {}, boost::optional<size_t> le = boost::none);
 };
 
 std::vector<octet> derEncode(u32 tag, const std::vector<octet>& data);
 std::vector<octet> derDecode(u32 tag, octet* data, size_t len);
+size_t derTLV(std::span<const octet> data, u32& tag, std::span<const octet>& value);
 std::vector<octet> APDUEncode(APDU command);
+std::vector<octet> APDUToCmd(const APDU& command);
+boost::optional<APDU> APDUDecode(const std::vector<octet>& apdu);
+std::vector<APDU> APDUChain(const APDU& command, size_t maxData);
 APDU APDUEncrypt(APDU command);
 // std::vector<octet> createAPDUCmd(Cla cla, Instruction cmd, octet p1, octet p2, std::vector<octet> data =
 // {});
@@ -0,0 +1,36 @@
+#ifndef ATR_H
+#define ATR_H
+
+#include <bee2/defs.h>
+
+#include <boost/optional.hpp>
+#include <string>
+#include <vector>
+
+enum class CardType { Unknown, Contact, Contactless, ContactlessStorage };
+
+// Answer-to-reset as defined in ISO 7816-3, historical bytes as in ISO 7816-4
+class ATR {
+public:
+    static boost::optional<ATR> parse(const octet* atr, size_t len);
+
+    bool supportsProtocol(int protocol) const;
+    bool supportsExtendedLength() const;
+    bool supportsChaining() const;
+    CardType getCardType() const;
+    const std::vector<octet>& getHistoricalBytes() const;
+    std::string toHex() const;
+
+private:
+    ATR() = default;
+    void parseHistoricalBytes();
+
+    std::vector<octet> raw;
+    std::vector<octet> historical;
+    std::vector<int> protocols;
+    bool extendedLength = false;
+    bool chaining = false;
+    CardType cardType = CardType::Unknown;
+};
+
+#endif
@@ -2,10 +2,8 @@
 #define BPACE_H
 
 #include <bee2/core/apdu.h>
-#include <bee2/core/blob.h>
 #include <bee2/core/der.h>
 #include <bee2/core/mem.h>
-#include <bee2/core/prng.h>
 #include <bee2/crypto/bake.h>
 #include <bee2/crypto/bign.h>
 
@@ -14,45 +12,204 @@
 #include <logger.h>
 #include <pcsc.h>
 #include <cardsecure.h>
+#include <protocolEngine.h>
+#include <randomPool.h>
+#include <readCheckpoint.h>
+#include <secureArena.h>
 
 
+#include <array>
+#include <functional>
+#include <future>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <span>
 
-class Bpace {
+// Security level l of the bign curve, fixes the curve and every BPACE message length
+template <size_t L>
+struct BpaceLevel {
+    static_assert(L == 128 || L == 192 || L == 256, "bign defines l = 128, 192 and 256");
+
+    static constexpr const char *CURVE = L == 128   ? "1.2.112.0.2.0.34.101.45.3.1"
+                                         : L == 192 ? "1.2.112.0.2.0.34.101.45.3.2"
+                                                    : "1.2.112.0.2.0.34.101.45.3.3";
+    static constexpr size_t KEY = 32;
+    static constexpr size_t M1 = L / 8;
+    static constexpr size_t M2 = 5 * L / 8;
+    static constexpr size_t M3 = L / 2 + 8;
+    static constexpr size_t M4 = 8;
+    // key | message 2 | message 3 | bake state, whose size bee2 only reports at run time
+    static size_t slot() {
+        static const size_t size = KEY + M2 + M3 + bakeBPACE_keep(L);
+        return size;
+    }
+};
+
+template <size_t L>
+class TerminalKeyPool;
+template <size_t L>
+class TerminalHandshake;
+class CommandPipeline;
+
+// Construction only stores the password, open() connects the reader, selects the applet and starts BPACE.
+// Buffer sizes follow from L, the key material and handshake buffers live in one secure arena slot.
+template <size_t L>
+class BpaceSession {
 public:
-    Bpace(std::string password, Pwd pwd_type);
+    using Level = BpaceLevel<L>;
+
+    BpaceSession(std::string password, Pwd pwd_type);
+    BpaceSession(std::string password, Pwd pwd_type, std::shared_ptr<CardTransport> transport);
+    ~BpaceSession();
+
+    int open();
+    std::future<int> openAsync();
+    bool isOpen() const;
+
+    // Session on a further logical channel of the same card with its own applet selection, BPACE
+    // and SM context, so eID reads and eSign operations interleave without re-selecting.
+    // Returns nullptr when the card has no free channel. A transport, e.g. a ScheduledTransport of
+    // the same reader, gives the channel its own place in the reader's schedule.
+    std::unique_ptr<BpaceSession> openChannel(std::shared_ptr<CardTransport> transport = nullptr);
+    bool closeChannel();
+    octet getChannel() const;
 
     int bpaceInit(Pwd pwd_type);
     int bPACEStart(std::string password, Pwd pwd_type);
     bool chooseApplеt(const octet aid[], size_t aidSize);
     bool chooseMF();
+    // EF.DG1 (01 01) by default, or the EF with the given file id, e.g. EF.SOD or a further data
+    // group. The EF cache and read checkpoints are kept per file id.
     bool chooseEF(CardSecure &card);
+    bool chooseEF(CardSecure &card, const std::vector<octet> &fid);
+    // A read that fails midway keeps what it confirmed, the next read of the same EF on the same
+    // card continues from there once the session is restored
+    std::vector<octet> readEF(CardSecure &card);
+
+    // Sees the data of every EF read as it arrives, with its offset in the file, e.g. to hash it
+    // for passive authentication. A read that starts over delivers offset 0 again.
+    void setReadObserver(std::function<void(size_t, std::span<const octet>)> observer);
 
     // temp
     std::string getName();
 
+    PCSC& getPCSC();
+
 
     bool authorize();
 
+    // SM exchange that recovers from card resets, removal, transport and SM failures with the
+    // cheapest sufficient action, idempotent commands are re-sent once the session is restored
+    boost::optional<std::vector<octet>> transmitSecure(CardSecure &card, const APDU &command, bool idempotent);
+    bool recover(CardError error, CardSecure &card);
+    CardError getLastError() const;
+
+    // BAUTH over SM after authorize(): proves the terminal certificate to the card and moves SM to
+    // the new key. The pool must outlive the session, recovery authenticates again with it.
+    bool authenticateTerminal(CardSecure &card, TerminalKeyPool<L> &pool);
+
+    // Bounded by a deadline across every APDU of the flow, recovery included. Once it passes the
+    // exchange is abandoned and getLastError() reports DeadlineExceeded or Cancelled.
+    int open(const Deadline &deadline);
+    bool authorize(const Deadline &deadline);
+    bool chooseEF(CardSecure &card, const Deadline &deadline);
+    bool chooseEF(CardSecure &card, const std::vector<octet> &fid, const Deadline &deadline);
+    std::vector<octet> readEF(CardSecure &card, const Deadline &deadline);
+    bool authenticateTerminal(CardSecure &card, TerminalKeyPool<L> &pool, const Deadline &deadline);
+
+    // Same conversations as coroutines on an event loop, one thread can drive many cards
+    Task<int> open(EventLoop &loop);
+    Task<bool> authorize(EventLoop &loop);
+    Task<bool> chooseEF(EventLoop &loop, CardSecure &card);
+    Task<bool> chooseEF(EventLoop &loop, CardSecure &card, std::vector<octet> fid);
+    Task<std::vector<octet>> readEF(EventLoop &loop, CardSecure &card);
+    Task<bool> authenticateTerminal(EventLoop &loop, CardSecure &card, TerminalKeyPool<L> &pool);
+    Task<bool> authorize(EventLoop &loop, Deadline deadline);
+    Task<std::vector<octet>> readEF(EventLoop &loop, CardSecure &card, Deadline deadline);
+
     std::vector<octet> createMessage1();
     std::vector<octet> createMessage3(std::vector<octet> message2);
     std::vector<octet> sendM1();
     std::vector<octet> sendM3(std::vector<octet> message2);
-    bool lastAuthStep(std::vector<octet> message3);
+    err_t lastAuthStep(std::vector<octet> message4);
     std::vector<octet> getKey();
     void getKey(octet *key0);
 
 private:
-    bign_params params{};
-    octet echo[64]{};
-    blob_t blob{};
-    octet *in{}, *out{};
-    void *state{};
-    octet mac[32]{};
-
-    octet k0[32]{};
+    enum class ChunkStatus { More, Done, Failed };
+
+    BpaceSession(const BpaceSession &basic, octet channel, PCSC pcsc);
+
+    static const bign_params *curveParams();
+
+    APDU onChannel(APDU command) const;
+    std::vector<octet> encode(APDU command) const;
+
+    // k0 | in | out | bake state inside the secure slot
+    octet *key();
+    std::span<octet, Level::M2> in();
+    std::span<octet, Level::M3> out();
+    void *state();
+
+    void wipeHandshake();
+    int startHandshake();
+    int startState(const std::string &pwd);
+
+    std::vector<octet> bpaceInitCommand(Pwd pwd_type);
+    bool bpaceInitAccepted(const std::vector<octet> &response);
+    bool appletSelected(const std::vector<octet> &response, const std::vector<octet> &aid);
+    bool mfSelected(const std::vector<octet> &response);
+    std::vector<octet> stepPayload(const std::vector<octet> &response, u32 tag, const std::string &step);
+    bool efSelected(const std::vector<octet> &plain);
+    std::vector<octet> readEFFromCard(CardSecure &card);
+    CommandPipeline &readPipeline();
+    Task<std::vector<octet>> readEFFromCard(EventLoop &loop, CardSecure &card);
+    boost::optional<APDU> resumeProbe();
+    std::vector<octet> resumed(const boost::optional<std::vector<octet>> &plain);
+    std::vector<octet> suspendRead(std::vector<octet> &data);
+    std::vector<octet> currentFileId() const;
+    std::string cardIdentity() const;
+    ChunkStatus readChunk(const std::vector<octet> &plain, std::vector<octet> &data, size_t chunk);
+    ChunkStatus readDataChunk(const std::vector<octet> &plain, std::vector<octet> &data, size_t chunk);
+    void observe(size_t offset, std::span<const octet> chunk);
+    boost::optional<std::vector<octet>> wrapOrLog(CardSecure &card, const APDU &command);
+    boost::optional<std::vector<octet>> unwrapOrLog(CardSecure &card, const std::vector<octet> &response);
+    CardError classifyUnprotected(const std::vector<octet> &response, boost::optional<std::vector<octet>> &plain);
+    int rekey(bool reselect, CardSecure &card);
+    void noteDeadline();
+
+    template <typename F>
+    auto withDeadline(const Deadline &deadline, F f) {
+        DeadlineScope scope(this->pcsc, deadline);
+        auto result = f();
+        this->noteDeadline();
+        return result;
+    }
+    boost::optional<std::vector<octet>> exchangeSecure(CardSecure &card, const APDU &command);
+    APDU bauthInitCommand(const TerminalKeyPool<L> &pool);
+    bool bauthInitAccepted(const std::vector<octet> &plain);
+    APDU bauthStepCommand(u32 tag, const std::vector<octet> &message, bool last);
+    bool terminalAuthenticated(const std::vector<octet> &plain, TerminalHandshake<L> &handshake, CardSecure &card);
+
+    static constexpr int MAX_RETRIES = 2;
+
+    SecureSlot password;
+    Pwd pwdType;
+    octet channel = 0;
+    bool opened = false;
+    bool authorized = false;
+    CardError lastError = CardError::None;
+    boost::optional<APDU> currentFile;
+    ReadCheckpoint checkpoint;
+    std::function<void(size_t, std::span<const octet>)> readObserver;
+    TerminalKeyPool<L> *terminalPool = nullptr;
+
+    static constexpr size_t HELLO_MAX = 96;
+
+    // Wiped when returned to the arena
+    SecureSlot secure;
+    std::array<octet, HELLO_MAX> helloa{};
 
     bake_settings settings = {.kca = TRUE,
                               .kcb = TRUE,
@@ -60,14 +217,24 @@ private:
                               .helloa_len = 0,
                               .hellob = "",
                               .hellob_len = 0,
-                              .rng = prngEchoStepR,
-                              .rng_state = echo};
+                              .rng = RandomPool::stepR,
+                              .rng_state = nullptr};
 
     PCSC pcsc;
+    // Created by the first read and kept for the session with its I/O thread, destroyed before pcsc
+    std::unique_ptr<CommandPipeline> pipeline;
 
 
     std::shared_ptr<Logger> logger;
 
 };
 
+extern template class BpaceSession<128>;
+extern template class BpaceSession<192>;
+extern template class BpaceSession<256>;
+
+using Bpace = BpaceSession<128>;
+using Bpace192 = BpaceSession<192>;
+using Bpace256 = BpaceSession<256>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef CAPABILITYCACHE_H
+#define CAPABILITYCACHE_H
+
+#include <cardProfile.h>
+#include <logger.h>
+
+#include <boost/optional.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Card profiles persisted between runs, keyed by ATR and reader model
+class CapabilityCache {
+public:
+    static std::shared_ptr<CapabilityCache> getInstance();
+
+    boost::optional<CardProfile> find(const std::string& atr, const std::string& reader);
+    void store(const std::string& atr, const std::string& reader, const CardProfile& profile);
+
+    static std::string readerModel(const std::string& reader);
+    // $CARDLIB_CACHE_DIR, else cardlib under the XDG cache directory, empty when there is no home
+    static std::string directory();
+
+private:
+    CapabilityCache();
+
+    void load();
+    bool save();
+
+    std::string path;
+    std::map<std::string, CardProfile> entries;
+    std::mutex mutex;
+
+    static std::shared_ptr<CapabilityCache> cacheInstance;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
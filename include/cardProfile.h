@@ -0,0 +1,23 @@
+#ifndef CARDPROFILE_H
+#define CARDPROFILE_H
+
+#include <bee2/defs.h>
+
+#include <cstddef>
+#include <vector>
+
+// Max data sizes for a reader/card pair: Nc for commands, Ne for responses
+struct ApduLimits {
+    size_t maxCommand = 255;
+    size_t maxResponse = 256;
+    bool extended = false;
+    bool chaining = false;
+};
+
+struct CardProfile {
+    ApduLimits limits;
+    bool secureMessaging = false;
+    std::vector<std::vector<octet>> applets;
+};
+
+#endif
@@ -3,10 +3,10 @@
 #include <apducmd.h>
 
 
-std::string getDataFirstName(PCSC pcsc);
+std::string getDataFirstName(PCSC& pcsc);
 
-std::string getDataSecondName(PCSC pcsc);
+std::string getDataSecondName(PCSC& pcsc);
 
-std::string getDataSurname(PCSC pcsc);
+std::string getDataSurname(PCSC& pcsc);
 
-std::string getDataGroups(PCSC pcsc);
\ No newline at end of file
+std::string getDataGroups(PCSC& pcsc);
\ No newline at end of file
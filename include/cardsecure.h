@@ -1,22 +1,37 @@
+#ifndef CARDSECURE_H
+#define CARDSECURE_H
+
 #include <apducmd.h>
 #include <bee2/crypto/belt.h>
 #include <bee2/defs.h>
 #include <enums/apduEnum.h>
 #include <logger.h>
+#include <secureArena.h>
 #include <btok.h>
 
 #include <vector>
 
 class CardSecure {
 public:
+    CardSecure() = default;
+    CardSecure(const CardSecure& other);
+    CardSecure& operator=(const CardSecure& other);
+    CardSecure(CardSecure&& other) = default;
+    CardSecure& operator=(CardSecure&& other) = default;
+
     void initSecure(octet key0[32]);
     boost::optional<APDU> APDUEncrypt(APDU command);
+    boost::optional<std::vector<octet>> wrapCommand(const APDU& command);
+    boost::optional<std::vector<octet>> unwrapResponse(const std::vector<octet>& response);
+
+    static size_t plainResponseCapacity(size_t maxResponse);
 private:
-    void* state;
+    SecureSlot state;
 
-    octet key1[32]{}, key2[32]{};
-    __int128_t counter;
+    __int128_t counter = 0;
     
 
     std::shared_ptr<Logger> logger;
-};
\ No newline at end of file
+};
+
+#endif
@@ -2,8 +2,10 @@
 #define CERTHAT_H
 
 #include <bee2/defs.h>
+#include <boost/optional.hpp>
 #include <cstddef>
 #include <algorithm>
+#include <span>
 #include <vector>
 
 class CertHAT {
@@ -11,6 +13,10 @@ class CertHAT {
 public:
     CertHAT(std::vector<octet> objId, std::vector<octet> data);
     std::vector<octet> encode();
+    static boost::optional<CertHAT> decode(std::span<const octet> data);
+
+    const std::vector<octet>& getObjectId() const;
+    const std::vector<octet>& getDiscretionaryData() const;
 
 
 private:
@@ -0,0 +1,110 @@
+#ifndef COMMANDPIPELINE_H
+#define COMMANDPIPELINE_H
+
+#include <bee2/defs.h>
+
+#include <apducmd.h>
+#include <cardsecure.h>
+#include <enums/cardError.h>
+#include <logger.h>
+#include <pcsc.h>
+
+#include <boost/optional.hpp>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Bounded single-producer single-consumer ring, the consumer may block in waitPop()
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool push(T value) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - this->head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        this->items[tail & (N - 1)] = std::move(value);
+        this->tail.store(tail + 1, std::memory_order_release);
+        this->tail.notify_one();
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == this->tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(this->items[head & (N - 1)]);
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    T waitPop() {
+        T value;
+        while (!this->pop(value)) {
+            this->tail.wait(this->head.load(std::memory_order_relaxed), std::memory_order_acquire);
+        }
+        return value;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::array<T, N> items{};
+};
+
+// Per-session pipeline overlapping SM wrapping, card I/O and unwrapping. The calling thread is
+// the crypto stage: it wraps command i+1 and unwraps response i-1 while an I/O thread has command
+// i on the wire. Commands are wrapped strictly in order and each response is unwrapped with a copy
+// of the SM state taken right after its command was wrapped, which is the order the btok counter needs.
+// A session keeps one pipeline, and its I/O thread, for all of its reads.
+class CommandPipeline {
+public:
+    static constexpr size_t MAX_DEPTH = 8;
+
+    explicit CommandPipeline(PCSC& pcsc, size_t depth = 4);
+    ~CommandPipeline();
+
+    CommandPipeline(const CommandPipeline&) = delete;
+    CommandPipeline& operator=(const CommandPipeline&) = delete;
+
+    // next(i) supplies command i or none to end the sequence. onResponse(i, plain) gets the unwrapped
+    // responses in order, none when the exchange failed; returning false stops issuing commands.
+    // Wrapped commands the I/O thread has not sent by then are dropped, and card is set back to the
+    // SM state right after the last command sent, so its counter stays in step with the card's.
+    // Returns the number of responses delivered.
+    size_t run(CardSecure& card,
+               const std::function<boost::optional<APDU>(size_t)>& next,
+               const std::function<bool(size_t, const boost::optional<std::vector<octet>>&)>& onResponse);
+
+    CardError getLastError() const;
+
+private:
+    struct Slot {
+        size_t index = 0;
+        std::vector<octet> command, response;
+        CardSecure context;
+        CardError error = CardError::None;
+        bool sent = false;
+    };
+
+    void ioStage();
+
+    PCSC& pcsc;
+    size_t depth;
+    std::array<Slot, MAX_DEPTH> slots;
+    SpscQueue<Slot*, MAX_DEPTH * 2> toCard, fromCard;
+    std::atomic<bool> stopped{false};
+    CardError lastError = CardError::None;
+    std::thread io;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CVCERTIFICATE_H
+#define CVCERTIFICATE_H
+
+#include <bee2/crypto/belt.h>
+#include <bee2/defs.h>
+
+#include <apducmd.h>
+#include <certHat.h>
+#include <hasher.h>
+#include <logger.h>
+#include <verifier.h>
+
+#include <boost/optional.hpp>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Card-verifiable certificate 7F21 { 7F4E body, 5F37 signature }. All fields are views
+// into the parsed bytes, which must outlive the certificate.
+struct CVCertificate {
+    std::span<const octet> raw;
+    std::span<const octet> body;
+    std::span<const octet> profileId;
+    std::span<const octet> authorityRef;
+    std::span<const octet> publicKeyOid;
+    std::span<const octet> publicKey;
+    std::span<const octet> holderRef;
+    std::span<const octet> chat;
+    std::span<const octet> effectiveDate;
+    std::span<const octet> expirationDate;
+    std::span<const octet> extensions;
+    std::span<const octet> signature;
+
+    static boost::optional<CVCertificate> parse(std::span<const octet> data);
+
+    // Dates are YYMMDD in unpacked BCD, years from 2000, compared as YYYYMMDD
+    static boost::optional<uint32_t> date(std::span<const octet> value);
+    static uint32_t date(std::chrono::system_clock::time_point when);
+
+    boost::optional<CertHAT> getCertHAT() const;
+    bool verify(const std::vector<octet>& issuerPubkey, SignatureVerifier& verifier) const;
+};
+
+// Bounded LRU of signature checks, keyed by the hash of a certificate and its issuer key. The
+// entries keep the references and dates, which are checked on every use, so a cached certificate
+// still expires.
+class CVCertificateCache {
+public:
+    struct Entry {
+        bool verified = false;
+        std::vector<octet> publicKey;
+        std::vector<octet> authorityRef;
+        std::vector<octet> holderRef;
+        // 0 when missing or malformed
+        uint32_t effective = 0;
+        uint32_t expiration = 0;
+    };
+
+    CVCertificateCache(SignatureVerifier& verifier, size_t capacity = 256);
+
+    Entry validate(std::span<const octet> certificate, const std::vector<octet>& issuerPubkey);
+
+    // The anchor is the trust point, e.g. the CVCA: its key checks the first certificate, whose CAR
+    // must be the anchor's holder reference, and each next CAR must be the CHR before it. Every
+    // certificate must be valid on the date of now. Returns the public key of the last one.
+    boost::optional<std::vector<octet>> validateChain(const std::vector<std::span<const octet>>& chain,
+                                                      const std::vector<octet>& anchorPubkey,
+                                                      const std::vector<octet>& anchorRef,
+                                                      std::chrono::system_clock::time_point now);
+
+private:
+    using Key = std::string;
+
+    SignatureVerifier& verifier;
+    size_t capacity;
+
+    std::list<std::pair<Key, Entry>> entries;
+    std::unordered_map<Key, std::list<std::pair<Key, Entry>>::iterator> index;
+    std::mutex mutex;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DAEMONCLIENT_H
+#define DAEMONCLIENT_H
+
+#include <apducmd.h>
+#include <daemonProtocol.h>
+#include <enums/apduEnum.h>
+#include <logger.h>
+
+#include <boost/optional.hpp>
+#include <string>
+#include <vector>
+
+// Client of cardlibd: requests run on sessions the daemon keeps authenticated
+class DaemonClient {
+public:
+    DaemonClient();
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    int connectTo(const std::string& path = defaultDaemonSocket());
+
+    boost::optional<u32> open(const std::string& password, Pwd pwd_type);
+    boost::optional<std::vector<octet>> transmit(u32 session, const APDU& command);
+    boost::optional<std::vector<octet>> readEF(u32 session);
+    boost::optional<std::vector<octet>> sign(u32 session, const std::vector<octet>& digest);
+    bool close(u32 session);
+    // Ends the authenticated session for every client, the next Open runs BPACE again
+    bool terminate(u32 session);
+
+private:
+    boost::optional<std::vector<octet>> request(DaemonOp op, u32 session, const std::vector<octet>& payload);
+
+    int fd = -1;
+    u32 lastSession = 0;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef DAEMONPROTOCOL_H
+#define DAEMONPROTOCOL_H
+
+#include <bee2/defs.h>
+
+#include <boost/optional.hpp>
+#include <string>
+#include <vector>
+
+// Requests and replies share one frame: code (1) | session (4, LE) | length (4, LE) | payload.
+// Close releases the session for the connection, Terminate ends it for every client.
+enum class DaemonOp : octet { Open = 1, Transmit = 2, ReadEF = 3, Sign = 4, Close = 5, Terminate = 6 };
+
+// Busy: the card is held by a session opened with another password that a client still uses
+enum class DaemonStatus : octet { Ok = 0, Error = 1, NoSession = 2, BadRequest = 3, Busy = 4 };
+
+struct DaemonFrame {
+    octet code = 0;
+    u32 session = 0;
+    std::vector<octet> payload;
+};
+
+const size_t DAEMON_HEADER_SIZE = 9;
+const u32 DAEMON_MAX_PAYLOAD = 1 << 20;
+
+bool sendFrame(int fd, const DaemonFrame& frame);
+boost::optional<DaemonFrame> recvFrame(int fd);
+
+std::string defaultDaemonSocket();
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <enums/cardError.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// Point in time by which an operation must finish, copies share one cancel flag so another thread
+// can abort the operation early. The default deadline never expires and cannot be cancelled.
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Deadline() = default;
+
+    static Deadline after(Clock::duration timeout);
+    static Deadline at(Clock::time_point when);
+
+    bool isSet() const;
+    bool expired() const;
+    Clock::time_point getTime() const;
+
+    void cancel() const;
+    bool cancelled() const;
+
+    // DeadlineExceeded or Cancelled once the operation has to stop, None before
+    CardError error() const;
+
+    // Waits until done() holds, the deadline passes or it is cancelled; returns done()
+    template <typename Predicate>
+    bool wait(Predicate done) const {
+        if (this->state == nullptr) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(this->state->mutex);
+        this->state->condition.wait_until(lock, this->when, [&]() { return this->state->cancelled || done(); });
+        return done();
+    }
+
+    // Wakes wait() so it re-checks its predicate, called by whoever makes done() true
+    void notify() const;
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool cancelled = false;
+    };
+
+    Clock::time_point when = Clock::time_point::max();
+    std::shared_ptr<State> state;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef EFCACHE_H
+#define EFCACHE_H
+
+#include <bee2/defs.h>
+
+#include <logger.h>
+
+#include <boost/optional.hpp>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Read-through cache of static EF contents persisted between runs, one file per entry. The
+// MAX_MAPPED most recently used entries stay memory-mapped, older ones are unmapped. A card is identified by its ATR and the first PROBE bytes of
+// the file, which for certificates hold the serial number. Entries are not encrypted, so only
+// EFs allowed explicitly are cached and personal data groups must never be allowed.
+class EfCache {
+public:
+    static std::shared_ptr<EfCache> getInstance();
+
+    static constexpr size_t PROBE = 32;
+    static constexpr size_t MAX_MAPPED = 64;
+
+    void allow(const std::vector<octet>& efId);
+    bool cacheable(const std::vector<octet>& efId);
+
+    static std::string key(const std::string& atr, const std::vector<octet>& efId, std::span<const octet> head);
+
+    boost::optional<std::vector<octet>> find(const std::string& key);
+    bool store(const std::string& key, const std::vector<octet>& data);
+
+    // Checks the cached copy against the last PROBE bytes of the file as read from the card
+    static bool tailMatches(const std::vector<octet>& cached, const std::vector<octet>& tail);
+
+private:
+    EfCache();
+
+    struct Mapping {
+        const octet* data = nullptr;
+        size_t size = 0;
+    };
+
+    boost::optional<Mapping> map(const std::string& key);
+    void unmap(const Mapping& mapping);
+
+    std::string dir;
+    std::set<std::vector<octet>> allowed;
+    using MappedEntry = std::pair<std::string, Mapping>;
+
+    std::list<MappedEntry> lru;
+    std::unordered_map<std::string, std::list<MappedEntry>::iterator> mapped;
+    std::mutex mutex;
+
+    static std::shared_ptr<EfCache> cacheInstance;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
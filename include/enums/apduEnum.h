@@ -13,11 +13,20 @@ const octet OID_EID[] = {0x7F, 0x4C, 0x13, 0x06, 0x0A, 0x2A, 0x70, 0x00, 0x02, 0
 const octet EID_ACCESS[] = {0x04, 0x05, 0x00, 0x00, 0x00, 0x1F, 0x21};
 
 const octet OID_BPACE[] = {0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x42, 0x15};
+const octet OID_BAUTH[] = {0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x42, 0x16};
 
 
 enum class Cla { Default = 0x00, Chained = 0x10, Secure = 0x04, SecureChained = 0x14 };
 
-enum class Instruction { FilesSelect = 0xA4, BPACEInit = 0x22, BPACESteps = 0x86, ReadData = 0xCB    };
+enum class Instruction {
+    FilesSelect = 0xA4,
+    BPACEInit = 0x22,
+    BPACESteps = 0x86,
+    ReadData = 0xCB,
+    ReadBinary = 0xB0,
+    PerformSecurityOperation = 0x2A,
+    ManageChannel = 0x70
+};
 
 enum class Pwd { CAN = 0x02, PIN = 0x03, PUK = 0x04};
 
@@ -0,0 +1,18 @@
+#ifndef CARDERROR_H
+#define CARDERROR_H
+
+// Why the last exchange failed, ordered from the cheapest recovery to the most expensive
+enum class CardError {
+    None,
+    Timeout,
+    Transport,
+    SecureMessaging,
+    CardReset,
+    CardRemoved,
+    ReaderLost,
+    // Not recovered: the caller's deadline passed or it cancelled the operation
+    DeadlineExceeded,
+    Cancelled
+};
+
+#endif
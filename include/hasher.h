@@ -0,0 +1,47 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <bee2/crypto/bash.h>
+#include <bee2/crypto/belt.h>
+#include <bee2/defs.h>
+
+#include <logger.h>
+#include <threadPool.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+enum class HashAlg { BeltHash, Bash256, Bash384, Bash512 };
+
+// Incremental belt-hash / bash-hash
+class Hasher {
+public:
+    explicit Hasher(HashAlg alg = HashAlg::BeltHash);
+
+    void update(const octet* data, size_t len);
+    std::vector<octet> finish();
+
+    static size_t hashLength(HashAlg alg);
+
+private:
+    HashAlg alg;
+    std::vector<octet> state;
+};
+
+// Hashes files on a pool of workers, a file is memory-mapped or read in large aligned blocks
+class DocumentHasher {
+public:
+    explicit DocumentHasher(size_t threads = 0);
+
+    std::shared_future<std::vector<octet>> hashFile(const std::string& path, HashAlg alg = HashAlg::BeltHash);
+    std::vector<std::shared_future<std::vector<octet>>> hashFiles(const std::vector<std::string>& paths,
+                                                                  HashAlg alg = HashAlg::BeltHash);
+
+    static std::vector<octet> hashFileSync(const std::string& path, HashAlg alg = HashAlg::BeltHash);
+
+private:
+    ThreadPool pool;
+};
+
+#endif
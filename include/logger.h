@@ -22,7 +22,7 @@ public:
     LogLevel setLogLevel(const std::string& logLevel);
 
 private:
-    LogLevel logLevel;
+    LogLevel logLevel = LogLevel::DEBUG;
     LogOutput logOutput = LogOutput::CONSOLE;
     std::ofstream logFile;
 
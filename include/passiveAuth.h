@@ -0,0 +1,87 @@
+#ifndef PASSIVEAUTH_H
+#define PASSIVEAUTH_H
+
+#include <bee2/defs.h>
+
+#include <hasher.h>
+#include <logger.h>
+#include <threadPool.h>
+#include <verifier.h>
+
+#include <boost/optional.hpp>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Document security object EF.SOD: CMS SignedData over the LDS security object, which lists the
+// hash of every data group. All fields are views into the parsed bytes, which must outlive it.
+struct SecurityObject {
+    HashAlg groupHash;
+    std::map<int, std::span<const octet>> groupHashes;
+    std::span<const octet> content;
+    HashAlg digestHash;
+    std::string digestOid;
+    std::span<const octet> signedAttrs;
+    std::span<const octet> messageDigest;
+    std::span<const octet> signature;
+
+    static boost::optional<SecurityObject> parse(std::span<const octet> data);
+
+    // Checks the message digest of the content and the bign signature of the document signer
+    bool verify(const std::vector<octet>& signerPubkey, SignatureVerifier& verifier) const;
+};
+
+// Passive authentication of data groups. The signature of the security object is checked on the
+// pool as soon as it is loaded, and data groups are hashed as their chunks arrive from the card,
+// so little more than the last block is left to hash once a read ends. Whole data groups are
+// hashed in parallel on the pool.
+class PassiveAuthenticator {
+public:
+    explicit PassiveAuthenticator(SignatureVerifier& verifier, size_t threads = 0);
+    ~PassiveAuthenticator();
+
+    // Called before the data groups are read. The signer key comes from a trusted source, e.g. a
+    // chain checked by CVCertificateCache.
+    bool load(std::vector<octet> securityObject, const std::vector<octet>& signerPubkey);
+    bool signatureValid();
+
+    // Chunk of a data group at its offset in the file, a read that starts over begins at 0 again
+    void update(int group, size_t offset, std::span<const octet> chunk);
+
+    // Verdict on the chunks passed to update() since the group was last read from offset 0, so
+    // it covers exactly what came from the card. False if the read left a gap.
+    bool checkRead(int group);
+
+    // Hashes the data given
+    bool check(int group, std::span<const octet> data);
+    std::vector<bool> checkBatch(const std::vector<std::pair<int, std::vector<octet>>>& groups);
+
+private:
+    struct Digest {
+        std::mutex mutex;
+        boost::optional<Hasher> hasher;
+        size_t hashed = 0;
+    };
+
+    bool matches(int group, const std::vector<octet>& hash) const;
+    std::vector<octet> hashGroup(std::span<const octet> data) const;
+    Digest* digest(int group);
+
+    SignatureVerifier& verifier;
+    ThreadPool pool;
+
+    std::vector<octet> raw;
+    boost::optional<SecurityObject> object;
+    std::shared_future<bool> signature;
+    std::map<int, std::unique_ptr<Digest>> digests;
+    std::mutex mutex;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -4,31 +4,134 @@
 #include <pcsc-lite/winscard.h>
 #include <bee2/defs.h>
 #include <bee2/core/apdu.h>
+#include <apducmd.h>
+#include <atr.h>
+#include <cardProfile.h>
+#include <deadline.h>
+#include <enums/cardError.h>
 #include <logger.h>
+#include <pcscRegistry.h>
+#include <tracer.h>
+#include <transmitWorker.h>
 #include <stdio.h>
 
+#include <boost/optional.hpp>
+#include <atomic>
 #include <cstddef>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+// Stand-in for SCardTransmit, e.g. an in-process card
+class CardTransport {
+public:
+    virtual ~CardTransport() = default;
+    virtual std::vector<octet> transmit(const std::vector<octet>& cmd) = 0;
+    virtual ApduLimits getLimits() {
+        return ApduLimits();
+    }
+    virtual int reconnect(bool /* reset */) {
+        return 0;
+    }
+    // ATR of the card behind the transport, it identifies the card to the caches
+    virtual boost::optional<ATR> getATR() {
+        return boost::none;
+    }
+};
+
+// Construction does no I/O, the reader is connected by connect() or on first use. Copies share
+// the card handle, which is closed when the last of them is gone.
 class PCSC {
 public:
     PCSC();
+    explicit PCSC(std::shared_ptr<CardTransport> transport);
+    PCSC(const PCSC& other);
+
+    int connect();
+    std::future<int> connectAsync();
+    bool isConnected() const;
+
+    int reconnect(bool reset);
+    int reestablish();
+    CardError getLastError() const;
+    static CardError classify(LONG result);
+
+    // Charges the spans that follow on this thread to this reader and session
+    void traceContext() const;
+
     int initPCSC();
     int checkReaderStatus();
+    int discoverLimits();
+    const ApduLimits& getLimits() const;
+    const CardProfile& getProfile() const;
+    const boost::optional<ATR>& getATR() const;
+    std::string getReaderName() const;
+    void addApplet(const std::vector<octet>& aid);
+    void setSecureMessaging(bool supported);
+    uint64_t getTransmitCount() const;
+
+    // MANAGE CHANNEL on the basic channel, returns the channel the card opened or -1
+    int openChannel();
+    bool closeChannel(octet channel);
 
     std::vector<octet> sendCommandToCard(std::vector<octet> cmd);
+    std::vector<octet> sendCommandToCard(std::vector<octet> cmd, const Deadline& deadline);
+
+    // Exchanges wait at most until this deadline, see DeadlineScope
+    void setDeadline(const Deadline& deadline);
+    const Deadline& getDeadline() const;
+    std::vector<octet> sendCommandChained(const APDU& command);
     std::shared_ptr<apdu_resp_t> decodeResponse(std::vector<octet> response);
 
 private:
-    SCARDCONTEXT hContext;
-    LPTSTR mszReaders;
-    DWORD dwReaders, dwActiveProtocol, dwReaderState;
-    SCARDHANDLE hCard;
-    SCARD_IO_REQUEST pioSendPci;
+    std::vector<octet> transmitDirect(std::vector<octet> cmd);
+    std::vector<octet> transmitGuarded(std::vector<octet> cmd);
+    void abandonConnection();
+
+    boost::optional<DWORD> readerMaxApduSize();
+    bool probeExtendedApdu();
+    void saveProfile();
+
+    std::shared_ptr<CardHandle> handle;
+    DWORD dwReaderState;
     BYTE pbAtr[MAX_ATR_SIZE];
+    DWORD dwAtrLen = 0;
+
+    boost::optional<ATR> atr;
+    ApduLimits limits;
+    CardProfile profile;
+    std::vector<octet> rxBuffer;
+
+    std::shared_ptr<CardTransport> transport;
+    bool connected = false;
+    CardError lastError = CardError::None;
+    uint32_t traceReader = 0;
+    uint32_t traceSession = 0;
+    Deadline deadline;
+    // Runs the guarded exchanges, not shared with copies
+    std::unique_ptr<TransmitWorker> worker;
+    std::mutex connectMutex;
+    std::atomic<uint64_t> transmitCount{0};
 
     std::shared_ptr<Logger> logger;
 
 };
 
-#endif
\ No newline at end of file
+// Applies a deadline to every exchange on the connection until the scope ends, so a multi-APDU
+// flow such as BPACE is bounded as a whole. The previous deadline is restored on exit.
+class DeadlineScope {
+public:
+    DeadlineScope(PCSC& pcsc, const Deadline& deadline);
+    ~DeadlineScope();
+
+    DeadlineScope(const DeadlineScope&) = delete;
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+private:
+    PCSC& pcsc;
+    Deadline previous;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef PCSCREGISTRY_H
+#define PCSCREGISTRY_H
+
+#include <pcsc-lite/winscard.h>
+
+#include <logger.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Connection to one reader shared by every PCSC on it. The last reference disconnects and
+// releases the context, leaving the card as is unless the connection was abandoned.
+class CardHandle {
+public:
+    ~CardHandle();
+
+    CardHandle(const CardHandle&) = delete;
+    CardHandle& operator=(const CardHandle&) = delete;
+
+    SCARDHANDLE get() const;
+    SCARDCONTEXT getContext() const;
+    const std::string& getReaderName() const;
+    DWORD getProtocol() const;
+    const SCARD_IO_REQUEST* getSendPci() const;
+
+    // A reset drops the card state of every PCSC sharing the handle
+    LONG reconnect(bool reset);
+
+    // Used when a command may still be running on the card: the card is reset on release and the
+    // registry no longer hands the handle out. Nothing interrupts the exchange itself, SCardCancel
+    // only ends SCardGetStatusChange, so it runs until the card answers.
+    void abandon();
+    bool isValid() const;
+
+    // Disconnects and releases the context now rather than with the last reference. pcsc-lite
+    // serializes the calls on a context, so this waits for an exchange still in progress.
+    void release();
+
+private:
+    friend class PcscRegistry;
+    CardHandle(SCARDCONTEXT context, SCARDHANDLE card, std::string readerName, DWORD protocol);
+
+    SCARDCONTEXT context;
+    SCARDHANDLE card;
+    std::string readerName;
+    std::atomic<DWORD> protocol;
+    std::atomic<DWORD> disposition{SCARD_LEAVE_CARD};
+    std::atomic<bool> valid{true};
+    std::atomic<bool> released{false};
+};
+
+// Process-wide owner of PC/SC resources. One context enumerates readers, and card handles are
+// kept per reader name for as long as someone references them. Every handle brings its own
+// context because pcsc-lite serializes the calls made on one context, which would make readers
+// wait for each other.
+class PcscRegistry {
+public:
+    static std::shared_ptr<PcscRegistry> getInstance();
+    ~PcscRegistry();
+
+    // An empty name picks the first reader, an existing handle to the reader is shared
+    LONG connect(const std::string& reader, std::shared_ptr<CardHandle>& handle);
+    LONG listReaders(std::vector<std::string>& readers);
+
+    // Stops handing out a handle that went bad, its holders keep it until they reconnect
+    void forget(const std::shared_ptr<CardHandle>& handle);
+    size_t openHandles();
+
+private:
+    PcscRegistry();
+
+    LONG establish();
+    LONG listReadersLocked(std::vector<std::string>& readers);
+
+    SCARDCONTEXT context;
+    bool established = false;
+    std::map<std::string, std::weak_ptr<CardHandle>> handles;
+    std::mutex mutex;
+
+    static std::shared_ptr<PcscRegistry> registryInstance;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
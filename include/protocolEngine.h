@@ -0,0 +1,243 @@
+#ifndef PROTOCOLENGINE_H
+#define PROTOCOLENGINE_H
+
+#include <bee2/defs.h>
+
+#include <pcsc.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Per-thread free lists of coroutine frames in 256-byte size classes, a conversation
+// allocates its frames once and reuses them for every later session on the same thread
+class FramePool {
+public:
+    static void* allocate(size_t size);
+    static void deallocate(void* frame, size_t size) noexcept;
+
+    static const size_t GRANULE = 256;
+    static const size_t CLASSES = 32;
+    static const size_t MAX_CACHED = 4096;
+};
+
+// Lazily started coroutine returning T, awaiting it runs the body and resumes the caller on completion
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        auto final_suspend() noexcept {
+            struct Resume {
+                bool await_ready() noexcept {
+                    return false;
+                }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    auto continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return Resume{};
+        }
+        void return_value(T result) {
+            this->value = std::move(result);
+        }
+        void unhandled_exception() {
+            this->error = std::current_exception();
+        }
+
+        static void* operator new(size_t size) {
+            return FramePool::allocate(size);
+        }
+        static void operator delete(void* frame, size_t size) noexcept {
+            FramePool::deallocate(frame, size);
+        }
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (this->handle) {
+            this->handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        this->handle.promise().continuation = caller;
+        return this->handle;
+    }
+    T await_resume() {
+        if (this->handle.promise().error) {
+            std::rethrow_exception(this->handle.promise().error);
+        }
+        return std::move(*this->handle.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Single-threaded scheduler for card conversations. Coroutines run on the thread calling run();
+// blocking PC/SC calls are handed to I/O threads and the coroutine is resumed on the loop when
+// they complete. Operations live in the suspended frame and are queued intrusively, so an APDU
+// round trip does not allocate. At most one conversation may use a given PCSC at a time.
+// An I/O thread is held for the whole PC/SC call, so exchanges beyond the number of I/O threads
+// wait for one to finish: give the loop at least one per reader used at the same time. The
+// default is one per hardware thread.
+class EventLoop {
+public:
+    struct Operation {
+        virtual ~Operation() = default;
+        virtual void execute() {}
+
+        Operation* next = nullptr;
+        std::coroutine_handle<> handle;
+    };
+
+    struct Exchange : Operation {
+        Exchange(EventLoop& loop, PCSC& pcsc, std::vector<octet> command)
+            : loop(loop), pcsc(pcsc), command(std::move(command)) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> caller) {
+            this->handle = caller;
+            this->loop.submit(this);
+        }
+        std::vector<octet> await_resume() {
+            this->pcsc.traceContext();
+            return std::move(this->response);
+        }
+        void execute() override {
+            this->response = this->pcsc.sendCommandToCard(std::move(this->command));
+        }
+
+        EventLoop& loop;
+        PCSC& pcsc;
+        std::vector<octet> command, response;
+    };
+
+    struct Connect : Operation {
+        Connect(EventLoop& loop, PCSC& pcsc) : loop(loop), pcsc(pcsc) {}
+
+        bool await_ready() const noexcept {
+            return this->pcsc.isConnected();
+        }
+        void await_suspend(std::coroutine_handle<> caller) {
+            this->handle = caller;
+            this->loop.submit(this);
+        }
+        int await_resume() {
+            this->pcsc.traceContext();
+            return this->result;
+        }
+        void execute() override {
+            this->result = this->pcsc.connect();
+        }
+
+        EventLoop& loop;
+        PCSC& pcsc;
+        int result = 0;
+    };
+
+    explicit EventLoop(size_t ioThreads = 0);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    Exchange transmit(PCSC& pcsc, std::vector<octet> command);
+    Connect connect(PCSC& pcsc);
+
+    // Starts the task on the loop, onDone(result) is called on the loop thread when it finishes
+    template <typename T, typename F>
+    void spawn(Task<T> task, F onDone) {
+        this->active++;
+        auto root = [](EventLoop* loop, Task<T> task, F onDone) -> Detached {
+            onDone(co_await task);
+            loop->finish();
+        }(this, std::move(task), std::move(onDone));
+        root.operation->handle = root.handle;
+        this->post(root.operation);
+    }
+
+    // Runs until every spawned task has finished or stop() is called
+    void run();
+    void stop();
+    size_t pending() const;
+
+private:
+    struct Detached {
+        struct promise_type {
+            Operation operation;
+
+            Detached get_return_object() {
+                return {std::coroutine_handle<promise_type>::from_promise(*this), &this->operation};
+            }
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+            void return_void() {}
+            void unhandled_exception() {
+                std::terminate();
+            }
+
+            static void* operator new(size_t size) {
+                return FramePool::allocate(size);
+            }
+            static void operator delete(void* frame, size_t size) noexcept {
+                FramePool::deallocate(frame, size);
+            }
+        };
+
+        std::coroutine_handle<> handle;
+        Operation* operation;
+    };
+
+    void post(Operation* operation);
+    void submit(Operation* operation);
+    void finish();
+    void ioWorker();
+
+    std::vector<std::thread> ioThreads;
+
+    std::mutex readyMutex;
+    std::condition_variable readyCondition;
+    Operation *readyHead = nullptr, *readyTail = nullptr;
+
+    std::mutex ioMutex;
+    std::condition_variable ioCondition;
+    Operation *ioHead = nullptr, *ioTail = nullptr;
+
+    std::atomic<size_t> active{0};
+    std::atomic<bool> stopping{false};
+};
+
+#endif
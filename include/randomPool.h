@@ -0,0 +1,62 @@
+#ifndef RANDOMPOOL_H
+#define RANDOMPOOL_H
+
+#include <bee2/defs.h>
+
+#include <logger.h>
+#include <secureArena.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+// Random source for bake and bign. Every thread draws from its own brngCTR generator (belt in
+// counter mode) through a buffer in locked memory, so concurrent sessions share no generator and
+// a request costs a copy rather than a getrandom syscall. Generators are keyed from a reservoir of
+// OS entropy that a background thread keeps topped up, and rekey after RESEED_BYTES of output
+// and in the child of a fork().
+class RandomPool {
+public:
+    static RandomPool& getInstance();
+
+    // gen_i callback for bake_settings.rng and bign, the state argument is unused
+    static void stepR(void* buf, size_t count, void* state);
+
+    void generate(void* buf, size_t count);
+
+    static const size_t SEED = 64;
+    static const size_t BUFFER = 4096;
+    static const size_t RESEED_BYTES = 1 << 20;
+    static const size_t RESERVOIR = 32;
+
+private:
+    RandomPool();
+
+    static void beforeFork();
+    static void afterForkParent();
+    static void afterForkChild();
+
+    struct Generator {
+        SecureSlot slot;
+        size_t available = 0;
+        size_t produced = 0;
+        unsigned generation = 0;
+    };
+
+    Generator& local();
+    void rekey(Generator& generator);
+    void takeSeed(octet* seed);
+    void refill();
+    void osEntropy(octet* buf, size_t count);
+
+    std::mutex mutex;
+    std::condition_variable drained;
+    SecureSlot reservoir;
+    size_t seeds = 0;
+    unsigned generation = 0;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef READCHECKPOINT_H
+#define READCHECKPOINT_H
+
+#include <bee2/defs.h>
+
+#include <logger.h>
+
+#include <boost/optional.hpp>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Data of an interrupted EF read, kept so the next read of the file continues from the last
+// confirmed offset. It is only used for the same card and file, and the bytes just before the
+// offset are read again and compared before anything is appended. Held in memory only and wiped
+// when dropped.
+class ReadCheckpoint {
+public:
+    static constexpr size_t OVERLAP = 16;
+
+    ReadCheckpoint();
+    ~ReadCheckpoint();
+
+    ReadCheckpoint(const ReadCheckpoint&) = delete;
+    ReadCheckpoint& operator=(const ReadCheckpoint&) = delete;
+
+    void save(const std::string& card, const std::vector<octet>& efId, std::vector<octet> data);
+    void clear();
+
+    // Offset and length of the read that confirms the prefix, none without a usable checkpoint
+    boost::optional<std::pair<size_t, size_t>> overlap(const std::string& card, const std::vector<octet>& efId);
+
+    // The prefix if the bytes read again match it, the checkpoint is dropped either way
+    std::vector<octet> resume(const std::vector<octet>& reread);
+
+private:
+    std::string card;
+    std::vector<octet> efId;
+    std::vector<octet> data;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef READERSCHEDULER_H
+#define READERSCHEDULER_H
+
+#include <bee2/defs.h>
+
+#include <logger.h>
+#include <pcsc.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ReaderScheduler;
+
+// Transport of one logical session on a shared reader, each exchange waits for its turn. The
+// session's exchanges share its turn, so it serves one connection.
+class ScheduledTransport : public CardTransport {
+public:
+    ~ScheduledTransport() override;
+
+    std::vector<octet> transmit(const std::vector<octet>& cmd) override;
+    ApduLimits getLimits() override;
+    boost::optional<ATR> getATR() override;
+    // A reset drops the card state of every session on the reader
+    int reconnect(bool reset) override;
+
+    // Keeps the reader for this session across several exchanges, e.g. command chaining or a
+    // sequence other sessions on the same channel must not split. Calls nest.
+    void hold();
+    void release();
+
+private:
+    friend class ReaderScheduler;
+    ScheduledTransport(std::shared_ptr<ReaderScheduler> scheduler, uint32_t flow);
+
+    std::shared_ptr<ReaderScheduler> scheduler;
+    uint32_t flow;
+};
+
+// Holds the reader for a session until the batch goes out of scope
+class ReaderBatch {
+public:
+    explicit ReaderBatch(ScheduledTransport& transport);
+    ~ReaderBatch();
+
+    ReaderBatch(const ReaderBatch&) = delete;
+    ReaderBatch& operator=(const ReaderBatch&) = delete;
+
+private:
+    ScheduledTransport& transport;
+};
+
+// Per-reader arbiter for sessions sharing one card. Higher priority classes always go first,
+// within a class sessions share reader time by weighted fair queueing on measured card time, and
+// a session's exchanges keep their order. The reader is granted per exchange or per batch and is
+// never taken away mid-batch, so an interactive exchange waits for at most one lower-priority
+// exchange or batch; background jobs should keep their batches short. A session that is still
+// ahead when its exchange ends keeps the reader for ANTICIPATION, so a caller issuing exchanges
+// back to back is not taken for idle in between and keeps its share.
+class ReaderScheduler : public std::enable_shared_from_this<ReaderScheduler> {
+public:
+    enum class Priority { Interactive, Normal, Background };
+
+    static std::shared_ptr<ReaderScheduler> create(std::shared_ptr<PCSC> reader);
+
+    static constexpr std::chrono::microseconds ANTICIPATION{500};
+
+    std::shared_ptr<ScheduledTransport> session(Priority priority, uint32_t weight = 1);
+    void setPriority(const ScheduledTransport& transport, Priority priority);
+
+    PCSC& getReader();
+
+private:
+    explicit ReaderScheduler(std::shared_ptr<PCSC> reader);
+
+    struct Flow {
+        Priority priority;
+        double weight;
+        double tag = 0;
+        size_t waiting = 0;
+        size_t holds = 0;
+    };
+
+    friend class ScheduledTransport;
+    void acquire(uint32_t flow);
+    void release(uint32_t flow);
+    void close(uint32_t flow);
+    bool eligible(uint32_t flow) const;
+    bool ahead(uint32_t flow) const;
+    bool blocked(uint32_t flow) const;
+
+    std::shared_ptr<PCSC> reader;
+    std::map<uint32_t, Flow> flows;
+    uint32_t nextFlow = 1;
+    uint32_t owner = 0;
+    double virtualTime = 0;
+    std::chrono::steady_clock::time_point grantedAt;
+    uint32_t reserved = 0;
+    std::chrono::steady_clock::time_point reservedUntil;
+    std::mutex mutex;
+    std::condition_variable turn;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SECUREARENA_H
+#define SECUREARENA_H
+
+#include <bee2/core/mem.h>
+#include <bee2/defs.h>
+
+#include <logger.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class SecureArena;
+
+// Slot of locked memory, wiped and returned to the arena on destruction
+class SecureSlot {
+public:
+    SecureSlot() = default;
+    SecureSlot(SecureSlot&& other) noexcept;
+    SecureSlot& operator=(SecureSlot&& other) noexcept;
+    ~SecureSlot();
+
+    SecureSlot(const SecureSlot&) = delete;
+    SecureSlot& operator=(const SecureSlot&) = delete;
+
+    octet* data() const;
+    size_t size() const;
+    explicit operator bool() const;
+
+private:
+    friend class SecureArena;
+    SecureSlot(octet* ptr, size_t len);
+
+    octet* ptr = nullptr;
+    size_t len = 0;
+};
+
+// Slab allocator for key material: slots are mlock'ed, excluded from core dumps
+// and separated by PROT_NONE guard pages. Slots of one size class are reused.
+class SecureArena {
+public:
+    static SecureArena& getInstance();
+
+    SecureSlot acquire(size_t size);
+
+private:
+    SecureArena();
+
+    struct Pool {
+        std::vector<octet*> free;
+        size_t slots = 0;
+    };
+
+    friend class SecureSlot;
+    void release(octet* ptr, size_t len);
+    bool grow(Pool& pool, size_t pages);
+
+    size_t pageSize;
+    std::map<size_t, Pool> pools;
+    std::mutex mutex;
+    bool lockWarned = false;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SIGNER_H
+#define SIGNER_H
+
+#include <bee2/crypto/belt.h>
+#include <bee2/defs.h>
+
+#include <apducmd.h>
+#include <cardsecure.h>
+#include <logger.h>
+#include <pcsc.h>
+#include <threadPool.h>
+
+#include <boost/optional.hpp>
+#include <future>
+#include <vector>
+
+// Signs with the eSign applet over an established SM session (BPACE with PIN).
+// The next digest is computed while the card signs the current one, commands are wrapped in send
+// order so the SM counter stays in step with the card.
+class Signer {
+public:
+    Signer(PCSC& pcsc, CardSecure& card, octet channel = 0);
+
+    boost::optional<std::vector<octet>> sign(const std::vector<octet>& digest);
+    std::vector<boost::optional<std::vector<octet>>> signDigests(const std::vector<std::vector<octet>>& digests);
+    std::vector<boost::optional<std::vector<octet>>> signDigests(
+        const std::vector<std::shared_future<std::vector<octet>>>& digests);
+    std::vector<boost::optional<std::vector<octet>>> signDocuments(
+        const std::vector<std::vector<octet>>& documents);
+
+private:
+    boost::optional<std::vector<octet>> wrap(const std::vector<octet>& digest);
+    boost::optional<std::vector<octet>> complete(const std::vector<octet>& response);
+
+    template <typename Source>
+    std::vector<boost::optional<std::vector<octet>>> signBatch(size_t count, Source source);
+
+    PCSC& pcsc;
+    CardSecure& card;
+    octet channel;
+    ThreadPool worker;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef TERMINALAUTH_H
+#define TERMINALAUTH_H
+
+#include <bee2/crypto/bake.h>
+#include <bee2/crypto/bign.h>
+#include <bee2/defs.h>
+#include <btok.h>
+
+#include <bpace.h>
+#include <logger.h>
+#include <randomPool.h>
+#include <secureArena.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// BAUTH message lengths on the terminal side for security level l
+template <size_t L>
+struct BauthLevel {
+    static constexpr size_t KEY = 32;
+    // Terminal ephemeral public key
+    static constexpr size_t M1 = L / 2;
+    static constexpr size_t M2 = L / 2 + 8;
+    // Message 3 without the terminal certificate it carries
+    static constexpr size_t M3 = L / 4 + 8;
+    static constexpr size_t PUBKEY = L / 2;
+    // key | message 1 | BAUTH state of btokBAUTHT_keep(l) bytes
+    static size_t slot() {
+        static const size_t size = KEY + M1 + btokBAUTHT_keep(L);
+        return size;
+    }
+};
+
+template <size_t L>
+class TerminalKeyPool;
+
+// One terminal-side BAUTH run whose ephemeral key pair is already drawn, so only the steps
+// that depend on the card are left. key | message 1 | bake state inside a secure slot.
+template <size_t L>
+class TerminalHandshake {
+public:
+    using Level = BauthLevel<L>;
+
+    TerminalHandshake() = default;
+
+    explicit operator bool() const;
+
+    std::vector<octet> message1() const;
+    std::vector<octet> message3(const std::vector<octet> &message2);
+    bool deriveKey(octet key[32]);
+
+private:
+    friend class TerminalKeyPool<L>;
+    TerminalHandshake(SecureSlot slot, size_t message3Size);
+
+    octet *key() const;
+    octet *out() const;
+    void *state() const;
+
+    SecureSlot slot;
+    size_t message3Size = 0;
+};
+
+// Terminal credentials with a stock of prepared handshakes that a background thread keeps at
+// capacity. The pool must outlive every handshake taken from it and every session using it.
+template <size_t L>
+class TerminalKeyPool {
+public:
+    using Level = BauthLevel<L>;
+
+    TerminalKeyPool(const std::vector<octet> &privateKey, std::vector<octet> certificate, size_t capacity = 8);
+    ~TerminalKeyPool();
+
+    TerminalKeyPool(const TerminalKeyPool &) = delete;
+    TerminalKeyPool &operator=(const TerminalKeyPool &) = delete;
+
+    bool isValid() const;
+
+    // A prepared handshake, computed on the calling thread when the stock has run out
+    TerminalHandshake<L> take();
+    size_t ready();
+
+    const std::vector<octet> &getHolderRef() const;
+
+private:
+    TerminalHandshake<L> prepare();
+    void refill();
+
+    static const bign_params *curveParams();
+    static err_t certPublicKey(octet *pubkey, const bign_params *params, const octet *data, size_t len);
+
+    SecureSlot privateKey;
+    std::vector<octet> certificate;
+    std::vector<octet> holderRef;
+    bake_cert cert{};
+    bake_settings settings = {.kca = TRUE,
+                              .kcb = TRUE,
+                              .helloa = "",
+                              .helloa_len = 0,
+                              .hellob = "",
+                              .hellob_len = 0,
+                              .rng = RandomPool::stepR,
+                              .rng_state = nullptr};
+    bool valid = false;
+
+    size_t capacity;
+    std::deque<TerminalHandshake<L>> stock;
+    std::mutex mutex;
+    std::condition_variable taken;
+    bool stopping = false;
+    std::thread worker;
+
+    std::shared_ptr<Logger> logger;
+};
+
+extern template class TerminalHandshake<128>;
+extern template class TerminalHandshake<192>;
+extern template class TerminalHandshake<256>;
+extern template class TerminalKeyPool<128>;
+extern template class TerminalKeyPool<192>;
+extern template class TerminalKeyPool<256>;
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Chrome trace-event recording of card sessions, off until start() or $CARDLIB_TRACE=<file>.
+// Spans are appended to a preallocated buffer by an atomic cursor and written out by stop() as
+// JSON that Perfetto and chrome://tracing load. Each reader is a process and each session a
+// thread on the timeline, span names carry both ids. A span is charged to the ids set on its
+// thread when it ends, so a span around connecting already knows its reader.
+struct TraceEvent {
+    std::atomic<bool> ready{false};
+    const char* name = nullptr;
+    uint64_t start = 0;
+    uint64_t duration = 0;
+    uint32_t reader = 0;
+    uint32_t session = 0;
+    uint32_t thread = 0;
+};
+
+class Tracer {
+public:
+    static Tracer& getInstance();
+
+    bool start(const std::string& path, size_t capacity = 1 << 20);
+    bool stop();
+
+    bool enabled() const {
+        return this->active.load(std::memory_order_relaxed);
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end, uint32_t reader, uint32_t session);
+    uint64_t now() const;
+    size_t dropped() const;
+
+    uint32_t readerId(const std::string& readerName);
+    static uint32_t nextSessionId();
+
+    // Ids charged to spans opened on this thread until the next call
+    static void setContext(uint32_t reader, uint32_t session);
+
+private:
+    Tracer() = default;
+
+    bool write();
+    void drain() const;
+
+    std::atomic<bool> active{false};
+    std::atomic<size_t> recording{0};
+    std::string path;
+    std::unique_ptr<TraceEvent[]> events;
+    size_t capacity = 0;
+    std::atomic<size_t> cursor{0};
+    std::atomic<size_t> overflow{0};
+    uint64_t origin = 0;
+
+    std::mutex readersMutex;
+    std::vector<std::string> readers;
+};
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    uint64_t start = 0;
+};
+
+// Runs f inside a span named name and returns its result
+template <typename F>
+auto traced(const char* name, F&& f) {
+    TraceSpan span(name);
+    return f();
+}
+
+#define CARDLIB_TRACE_CONCAT_(a, b) a##b
+#define CARDLIB_TRACE_CONCAT(a, b) CARDLIB_TRACE_CONCAT_(a, b)
+#define CARDLIB_TRACE_SPAN(name) TraceSpan CARDLIB_TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef TRANSMITWORKER_H
+#define TRANSMITWORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Long-lived thread running the deadline-guarded exchanges of one connection, one at a time.
+// A worker whose exchange was given up on is retired: it finishes the exchange, runs the teardown
+// it was handed and exits. Retired workers still stuck in an exchange are capped process-wide.
+class TransmitWorker {
+public:
+    static const size_t MAX_RETIRED = 4;
+
+    TransmitWorker();
+    ~TransmitWorker();
+
+    TransmitWorker(const TransmitWorker&) = delete;
+    TransmitWorker& operator=(const TransmitWorker&) = delete;
+
+    void post(std::function<void()> job);
+
+    // Called by the caller that gave up on the running job. Returns false if the job has already
+    // returned, the caller then runs the teardown itself.
+    bool retire(std::function<void()> teardown);
+
+    static size_t retired();
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::function<void()> job;
+        std::function<void()> teardown;
+        bool running = false;
+        bool retired = false;
+        bool stopping = false;
+    };
+
+    static void run(std::shared_ptr<State> state);
+
+    std::shared_ptr<State> state;
+    std::thread thread;
+};
+
+#endif
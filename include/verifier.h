@@ -0,0 +1,61 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <bee2/crypto/belt.h>
+#include <bee2/crypto/bign.h>
+#include <bee2/defs.h>
+
+#include <logger.h>
+#include <threadPool.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// belt-hash, the hash function of signatures made by the card
+const char OID_BELT_HASH[] = "1.2.112.0.2.0.34.101.31.81";
+
+struct VerifyRequest {
+    std::vector<octet> pubkey;
+    std::vector<octet> hash;
+    std::vector<octet> signature;
+    std::string hashOid = OID_BELT_HASH;
+};
+
+// bign verification spread across a thread pool. Everything derived from a public key
+// alone (curve parameters, key validation) is computed once and cached by key hash.
+class SignatureVerifier {
+public:
+    explicit SignatureVerifier(size_t threads = 0, size_t maxKeys = 1024);
+
+    bool verify(const VerifyRequest& request);
+    std::vector<bool> verifyBatch(const std::vector<VerifyRequest>& requests);
+
+private:
+    struct KeyContext {
+        bign_params params;
+        bool valid;
+    };
+
+    std::shared_ptr<const KeyContext> keyContext(const std::vector<octet>& pubkey);
+    std::shared_ptr<const std::vector<octet>> oidDer(const std::string& oid);
+
+    ThreadPool pool;
+    size_t maxKeys;
+
+    using KeyEntry = std::pair<std::string, std::shared_ptr<const KeyContext>>;
+
+    std::list<KeyEntry> lru;
+    std::unordered_map<std::string, std::list<KeyEntry>::iterator> keys;
+    std::mutex keyMutex;
+    std::unordered_map<std::string, std::shared_ptr<const std::vector<octet>>> oids;
+    std::shared_mutex mutex;
+
+    std::shared_ptr<Logger> logger;
+};
+
+#endif
@@ -4,8 +4,14 @@
 
 int main() {
     Bpace bpace = Bpace("334780", Pwd::CAN);
+    if (bpace.open() != ERR_OK) {
+        return 1;
+    }
     std::cout << bpace.authorize() << std::endl;
     bpace.getName();
+    if (AllocStats::enabled()) {
+        std::cout << AllocStats::report();
+    }
     // CardSecure card = CardSecure();
     // card.initSecure(bpace.getKey().data());
 
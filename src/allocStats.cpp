@@ -0,0 +1,165 @@
+#include <allocStats.h>
+#include <logger.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+struct AtomicCounters {
+    std::atomic<size_t> allocs{0};
+    std::atomic<size_t> frees{0};
+    std::atomic<size_t> bytes{0};
+};
+
+static AtomicCounters counters[static_cast<size_t>(AllocSite::Count)];
+static thread_local AllocSite currentSite = AllocSite::Other;
+
+AllocScope::AllocScope(AllocSite site) : previous(currentSite) {
+    currentSite = site;
+}
+
+AllocScope::~AllocScope() {
+    currentSite = this->previous;
+}
+
+bool AllocStats::enabled() {
+#ifdef CARDLIB_ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocCounters AllocStats::get(AllocSite site) {
+    auto& c = counters[static_cast<size_t>(site)];
+    AllocCounters res;
+    res.allocs = c.allocs.load(std::memory_order_relaxed);
+    res.frees = c.frees.load(std::memory_order_relaxed);
+    res.bytes = c.bytes.load(std::memory_order_relaxed);
+    return res;
+}
+
+void AllocStats::reset() {
+    for (auto& c : counters) {
+        c.allocs = 0;
+        c.frees = 0;
+        c.bytes = 0;
+    }
+}
+
+const char* AllocStats::siteName(AllocSite site) {
+    switch (site) {
+        case AllocSite::ApduEncode:
+            return "apdu encode";
+        case AllocSite::Der:
+            return "der";
+        case AllocSite::SmWrap:
+            return "sm wrap";
+        case AllocSite::SmUnwrap:
+            return "sm unwrap";
+        case AllocSite::Transmit:
+            return "transmit";
+        case AllocSite::BpaceInit:
+            return "bpace init";
+        case AllocSite::BpaceStep2:
+            return "bpace step2";
+        case AllocSite::BpaceStep4:
+            return "bpace step4";
+        case AllocSite::BpaceStep6:
+            return "bpace step6";
+        default:
+            return "other";
+    }
+}
+
+std::string AllocStats::report() {
+    std::string res;
+    for (size_t i = 0; i < static_cast<size_t>(AllocSite::Count); ++i) {
+        auto c = get(static_cast<AllocSite>(i));
+        res += std::string(siteName(static_cast<AllocSite>(i))) + ": " + std::to_string(c.allocs) + " allocs, " +
+               std::to_string(c.frees) + " frees, " + std::to_string(c.bytes) + " bytes\n";
+    }
+    return res;
+}
+
+bool AllocStats::checkBudget(AllocSite site, size_t maxAllocs) {
+    auto c = get(site);
+    if (c.allocs > maxAllocs) {
+        Logger::getInstance()->log(__FILE__,
+                                   __LINE__,
+                                   std::string("Allocation budget exceeded for ") + siteName(site) + ": " +
+                                       std::to_string(c.allocs) + " > " + std::to_string(maxAllocs),
+                                   LogLevel::ERROR);
+        return false;
+    }
+    return true;
+}
+
+#ifdef CARDLIB_ALLOC_STATS
+
+// The site sits in a header in front of the block, the header keeps the default new alignment
+static const size_t HEADER = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+static_assert(HEADER >= sizeof(AllocSite), "header too small for the site");
+
+static void* countedAlloc(size_t size) {
+    auto& c = counters[static_cast<size_t>(currentSite)];
+    c.allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size > SIZE_MAX - HEADER) {
+        return nullptr;
+    }
+    auto block = static_cast<unsigned char*>(std::malloc(HEADER + size));
+    if (block == nullptr) {
+        return nullptr;
+    }
+    *reinterpret_cast<AllocSite*>(block) = currentSite;
+    return block + HEADER;
+}
+
+static void countedFree(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto block = static_cast<unsigned char*>(ptr) - HEADER;
+    counters[static_cast<size_t>(*reinterpret_cast<AllocSite*>(block))].frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(block);
+}
+
+void* operator new(size_t size) {
+    void* ptr = countedAlloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    countedFree(ptr);
+}
+
+#endif
@@ -11,19 +11,22 @@ APDU::APDU(Cla cla, Instruction ins, octet p1, octet p2, std::vector<octet> data
 }
 
 std::vector<octet> derEncode(u32 tag, const std::vector<octet>& data) {
-    octet* apduCmd = new octet[2048];
-    auto count = derEnc(apduCmd, tag, data.data(), data.size());
+    CARDLIB_ALLOC_SCOPE(AllocSite::Der);
+    CARDLIB_TRACE_SPAN("DER encode");
+    auto count = derEnc(0, tag, data.data(), data.size());
     if (count == SIZE_MAX) {
         logger->log(__FILE__, __LINE__, "Error der encode", LogLevel::ERROR);
         throw -1;
     }
 
     std::vector<octet> res(count);
-    std::copy(apduCmd, apduCmd + count, res.begin());
+    derEnc(res.data(), tag, data.data(), data.size());
     return res;
 }
 
 std::vector<octet> derDecode(u32 tag, octet* data, size_t len) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::Der);
+    CARDLIB_TRACE_SPAN("DER decode");
     const octet* decoded;
     size_t decodedSize;
     auto count = derDec2(&decoded, &decodedSize, data, len, tag);
@@ -36,22 +39,38 @@ std::vector<octet> derDecode(u32 tag, octet* data, size_t len) {
     return res;
 }
 
-std::vector<octet> APDUEncode(APDU command) {
-    int dataSize = command.cdf.size();
+// Splits off the first TLV without copying, returns its full size or 0
+size_t derTLV(std::span<const octet> data, u32& tag, std::span<const octet>& value) {
+    size_t len;
+    size_t count = derTLDec(&tag, &len, data.data(), data.size());
+    if (count == SIZE_MAX || count + len > data.size()) {
+        return 0;
+    }
+    value = data.subspan(count, len);
+    return count + len;
+}
 
-    if (dataSize > std::numeric_limits<unsigned short int>::max() - 1) {
+std::vector<octet> APDUToCmd(const APDU& command) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::ApduEncode);
+    size_t dataSize = command.cdf.size();
+
+    if (dataSize > std::numeric_limits<unsigned short int>::max()) {
         logger->log(__FILE__, __LINE__, "Cannot encode APDU, data is too long", LogLevel::ERROR);
         return std::vector<octet>();
     }
 
-    octet stack[std::numeric_limits<unsigned short int>::max() - 1];
-    apdu_cmd_t* apduCmd = (apdu_cmd_t*)stack;
-    memSetZero(apduCmd, sizeof(apdu_cmd_t));
-    apduCmd->cla = static_cast<octet>(command.cla);
+    if (command.channel > APDU::MAX_CHANNEL) {
+        logger->log(__FILE__, __LINE__, "Cannot encode APDU, logical channel is out of range", LogLevel::ERROR);
+        return std::vector<octet>();
+    }
+
+    std::vector<octet> buffer(sizeof(apdu_cmd_t) + dataSize);
+    apdu_cmd_t* apduCmd = (apdu_cmd_t*)buffer.data();
+    apduCmd->cla = static_cast<octet>(command.cla) | command.channel;
     apduCmd->ins = static_cast<octet>(command.instruction);
     apduCmd->p1 = command.p1;
     apduCmd->p2 = command.p2;
-    apduCmd->cdf_len = command.cdf_len;
+    apduCmd->cdf_len = dataSize;
     std::copy(command.cdf.begin(), command.cdf.end(), apduCmd->cdf);
     if (command.le != boost::none) {
         apduCmd->rdf_len = command.le.get();
@@ -60,8 +79,62 @@ std::vector<octet> APDUEncode(APDU command) {
         logger->log(__FILE__, __LINE__, "APDU command is not valid", LogLevel::ERROR);
         return std::vector<octet>();
     }
+    return buffer;
+}
+
+std::vector<octet> APDUEncode(APDU command) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::ApduEncode);
+    auto buffer = APDUToCmd(command);
+    if (buffer.empty()) {
+        return std::vector<octet>();
+    }
+    apdu_cmd_t* apduCmd = (apdu_cmd_t*)buffer.data();
     size_t apduSize = apduCmdEnc(0, apduCmd);
     std::vector<octet> apdu(apduSize);
     apduCmdEnc(apdu.data(), apduCmd);
     return apdu;
-}
\ No newline at end of file
+}
+
+boost::optional<APDU> APDUDecode(const std::vector<octet>& apdu) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::ApduEncode);
+    size_t size = apduCmdDec(0, apdu.data(), apdu.size());
+    if (size == SIZE_MAX) {
+        logger->log(__FILE__, __LINE__, "Cannot decode APDU", LogLevel::ERROR);
+        return boost::none;
+    }
+    std::vector<octet> buffer(size);
+    apdu_cmd_t* cmd = (apdu_cmd_t*)buffer.data();
+    apduCmdDec(cmd, apdu.data(), apdu.size());
+    boost::optional<size_t> le;
+    if (cmd->rdf_len != 0) {
+        le = cmd->rdf_len;
+    }
+    APDU decoded(static_cast<Cla>(cmd->cla & ~APDU::MAX_CHANNEL),
+                 static_cast<Instruction>(cmd->ins),
+                 cmd->p1,
+                 cmd->p2,
+                 std::vector<octet>(cmd->cdf, cmd->cdf + cmd->cdf_len),
+                 le);
+    decoded.channel = cmd->cla & APDU::MAX_CHANNEL;
+    return decoded;
+}
+
+std::vector<APDU> APDUChain(const APDU& command, size_t maxData) {
+    if (command.cdf.size() <= maxData || maxData == 0) {
+        return {command};
+    }
+
+    std::vector<APDU> chain;
+    auto chained = static_cast<Cla>(static_cast<octet>(command.cla) | static_cast<octet>(Cla::Chained));
+    for (size_t offset = 0; offset < command.cdf.size(); offset += maxData) {
+        size_t partSize = std::min(maxData, command.cdf.size() - offset);
+        std::vector<octet> part(command.cdf.begin() + offset, command.cdf.begin() + offset + partSize);
+        if (offset + partSize < command.cdf.size()) {
+            chain.emplace_back(chained, command.instruction, command.p1, command.p2, part);
+        } else {
+            chain.emplace_back(command.cla, command.instruction, command.p1, command.p2, part, command.le);
+        }
+        chain.back().channel = command.channel;
+    }
+    return chain;
+}
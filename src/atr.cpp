@@ -0,0 +1,128 @@
+#include <atr.h>
+
+#include <algorithm>
+
+// RID of the PC/SC workgroup, used in ATRs built by readers for storage cards
+const octet PCSC_RID[] = {0xA0, 0x00, 0x00, 0x03, 0x06};
+
+boost::optional<ATR> ATR::parse(const octet* atr, size_t len) {
+    if (len < 2 || (atr[0] != 0x3B && atr[0] != 0x3F)) {
+        return boost::none;
+    }
+
+    ATR res;
+    res.raw = std::vector<octet>(atr, atr + len);
+    size_t historicalLen = atr[1] & 0x0F;
+    octet y = atr[1] >> 4;
+    size_t i = 2;
+    bool hasTck = false;
+    bool interfaceBytes = false;
+    std::vector<octet> td;
+
+    while (true) {
+        size_t count = (y & 0x01) + ((y >> 1) & 0x01) + ((y >> 2) & 0x01);
+        interfaceBytes = interfaceBytes || count > 0;
+        i += count;
+        if (!(y & 0x08)) {
+            break;
+        }
+        if (i >= len) {
+            return boost::none;
+        }
+        td.push_back(atr[i]);
+        int protocol = atr[i] & 0x0F;
+        if (std::find(res.protocols.begin(), res.protocols.end(), protocol) == res.protocols.end()) {
+            res.protocols.push_back(protocol);
+        }
+        hasTck = hasTck || protocol != 0;
+        y = atr[i++] >> 4;
+    }
+    if (res.protocols.empty()) {
+        res.protocols.push_back(0);
+    }
+
+    if (i + historicalLen + (hasTck ? 1 : 0) > len) {
+        return boost::none;
+    }
+    if (hasTck) {
+        octet tck = 0;
+        for (size_t pos = 1; pos < i + historicalLen + 1; ++pos) {
+            tck ^= atr[pos];
+        }
+        if (tck != 0) {
+            return boost::none;
+        }
+    }
+    res.historical = std::vector<octet>(atr + i, atr + i + historicalLen);
+
+    // PC/SC part 3 builds 3B 8n 80 01 ATRs for ISO 14443 cards
+    bool contactless = td.size() == 2 && td[0] == 0x80 && td[1] == 0x01 && atr[1] >> 4 == 0x08;
+    res.cardType = contactless ? CardType::Contactless : CardType::Contact;
+    if (contactless && historicalLen >= 8 && res.historical[0] == 0x80 && res.historical[1] == 0x4F &&
+        std::equal(PCSC_RID, PCSC_RID + sizeof(PCSC_RID), res.historical.begin() + 3)) {
+        res.cardType = CardType::ContactlessStorage;
+    }
+    res.parseHistoricalBytes();
+    return res;
+}
+
+void ATR::parseHistoricalBytes() {
+    if (this->historical.empty()) {
+        return;
+    }
+    // Category 0x00 keeps three status bytes after the compact-TLV objects, 0x80 may end with one
+    size_t end = this->historical.size();
+    if (this->historical[0] == 0x00) {
+        if (end < 4) {
+            return;
+        }
+        end -= 3;
+    } else if (this->historical[0] != 0x80) {
+        return;
+    }
+
+    for (size_t pos = 1; pos < end;) {
+        octet tag = this->historical[pos] >> 4;
+        size_t len = this->historical[pos] & 0x0F;
+        ++pos;
+        if (pos + len > end) {
+            return;
+        }
+        // Card capabilities, third software function table
+        if (tag == 0x07 && len >= 3) {
+            this->chaining = (this->historical[pos + 2] & 0x80) != 0;
+            this->extendedLength = (this->historical[pos + 2] & 0x40) != 0;
+        }
+        pos += len;
+    }
+}
+
+bool ATR::supportsProtocol(int protocol) const {
+    return std::find(this->protocols.begin(), this->protocols.end(), protocol) != this->protocols.end();
+}
+
+bool ATR::supportsExtendedLength() const {
+    return this->extendedLength;
+}
+
+bool ATR::supportsChaining() const {
+    return this->chaining;
+}
+
+CardType ATR::getCardType() const {
+    return this->cardType;
+}
+
+const std::vector<octet>& ATR::getHistoricalBytes() const {
+    return this->historical;
+}
+
+std::string ATR::toHex() const {
+    const char digits[] = "0123456789ABCDEF";
+    std::string res;
+    for (auto b : this->raw) {
+        res.push_back(digits[b >> 4]);
+        res.push_back(digits[b & 0x0F]);
+    }
+    return res;
+}
@@ -1,28 +1,217 @@
 #include <bpace.h>
+#include <commandPipeline.h>
+#include <efCache.h>
+#include <terminalAuth.h>
 
+#include <algorithm>
 #include <iomanip>
 
-Bpace::Bpace(std::string password, Pwd pwd_type) {
+template <size_t L>
+BpaceSession<L>::BpaceSession(std::string password, Pwd pwd_type) : BpaceSession(password, pwd_type, nullptr) {}
+
+template <size_t L>
+BpaceSession<L>::BpaceSession(std::string password, Pwd pwd_type, std::shared_ptr<CardTransport> transport)
+    : pwdType(pwd_type), pcsc(transport) {
     this->logger = Logger::getInstance();
-    this->logger->setLogOutput("CONSOLE");
-    this->logger->setLogLevel("INFO");
 
-    this->chooseApplеt(AID_KTA_APPLET, sizeof(AID_KTA_APPLET));
+    this->password = SecureArena::getInstance().acquire(password.size());
+    std::copy(password.begin(), password.end(), this->password.data());
+    memWipe(password.data(), password.size());
+}
 
-    this->chooseMF();
+template <size_t L>
+BpaceSession<L>::~BpaceSession() = default;
 
-    auto status = this->bPACEStart(password, pwd_type);
-    if (status != ERR_OK) {
-        std::cerr << "unable to init bpace: " << status;
-        if (this->blob != nullptr) {
-            blobClose(this->blob);
-            this->blob = nullptr;
+template <size_t L>
+BpaceSession<L>::BpaceSession(const BpaceSession &basic, octet channel, PCSC pcsc)
+    : pwdType(basic.pwdType), channel(channel), pcsc(pcsc) {
+    this->logger = Logger::getInstance();
+    this->password = SecureArena::getInstance().acquire(basic.password.size());
+    std::copy_n(basic.password.data(), basic.password.size(), this->password.data());
+}
+
+template <size_t L>
+std::unique_ptr<BpaceSession<L>> BpaceSession<L>::openChannel(std::shared_ptr<CardTransport> transport) {
+    int opened = this->pcsc.openChannel();
+    if (opened < 0) {
+        return nullptr;
+    }
+    // Without a transport the channel shares the card handle of the basic session
+    auto link = transport != nullptr ? PCSC(transport) : this->pcsc;
+    return std::unique_ptr<BpaceSession>(new BpaceSession(*this, static_cast<octet>(opened), link));
+}
+
+// Drops the selection and SM state of the channel on the card side
+template <size_t L>
+bool BpaceSession<L>::closeChannel() {
+    if (this->channel == 0 || !this->pcsc.closeChannel(this->channel)) {
+        return false;
+    }
+    this->opened = false;
+    this->authorized = false;
+    this->currentFile = boost::none;
+    this->wipeHandshake();
+    return true;
+}
+
+template <size_t L>
+octet BpaceSession<L>::getChannel() const {
+    return this->channel;
+}
+
+template <size_t L>
+APDU BpaceSession<L>::onChannel(APDU command) const {
+    command.channel = this->channel;
+    return command;
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::encode(APDU command) const {
+    return APDUEncode(this->onChannel(std::move(command)));
+}
+
+template <size_t L>
+int BpaceSession<L>::open() {
+    if (this->opened) {
+        return ERR_OK;
+    }
+    this->pcsc.traceContext();
+    auto result = this->pcsc.connect();
+    if (result != 0) {
+        logger->log(__FILE__, __LINE__, "Unable to connect to the reader", LogLevel::ERROR);
+        return result;
+    }
+
+    if (!this->chooseApplеt(AID_KTA_APPLET, sizeof(AID_KTA_APPLET)) || !this->chooseMF()) {
+        logger->log(__FILE__, __LINE__, "Unable to select the applet", LogLevel::ERROR);
+        return -1;
+    }
+    result = this->bpaceInit(this->pwdType);
+    if (result != ERR_OK) {
+        return result;
+    }
+    return this->startHandshake();
+}
+
+template <size_t L>
+Task<int> BpaceSession<L>::open(EventLoop &loop) {
+    if (this->opened) {
+        co_return ERR_OK;
+    }
+    this->pcsc.traceContext();
+    auto result = co_await loop.connect(this->pcsc);
+    if (result != 0) {
+        logger->log(__FILE__, __LINE__, "Unable to connect to the reader", LogLevel::ERROR);
+        co_return result;
+    }
+
+    std::vector<octet> aid(AID_KTA_APPLET, AID_KTA_APPLET + sizeof(AID_KTA_APPLET));
+    bool selected;
+    {
+        CARDLIB_TRACE_SPAN("SELECT applet");
+        auto response = co_await loop.transmit(this->pcsc, this->encode(APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, aid)));
+        selected = this->appletSelected(response, aid);
+    }
+    if (selected) {
+        CARDLIB_TRACE_SPAN("SELECT MF");
+        auto response = co_await loop.transmit(this->pcsc, this->encode(APDU(Cla::Default, Instruction::FilesSelect, 0x00, 0x00)));
+        selected = this->mfSelected(response);
+    }
+    if (!selected) {
+        logger->log(__FILE__, __LINE__, "Unable to select the applet", LogLevel::ERROR);
+        co_return -1;
+    }
+    {
+        CARDLIB_TRACE_SPAN("bpaceInit");
+        auto command = this->bpaceInitCommand(this->pwdType);
+        if (command.empty()) {
+            co_return -1;
         }
+        auto response = co_await loop.transmit(this->pcsc, command);
+        if (!this->bpaceInitAccepted(response)) {
+            co_return -1;
+        }
+    }
+    co_return this->startHandshake();
+}
+
+// Starts the bake state from the stored password once MSE:SET AT was accepted
+template <size_t L>
+int BpaceSession<L>::startHandshake() {
+    std::string pwd(reinterpret_cast<const char *>(this->password.data()), this->password.size());
+    auto status = this->startState(pwd);
+    memWipe(pwd.data(), pwd.size());
+    if (status != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Unable to init bpace: " + std::to_string(status), LogLevel::ERROR);
+        this->wipeHandshake();
+        return status;
     }
+    this->opened = true;
+    return ERR_OK;
+}
+
+// The Bpace object must outlive the returned future
+template <size_t L>
+std::future<int> BpaceSession<L>::openAsync() {
+    return std::async(std::launch::async, [this]() { return this->open(); });
 }
 
-int Bpace::bpaceInit(Pwd pwd_type) {
+template <size_t L>
+bool BpaceSession<L>::isOpen() const {
+    return this->opened;
+}
+
+// Handshake buffers are not needed after a failure or once k0 is derived
+template <size_t L>
+void BpaceSession<L>::wipeHandshake() {
+    if (this->secure) {
+        memWipe(this->in().data(), this->secure.size() - Level::KEY);
+    }
+}
+
+// One copy of the standard curve per level, shared by every session
+template <size_t L>
+const bign_params *BpaceSession<L>::curveParams() {
+    static bign_params params;
+    static const err_t status = bignParamsStd(&params, Level::CURVE);
+    return status == ERR_OK ? &params : nullptr;
+}
+
+template <size_t L>
+octet *BpaceSession<L>::key() {
+    return this->secure.data();
+}
+
+template <size_t L>
+std::span<octet, BpaceSession<L>::Level::M2> BpaceSession<L>::in() {
+    return std::span<octet, Level::M2>(this->secure.data() + Level::KEY, Level::M2);
+}
+
+template <size_t L>
+std::span<octet, BpaceSession<L>::Level::M3> BpaceSession<L>::out() {
+    return std::span<octet, Level::M3>(this->secure.data() + Level::KEY + Level::M2, Level::M3);
+}
+
+template <size_t L>
+void *BpaceSession<L>::state() {
+    return this->secure.data() + Level::KEY + Level::M2 + Level::M3;
+}
+
+template <size_t L>
+int BpaceSession<L>::bpaceInit(Pwd pwd_type) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::BpaceInit);
+    CARDLIB_TRACE_SPAN("bpaceInit");
+    auto command = this->bpaceInitCommand(pwd_type);
+    if (command.empty() || !this->bpaceInitAccepted(pcsc.sendCommandToCard(command))) {
+        return -1;
+    }
+    return 0;
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::bpaceInitCommand(Pwd pwd_type) {
     std::vector<octet> initBpace;
+    initBpace.reserve(HELLO_MAX + 32);
     auto encoded = derEncode(0x80, std::vector<octet>(OID_BPACE, OID_BPACE + sizeof(OID_BPACE)));
     std::copy(encoded.begin(), encoded.end(), std::back_inserter(initBpace));
     encoded = derEncode(0x83, std::vector<octet>(1, static_cast<octet>(pwd_type)));
@@ -34,62 +223,63 @@ int Bpace::bpaceInit(Pwd pwd_type) {
     encoded = certHatEsign.encode();
     std::copy(encoded.begin(), encoded.end(), std::back_inserter(initBpace));
 
-    std::vector<octet> helloa = std::vector<octet>();
-    char* certHat = new char[encoded.size()];
-    for (size_t i = 0; i < encoded.size(); ++i) {
-        certHat[i] = static_cast<const char>(encoded[i]);
+    // helloa is both CertHATs, a truncated one would make the card and us disagree on it
+    auto eidHat = CertHAT(std::vector<octet>(OID_EID, OID_EID + sizeof(OID_EID)),
+                          std::vector<octet>(EID_ACCESS, EID_ACCESS + sizeof(EID_ACCESS)))
+                      .encode();
+    if (encoded.size() + eidHat.size() > HELLO_MAX) {
+        logger->log(__FILE__, __LINE__, "CertHATs do not fit into helloa", LogLevel::ERROR);
+        return {};
     }
-    std::copy(certHat, certHat + encoded.size(), std::back_inserter(helloa));
+    size_t helloaLen = encoded.size();
+    std::copy_n(encoded.begin(), helloaLen, this->helloa.begin());
 
-    auto certHatEid = CertHAT(std::vector<octet>(OID_EID, OID_EID + sizeof(OID_EID)),
-                              std::vector<octet>(EID_ACCESS, EID_ACCESS + sizeof(EID_ACCESS)));
-
-    encoded = certHatEid.encode();
-    std::copy(encoded.begin(), encoded.end(), std::back_inserter(initBpace));
+    std::copy(eidHat.begin(), eidHat.end(), std::back_inserter(initBpace));
+    std::copy(eidHat.begin(), eidHat.end(), this->helloa.begin() + helloaLen);
+    this->settings.helloa = this->helloa.data();
+    this->settings.helloa_len = helloaLen + eidHat.size();
+    return this->encode(APDU(Cla::Default, Instruction::BPACEInit, 0xC1, 0xA4, initBpace));
+}
 
-    certHat = new char[encoded.size()];
-    for (size_t i = 0; i < encoded.size(); ++i) {
-        certHat[i] = static_cast<const char>(encoded[i]);
-    }
-    std::copy(certHat, certHat + encoded.size(), std::back_inserter(helloa));
-    this->settings.helloa = new char[helloa.size()];
-    std::copy(helloa.begin(), helloa.end(), (char*)this->settings.helloa);
-    this->settings.helloa_len = helloa.size();
-    auto apdu = APDUEncode(APDU(Cla::Default, Instruction::BPACEInit, 0xC1, 0xA4, initBpace));
-    auto resp = pcsc.decodeResponse(pcsc.sendCommandToCard(apdu));
+template <size_t L>
+bool BpaceSession<L>::bpaceInitAccepted(const std::vector<octet> &response) {
+    auto resp = pcsc.decodeResponse(response);
     if (resp->sw1 != 0x90 && resp->sw1 != 0x63) {
         logger->log(__FILE__, __LINE__, "Init BPACE failed", LogLevel::ERROR);
-        return -1;
+        return false;
     }
-    return 0;
+    return true;
 }
 
-int Bpace::bPACEStart(std::string pwd, Pwd pwd_type) {
+template <size_t L>
+int BpaceSession<L>::bPACEStart(std::string pwd, Pwd pwd_type) {
     auto error = bpaceInit(pwd_type);
     if (error != ERR_OK) {
         return error;
     }
+    return this->startState(pwd);
+}
 
-    err_t err = bignParamsStd(&this->params, "1.2.112.0.2.0.34.101.45.3.1");
-
-    if (err != ERR_OK) {
+template <size_t L>
+int BpaceSession<L>::startState(const std::string &pwd) {
+    auto params = curveParams();
+    if (params == nullptr) {
         logger->log(__FILE__, __LINE__, "Cannot start BPACE due to std params", LogLevel::ERROR);
-        return err;
+        return ERR_BAD_PARAMS;
+    }
+    this->secure = SecureArena::getInstance().acquire(Level::slot());
+    if (!this->secure) {
+        logger->log(__FILE__, __LINE__, "Cannot allocate BPACE state", LogLevel::ERROR);
+        return ERR_OUTOFMEMORY;
     }
-    prngEchoStart(this->echo, this->params.seed, 8);
-
-    this->blob = blobCreate(9 * this->params.l / 8 + 8 + bakeBPACE_keep(this->params.l));
-
-    this->in = (octet*)this->blob;
-    this->out = this->in + 5 * this->params.l / 8;
-    this->state = this->out + this->params.l / 2 + 8;
 
     octet pwd_tmp[16];
 
-    size_t pwdSize = pwd.length();
-    std::copy(pwd.begin(), pwd.end(), pwd_tmp);
+    size_t pwdSize = std::min(pwd.length(), sizeof(pwd_tmp));
+    std::copy(pwd.begin(), pwd.begin() + pwdSize, pwd_tmp);
 
-    err_t code = bakeBPACEStart(this->state, &this->params, &this->settings, pwd_tmp, pwdSize);
+    err_t code = bakeBPACEStart(this->state(), params, &this->settings, pwd_tmp, pwdSize);
+    memWipe(pwd_tmp, sizeof(pwd_tmp));
 
     if (code != ERR_OK) {
         logger->log(__FILE__, __LINE__, "Cannot start bpace", LogLevel::ERROR);
@@ -98,21 +288,36 @@ int Bpace::bPACEStart(std::string pwd, Pwd pwd_type) {
     return code;
 }
 
-bool Bpace::chooseApplеt(const octet aid[], size_t aidSize) {
+template <size_t L>
+bool BpaceSession<L>::chooseApplеt(const octet aid[], size_t aidSize) {
+    CARDLIB_TRACE_SPAN("SELECT applet");
     std::vector<octet> aidVector(aid, aid + aidSize);
-    auto apdu = APDUEncode(APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, aidVector));
-    auto res = pcsc.decodeResponse(pcsc.sendCommandToCard(apdu));
+    auto apdu = this->encode(APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, aidVector));
+    return this->appletSelected(pcsc.sendCommandToCard(apdu), aidVector);
+}
+
+template <size_t L>
+bool BpaceSession<L>::appletSelected(const std::vector<octet> &response, const std::vector<octet> &aid) {
+    auto res = pcsc.decodeResponse(response);
     if (res->sw1 != 0x90) {
         logger->log(__FILE__, __LINE__, "Error in choosing applet", LogLevel::ERROR);
         return false;
     }
+    pcsc.addApplet(aid);
     logger->log(__FILE__, __LINE__, "Successful choosing applet", LogLevel::INFO);
     return true;
 }
 
-bool Bpace::chooseMF() {
-    auto apdu = APDUEncode(APDU(Cla::Default, Instruction::FilesSelect, 0x00, 0x00));
-    auto res = pcsc.decodeResponse(pcsc.sendCommandToCard(apdu));
+template <size_t L>
+bool BpaceSession<L>::chooseMF() {
+    CARDLIB_TRACE_SPAN("SELECT MF");
+    auto apdu = this->encode(APDU(Cla::Default, Instruction::FilesSelect, 0x00, 0x00));
+    return this->mfSelected(pcsc.sendCommandToCard(apdu));
+}
+
+template <size_t L>
+bool BpaceSession<L>::mfSelected(const std::vector<octet> &response) {
+    auto res = pcsc.decodeResponse(response);
     if (res->sw1 != 0x90 && res->sw2 != 0x00) {
         logger->log(__FILE__, __LINE__, "Error in choosing MF", LogLevel::ERROR);
         return false;
@@ -121,167 +326,860 @@ bool Bpace::chooseMF() {
     return true;
 }
 
-bool Bpace::chooseEF(CardSecure &card) {
+static const std::vector<octet> DEFAULT_EF = {0x01, 0x01};
 
-    auto apdu = card.APDUEncrypt(APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, {0x01, 0x01}));
-    // auto apdu = card.APDUEncrypt(APDU(Cla::Default, Instruction::ReadData, 0x01, 0x01, {}, 236));
-    if (apdu == boost::none) {
-        logger->log(__FILE__, __LINE__, "Error in choosing EF: cannot encrypt APDU", LogLevel::ERROR);
+static APDU selectEFApdu(const std::vector<octet> &fid) {
+    return APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, fid);
+}
+
+// READ BINARY addresses the file with a 15-bit offset in P1-P2
+static APDU readBinaryApdu(size_t offset, size_t chunk) {
+    return APDU(Cla::Default,
+                Instruction::ReadBinary,
+                static_cast<octet>(offset >> 8),
+                static_cast<octet>(offset),
+                {},
+                chunk);
+}
+
+template <size_t L>
+bool BpaceSession<L>::chooseEF(CardSecure &card) {
+    return this->chooseEF(card, DEFAULT_EF);
+}
+
+template <size_t L>
+bool BpaceSession<L>::chooseEF(CardSecure &card, const std::vector<octet> &fid) {
+    this->pcsc.traceContext();
+    CARDLIB_TRACE_SPAN("SELECT EF");
+    auto select = this->onChannel(selectEFApdu(fid));
+    auto plain = this->transmitSecure(card, select, true);
+    if (plain == boost::none || !this->efSelected(plain.get())) {
         return false;
     }
-    auto a = APDUEncode(apdu.get());
-    a.push_back(0x00);
-    auto res = pcsc.decodeResponse(pcsc.sendCommandToCard(a));
+    this->currentFile = select;
+    return true;
+}
+
+template <size_t L>
+Task<bool> BpaceSession<L>::chooseEF(EventLoop &loop, CardSecure &card) {
+    return this->chooseEF(loop, card, DEFAULT_EF);
+}
+
+// The file id is taken by value, the coroutine may run after the caller's argument is gone
+template <size_t L>
+Task<bool> BpaceSession<L>::chooseEF(EventLoop &loop, CardSecure &card, std::vector<octet> fid) {
+    this->pcsc.traceContext();
+    CARDLIB_TRACE_SPAN("SELECT EF");
+    auto select = this->onChannel(selectEFApdu(fid));
+    auto apdu = this->wrapOrLog(card, select);
+    if (apdu == boost::none) {
+        co_return false;
+    }
+    auto plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+    if (plain == boost::none || !this->efSelected(plain.get())) {
+        co_return false;
+    }
+    this->currentFile = select;
+    co_return true;
+}
+
+template <size_t L>
+bool BpaceSession<L>::efSelected(const std::vector<octet> &plain) {
+    auto res = pcsc.decodeResponse(plain);
     if (res->sw1 != 0x90 && res->sw2 != 0x00) {
         logger->log(__FILE__, __LINE__, "Error in choosing EF", LogLevel::ERROR);
         return false;
     }
+    pcsc.setSecureMessaging(true);
     logger->log(__FILE__, __LINE__, "Successful choosing EF", LogLevel::INFO);
     return true;
 }
 
-std::string Bpace::getName() {
+// Allowed EFs are probed with a short read at the head, and on a cache hit at the tail of the cached copy
+template <size_t L>
+std::vector<octet> BpaceSession<L>::readEF(CardSecure &card) {
+    this->pcsc.traceContext();
+    auto cache = EfCache::getInstance();
+    auto efId = this->currentFileId();
+    if (!cache->cacheable(efId)) {
+        return this->readEFFromCard(card);
+    }
+    std::vector<octet> head;
+    auto plain = this->transmitSecure(card, this->onChannel(readBinaryApdu(0, EfCache::PROBE)), true);
+    auto status = plain == boost::none ? ChunkStatus::Failed : this->readChunk(plain.get(), head, EfCache::PROBE);
+    if (status != ChunkStatus::More) {
+        if (status == ChunkStatus::Failed) {
+            return std::vector<octet>();
+        }
+        this->observe(0, head);
+        return head;
+    }
+
+    auto key = EfCache::key(this->cardIdentity(), efId, head);
+    auto cached = cache->find(key);
+    if (cached != boost::none && cached->size() - EfCache::PROBE <= 0x7FFF) {
+        std::vector<octet> tail;
+        plain = this->transmitSecure(card, this->onChannel(readBinaryApdu(cached->size() - EfCache::PROBE, EfCache::PROBE + 1)), true);
+        if (plain != boost::none && this->readChunk(plain.get(), tail, EfCache::PROBE + 1) == ChunkStatus::Done &&
+            EfCache::tailMatches(cached.get(), tail)) {
+            this->observe(0, cached.get());
+            return cached.get();
+        }
+    }
+    auto data = this->readEFFromCard(card);
+    if (data.size() > EfCache::PROBE) {
+        cache->store(EfCache::key(this->cardIdentity(), efId, data), data);
+    }
+    return data;
+}
+
+template <size_t L>
+Task<std::vector<octet>> BpaceSession<L>::readEF(EventLoop &loop, CardSecure &card) {
+    this->pcsc.traceContext();
+    auto cache = EfCache::getInstance();
+    auto efId = this->currentFileId();
+    if (!cache->cacheable(efId)) {
+        co_return co_await this->readEFFromCard(loop, card);
+    }
+    std::vector<octet> head;
+    auto apdu = this->wrapOrLog(card, this->onChannel(readBinaryApdu(0, EfCache::PROBE)));
+    if (apdu == boost::none) {
+        co_return std::vector<octet>();
+    }
+    auto plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+    auto status = plain == boost::none ? ChunkStatus::Failed : this->readChunk(plain.get(), head, EfCache::PROBE);
+    if (status != ChunkStatus::More) {
+        if (status == ChunkStatus::Failed) {
+            co_return std::vector<octet>();
+        }
+        this->observe(0, head);
+        co_return head;
+    }
+
+    auto key = EfCache::key(this->cardIdentity(), efId, head);
+    auto cached = cache->find(key);
+    if (cached != boost::none && cached->size() - EfCache::PROBE <= 0x7FFF) {
+        apdu = this->wrapOrLog(card, this->onChannel(readBinaryApdu(cached->size() - EfCache::PROBE, EfCache::PROBE + 1)));
+        if (apdu == boost::none) {
+            co_return std::vector<octet>();
+        }
+        std::vector<octet> tail;
+        plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+        if (plain != boost::none && this->readChunk(plain.get(), tail, EfCache::PROBE + 1) == ChunkStatus::Done &&
+            EfCache::tailMatches(cached.get(), tail)) {
+            this->observe(0, cached.get());
+            co_return cached.get();
+        }
+    }
+    auto data = co_await this->readEFFromCard(loop, card);
+    if (data.size() > EfCache::PROBE) {
+        cache->store(EfCache::key(this->cardIdentity(), efId, data), data);
+    }
+    co_return data;
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::currentFileId() const {
+    return this->currentFile != boost::none ? this->currentFile->cdf : std::vector<octet>();
+}
+
+template <size_t L>
+std::string BpaceSession<L>::cardIdentity() const {
+    auto &atr = this->pcsc.getATR();
+    return atr != boost::none ? atr->toHex() : std::string();
+}
+
+// Confirms the prefix of an interrupted read of the current EF with a short read just before its end
+template <size_t L>
+boost::optional<APDU> BpaceSession<L>::resumeProbe() {
+    auto overlap = this->checkpoint.overlap(this->cardIdentity(), this->currentFileId());
+    if (overlap == boost::none) {
+        return boost::none;
+    }
+    return this->onChannel(readBinaryApdu(overlap->first, overlap->second));
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::resumed(const boost::optional<std::vector<octet>> &plain) {
+    std::vector<octet> reread;
+    if (plain == boost::none || this->readChunk(plain.get(), reread, ReadCheckpoint::OVERLAP) == ChunkStatus::Failed) {
+        this->checkpoint.clear();
+        return std::vector<octet>();
+    }
+    return this->checkpoint.resume(reread);
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::suspendRead(std::vector<octet> &data) {
+    this->checkpoint.save(this->cardIdentity(), this->currentFileId(), std::move(data));
+    return std::vector<octet>();
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::readEFFromCard(CardSecure &card) {
+    std::vector<octet> data;
+    auto probe = this->resumeProbe();
+    if (probe != boost::none) {
+        data = this->resumed(this->transmitSecure(card, probe.get(), true));
+    }
+    size_t chunk = CardSecure::plainResponseCapacity(pcsc.getLimits().maxResponse);
+    auto status = ChunkStatus::More;
+
+    // The first chunk is read on its own, so a file that fits in it takes a single exchange
+    if (data.size() <= 0x7FFF) {
+        auto plain = this->transmitSecure(card, this->onChannel(readBinaryApdu(data.size(), chunk)), true);
+        status = plain == boost::none ? ChunkStatus::Failed : this->readDataChunk(plain.get(), data, chunk);
+        if (status == ChunkStatus::Failed) {
+            return this->suspendRead(data);
+        }
+    }
+    size_t offset = data.size();
+
+    // The rest is read ahead through the pipeline, which stops sending at the first short chunk
+    if (status == ChunkStatus::More) {
+        auto &pipeline = this->readPipeline();
+        pipeline.run(
+            card,
+            [&](size_t i) -> boost::optional<APDU> {
+                if (offset + i * chunk > 0x7FFF) {
+                    return boost::none;
+                }
+                return this->onChannel(readBinaryApdu(offset + i * chunk, chunk));
+            },
+            [&](size_t, const boost::optional<std::vector<octet>> &plain) {
+                if (plain != boost::none) {
+                    status = this->readDataChunk(plain.get(), data, chunk);
+                }
+                return plain != boost::none && status == ChunkStatus::More;
+            });
+        if (status == ChunkStatus::Failed) {
+            return this->suspendRead(data);
+        }
+        this->lastError = pipeline.getLastError();
+    }
+
+    // A failed exchange is recovered and the rest is read one chunk at a time
+    if (status == ChunkStatus::More && this->lastError != CardError::None && !this->recover(this->lastError, card)) {
+        return this->suspendRead(data);
+    }
+    while (status == ChunkStatus::More && data.size() <= 0x7FFF) {
+        auto plain = this->transmitSecure(card, this->onChannel(readBinaryApdu(data.size(), chunk)), true);
+        if (plain == boost::none) {
+            return this->suspendRead(data);
+        }
+        status = this->readDataChunk(plain.get(), data, chunk);
+        if (status == ChunkStatus::Failed) {
+            return this->suspendRead(data);
+        }
+    }
+    return data;
+}
+
+template <size_t L>
+CommandPipeline &BpaceSession<L>::readPipeline() {
+    if (this->pipeline == nullptr) {
+        this->pipeline = std::make_unique<CommandPipeline>(this->pcsc);
+    }
+    return *this->pipeline;
+}
+
+template <size_t L>
+Task<std::vector<octet>> BpaceSession<L>::readEFFromCard(EventLoop &loop, CardSecure &card) {
+    std::vector<octet> data;
+    size_t chunk = CardSecure::plainResponseCapacity(pcsc.getLimits().maxResponse);
+
+    auto probe = this->resumeProbe();
+    if (probe != boost::none) {
+        auto apdu = this->wrapOrLog(card, probe.get());
+        if (apdu == boost::none) {
+            co_return std::vector<octet>();
+        }
+        auto plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+        data = this->resumed(plain);
+    }
+
+    while (data.size() <= 0x7FFF) {
+        auto apdu = this->wrapOrLog(card, this->onChannel(readBinaryApdu(data.size(), chunk)));
+        if (apdu == boost::none) {
+            co_return this->suspendRead(data);
+        }
+        auto plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+        auto status = plain == boost::none ? ChunkStatus::Failed : this->readDataChunk(plain.get(), data, chunk);
+        if (status == ChunkStatus::Failed) {
+            co_return this->suspendRead(data);
+        }
+        if (status == ChunkStatus::Done) {
+            break;
+        }
+    }
+    co_return data;
+}
+
+template <size_t L>
+typename BpaceSession<L>::ChunkStatus BpaceSession<L>::readChunk(const std::vector<octet> &plain, std::vector<octet> &data, size_t chunk) {
+    auto res = pcsc.decodeResponse(plain);
+    if (res->sw1 == 0x6B || (res->sw1 == 0x62 && res->sw2 == 0x82)) {
+        std::copy(res->rdf, res->rdf + res->rdf_len, std::back_inserter(data));
+        return ChunkStatus::Done;
+    }
+    if (res->sw1 != 0x90) {
+        logger->log(__FILE__, __LINE__, "Error in reading EF", LogLevel::ERROR);
+        return ChunkStatus::Failed;
+    }
+    std::copy(res->rdf, res->rdf + res->rdf_len, std::back_inserter(data));
+    return res->rdf_len < chunk ? ChunkStatus::Done : ChunkStatus::More;
+}
+
+// Chunk of the file being read, passed on to the observer once accepted
+template <size_t L>
+typename BpaceSession<L>::ChunkStatus BpaceSession<L>::readDataChunk(const std::vector<octet> &plain, std::vector<octet> &data, size_t chunk) {
+    size_t offset = data.size();
+    auto status = this->readChunk(plain, data, chunk);
+    if (status != ChunkStatus::Failed) {
+        this->observe(offset, std::span<const octet>(data).subspan(offset));
+    }
+    return status;
+}
+
+template <size_t L>
+void BpaceSession<L>::observe(size_t offset, std::span<const octet> chunk) {
+    if (this->readObserver) {
+        this->readObserver(offset, chunk);
+    }
+}
+
+template <size_t L>
+void BpaceSession<L>::setReadObserver(std::function<void(size_t, std::span<const octet>)> observer) {
+    this->readObserver = std::move(observer);
+}
+
+template <size_t L>
+boost::optional<std::vector<octet>> BpaceSession<L>::wrapOrLog(CardSecure &card, const APDU &command) {
+    auto apdu = card.wrapCommand(command);
+    if (apdu == boost::none) {
+        logger->log(__FILE__, __LINE__, "Cannot encrypt APDU", LogLevel::ERROR);
+    }
+    return apdu;
+}
+
+template <size_t L>
+boost::optional<std::vector<octet>> BpaceSession<L>::unwrapOrLog(CardSecure &card, const std::vector<octet> &response) {
+    auto plain = card.unwrapResponse(response);
+    if (plain == boost::none) {
+        logger->log(__FILE__, __LINE__, "Cannot decrypt response", LogLevel::ERROR);
+    }
+    return plain;
+}
+
+template <size_t L>
+boost::optional<std::vector<octet>> BpaceSession<L>::transmitSecure(CardSecure &card, const APDU &command, bool idempotent) {
+    for (int attempt = 0;; ++attempt) {
+        auto apdu = this->wrapOrLog(card, command);
+        if (apdu == boost::none) {
+            return boost::none;
+        }
+        auto response = pcsc.sendCommandToCard(apdu.get());
+        auto error = pcsc.getLastError();
+        boost::optional<std::vector<octet>> plain;
+        if (error == CardError::None) {
+            plain = card.unwrapResponse(response);
+            if (plain == boost::none) {
+                error = this->classifyUnprotected(response, plain);
+            }
+        }
+        this->lastError = error;
+        if (error == CardError::None) {
+            return plain;
+        }
+        logger->log(__FILE__, __LINE__, "Secure exchange failed: " + std::to_string(static_cast<int>(error)),
+                    LogLevel::WARN);
+        if (!this->recover(error, card) || !idempotent || attempt >= MAX_RETRIES) {
+            return boost::none;
+        }
+    }
+}
+
+// A bare status word is a plain error from the card unless it reports broken SM data objects
+template <size_t L>
+CardError BpaceSession<L>::classifyUnprotected(const std::vector<octet> &response, boost::optional<std::vector<octet>> &plain) {
+    if (response.size() != 2 || (response[0] == 0x69 && (response[1] == 0x87 || response[1] == 0x88))) {
+        return CardError::SecureMessaging;
+    }
+    plain = response;
+    return CardError::None;
+}
+
+template <size_t L>
+bool BpaceSession<L>::recover(CardError error, CardSecure &card) {
+    int result = 0;
+    bool reselect = true;
+    switch (error) {
+        case CardError::None:
+            return true;
+        case CardError::Timeout:
+        case CardError::Transport:
+            // The card may have consumed the command, its SM counter can no longer be trusted
+            result = this->pcsc.reconnect(false);
+            reselect = false;
+            break;
+        case CardError::SecureMessaging:
+            reselect = false;
+            break;
+        case CardError::CardReset:
+            result = this->pcsc.reconnect(false);
+            break;
+        case CardError::CardRemoved:
+            result = this->pcsc.reconnect(true);
+            break;
+        case CardError::ReaderLost:
+            result = this->pcsc.reestablish();
+            break;
+        case CardError::DeadlineExceeded:
+        case CardError::Cancelled:
+            // The connection was torn down, the next open() starts over
+            this->opened = false;
+            this->authorized = false;
+            this->wipeHandshake();
+            return false;
+    }
+    if (result != 0) {
+        auto escalated = this->pcsc.getLastError();
+        if (escalated > error) {
+            return this->recover(escalated, card);
+        }
+        logger->log(__FILE__, __LINE__, "Cannot recover card session", LogLevel::ERROR);
+        return false;
+    }
+    if (!reselect && !this->authorized) {
+        return true;
+    }
+    return this->rekey(reselect, card) == ERR_OK;
+}
+
+template <size_t L>
+int BpaceSession<L>::open(const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->open(); });
+}
+
+template <size_t L>
+bool BpaceSession<L>::authorize(const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->authorize(); });
+}
+
+template <size_t L>
+bool BpaceSession<L>::chooseEF(CardSecure &card, const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->chooseEF(card); });
+}
+
+template <size_t L>
+bool BpaceSession<L>::chooseEF(CardSecure &card, const std::vector<octet> &fid, const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->chooseEF(card, fid); });
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::readEF(CardSecure &card, const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->readEF(card); });
+}
+
+template <size_t L>
+bool BpaceSession<L>::authenticateTerminal(CardSecure &card, TerminalKeyPool<L> &pool, const Deadline &deadline) {
+    return this->withDeadline(deadline, [&]() { return this->authenticateTerminal(card, pool); });
+}
+
+template <size_t L>
+Task<bool> BpaceSession<L>::authorize(EventLoop &loop, Deadline deadline) {
+    DeadlineScope scope(this->pcsc, deadline);
+    bool result = co_await this->authorize(loop);
+    this->noteDeadline();
+    co_return result;
+}
+
+template <size_t L>
+Task<std::vector<octet>> BpaceSession<L>::readEF(EventLoop &loop, CardSecure &card, Deadline deadline) {
+    DeadlineScope scope(this->pcsc, deadline);
+    auto data = co_await this->readEF(loop, card);
+    this->noteDeadline();
+    co_return data;
+}
+
+// Flows that do not track errors themselves still report a deadline that cut them short,
+// the connection is gone by then so the session starts over on next use
+template <size_t L>
+void BpaceSession<L>::noteDeadline() {
+    auto error = this->pcsc.getLastError();
+    if (error == CardError::DeadlineExceeded || error == CardError::Cancelled) {
+        this->lastError = error;
+        this->opened = false;
+        this->authorized = false;
+        this->wipeHandshake();
+    }
+}
+
+template <size_t L>
+CardError BpaceSession<L>::getLastError() const {
+    return this->lastError;
+}
+
+// Restores what the card lost: the applet selection when reselect is set, then BPACE, SM and the current EF
+template <size_t L>
+int BpaceSession<L>::rekey(bool reselect, CardSecure &card) {
+    bool wasAuthorized = this->authorized;
+    this->authorized = false;
+    this->opened = false;
+    this->wipeHandshake();
+
+    // A reset closes every logical channel, the card may hand out a different number
+    if (reselect && this->channel != 0) {
+        int reopened = this->pcsc.openChannel();
+        if (reopened < 0) {
+            return -1;
+        }
+        this->channel = static_cast<octet>(reopened);
+    }
+
+    int result;
+    if (reselect) {
+        result = this->open();
+    } else {
+        result = this->bpaceInit(this->pwdType);
+        if (result == ERR_OK) {
+            result = this->startHandshake();
+        }
+    }
+    if (result != ERR_OK || !wasAuthorized) {
+        return result;
+    }
+    if (!this->authorize()) {
+        return -1;
+    }
+    card.initSecure(this->key());
+    logger->log(__FILE__, __LINE__, "Secure messaging session re-established", LogLevel::INFO);
+
+    if (this->terminalPool != nullptr && !this->authenticateTerminal(card, *this->terminalPool)) {
+        return -1;
+    }
+
+    if (this->currentFile != boost::none) {
+        auto plain = this->exchangeSecure(card, this->currentFile.get());
+        if (plain == boost::none || !this->efSelected(plain.get())) {
+            return -1;
+        }
+    }
+    return ERR_OK;
+}
+
+// One SM round trip without recovery, for steps the card cannot see twice
+template <size_t L>
+boost::optional<std::vector<octet>> BpaceSession<L>::exchangeSecure(CardSecure &card, const APDU &command) {
+    auto apdu = this->wrapOrLog(card, command);
+    if (apdu == boost::none) {
+        return boost::none;
+    }
+    auto plain = this->unwrapOrLog(card, pcsc.sendCommandToCard(apdu.get()));
+    if (plain == boost::none) {
+        auto error = pcsc.getLastError();
+        this->lastError = error != CardError::None ? error : CardError::SecureMessaging;
+    }
+    return plain;
+}
+
+template <size_t L>
+bool BpaceSession<L>::authenticateTerminal(CardSecure &card, TerminalKeyPool<L> &pool) {
+    this->pcsc.traceContext();
+    CARDLIB_TRACE_SPAN("terminal authentication");
+    if (!this->authorized) {
+        logger->log(__FILE__, __LINE__, "Terminal authentication needs BPACE first", LogLevel::ERROR);
+        return false;
+    }
+    auto handshake = pool.take();
+    if (!handshake) {
+        return false;
+    }
+    auto plain = this->exchangeSecure(card, this->bauthInitCommand(pool));
+    if (plain == boost::none || !this->bauthInitAccepted(plain.get())) {
+        return false;
+    }
+    plain = this->exchangeSecure(card, this->bauthStepCommand(0x80, handshake.message1(), false));
+    if (plain == boost::none) {
+        return false;
+    }
+    auto message3 = handshake.message3(this->stepPayload(plain.get(), 0x81, "BAUTH message 2"));
+    if (message3.empty()) {
+        return false;
+    }
+    plain = this->exchangeSecure(card, this->bauthStepCommand(0x82, message3, true));
+    if (plain == boost::none || !this->terminalAuthenticated(plain.get(), handshake, card)) {
+        return false;
+    }
+    this->terminalPool = &pool;
+    return true;
+}
+
+template <size_t L>
+Task<bool> BpaceSession<L>::authenticateTerminal(EventLoop &loop, CardSecure &card, TerminalKeyPool<L> &pool) {
+    this->pcsc.traceContext();
+    CARDLIB_TRACE_SPAN("terminal authentication");
+    if (!this->authorized) {
+        logger->log(__FILE__, __LINE__, "Terminal authentication needs BPACE first", LogLevel::ERROR);
+        co_return false;
+    }
+    auto handshake = pool.take();
+    if (!handshake) {
+        co_return false;
+    }
+    auto apdu = this->wrapOrLog(card, this->bauthInitCommand(pool));
+    if (apdu == boost::none) {
+        co_return false;
+    }
+    auto plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+    if (plain == boost::none || !this->bauthInitAccepted(plain.get())) {
+        co_return false;
+    }
+    apdu = this->wrapOrLog(card, this->bauthStepCommand(0x80, handshake.message1(), false));
+    if (apdu == boost::none) {
+        co_return false;
+    }
+    plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+    if (plain == boost::none) {
+        co_return false;
+    }
+    auto message3 = handshake.message3(this->stepPayload(plain.get(), 0x81, "BAUTH message 2"));
+    if (message3.empty()) {
+        co_return false;
+    }
+    apdu = this->wrapOrLog(card, this->bauthStepCommand(0x82, message3, true));
+    if (apdu == boost::none) {
+        co_return false;
+    }
+    plain = this->unwrapOrLog(card, co_await loop.transmit(this->pcsc, std::move(apdu.get())));
+    if (plain == boost::none || !this->terminalAuthenticated(plain.get(), handshake, card)) {
+        co_return false;
+    }
+    this->terminalPool = &pool;
+    co_return true;
+}
+
+// MSE:SET AT naming BAUTH and the terminal certificate the card is to check
+template <size_t L>
+APDU BpaceSession<L>::bauthInitCommand(const TerminalKeyPool<L> &pool) {
+    std::vector<octet> data;
+    auto encoded = derEncode(0x80, std::vector<octet>(OID_BAUTH, OID_BAUTH + sizeof(OID_BAUTH)));
+    std::copy(encoded.begin(), encoded.end(), std::back_inserter(data));
+    encoded = derEncode(0x83, pool.getHolderRef());
+    std::copy(encoded.begin(), encoded.end(), std::back_inserter(data));
+    return this->onChannel(APDU(Cla::Default, Instruction::BPACEInit, 0x81, 0xA4, data));
+}
+
+template <size_t L>
+bool BpaceSession<L>::bauthInitAccepted(const std::vector<octet> &plain) {
+    auto resp = pcsc.decodeResponse(plain);
+    if (resp->sw1 != 0x90) {
+        logger->log(__FILE__, __LINE__, "Init BAUTH failed", LogLevel::ERROR);
+        return false;
+    }
+    return true;
+}
+
+template <size_t L>
+APDU BpaceSession<L>::bauthStepCommand(u32 tag, const std::vector<octet> &message, bool last) {
+    return this->onChannel(APDU(last ? Cla::Default : Cla::Chained, Instruction::BPACESteps, 0x00, 0x00,
+                                derEncode(0x7c, derEncode(tag, message))));
+}
+
+// SM switches to the BAUTH key once the card has accepted message 3
+template <size_t L>
+bool BpaceSession<L>::terminalAuthenticated(const std::vector<octet> &plain, TerminalHandshake<L> &handshake, CardSecure &card) {
+    auto resp = pcsc.decodeResponse(plain);
+    if (resp->sw1 != 0x90) {
+        logger->log(__FILE__, __LINE__, "Terminal authentication rejected", LogLevel::ERROR);
+        return false;
+    }
+    if (!handshake.deriveKey(this->key())) {
+        return false;
+    }
+    card.initSecure(this->key());
+    logger->log(__FILE__, __LINE__, "Successful terminal authentication", LogLevel::INFO);
+    return true;
+}
+
+template <size_t L>
+std::string BpaceSession<L>::getName() {
     auto card = CardSecure();
-    card.initSecure(this->k0);
+    card.initSecure(this->key());
     std::cout << chooseEF(card);
     std::cout << chooseEF(card);
     return "";
 }
 
-std::vector<octet> Bpace::createMessage1() {
+template <size_t L>
+PCSC& BpaceSession<L>::getPCSC() {
+    return this->pcsc;
+}
+
+template <size_t L>
+std::vector<octet> BpaceSession<L>::createMessage1() {
+    CARDLIB_ALLOC_SCOPE(AllocSite::BpaceStep2);
     std::vector<octet> message1;
 
-    err_t code = bakeBPACEStep2(this->out, this->state);
+    err_t code = traced("bakeBPACEStep2", [&]() { return bakeBPACEStep2(this->out().data(), this->state()); });
 
     if (code != ERR_OK) {
         this->logger->log(
             __FILE__, __LINE__, "Error in step2 BPACE: " + std::to_string(code), LogLevel::ERROR);
-        if (this->blob != nullptr) {
-            blobClose(this->blob);
-            this->blob = nullptr;
-        }
+        this->wipeHandshake();
         return message1;
     }
 
-    std::copy(this->out, this->out + (this->params.l / 8), back_inserter(message1));
+    std::copy_n(this->out().begin(), Level::M1, back_inserter(message1));
     try {
         message1 = derEncode(0x7c, derEncode(0x80, message1));
     } catch (int code) {
-        if (this->blob != nullptr) {
-            blobClose(this->blob);
-            this->blob = nullptr;
-        }
+        this->wipeHandshake();
         return message1;
     }
-    return APDUEncode(APDU(Cla::Chained, Instruction::BPACESteps, 0x00, 0x00, message1));
+    return this->encode(APDU(Cla::Chained, Instruction::BPACESteps, 0x00, 0x00, message1));
 }
 
-std::vector<octet> Bpace::createMessage3(std::vector<octet> message2) {
+template <size_t L>
+std::vector<octet> BpaceSession<L>::createMessage3(std::vector<octet> message2) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::BpaceStep4);
     std::vector<octet> message3;
-    this->in = new octet[message2.size()];
-    std::copy(message2.begin(), message2.end(), this->in);
-    prngEchoStart(this->echo, this->params.seed, 8);
-    int code = bakeBPACEStep4(this->out, this->in, this->state);
+    if (!this->secure || message2.size() != Level::M2) {
+        this->logger->log(__FILE__, __LINE__, "Error in step4 BPACE: bad message 2", LogLevel::ERROR);
+        return message3;
+    }
+    std::copy(message2.begin(), message2.end(), this->in().begin());
+    int code = traced("bakeBPACEStep4",
+                      [&]() { return bakeBPACEStep4(this->out().data(), this->in().data(), this->state()); });
 
-    int err = bakeBPACEStepG(this->k0, this->state);
+    int err = traced("bakeBPACEStepG", [&]() { return bakeBPACEStepG(this->key(), this->state()); });
 
     if (code != ERR_OK || err != ERR_OK) {
         this->logger->log(
             __FILE__, __LINE__, "Error in step4 BPACE: " + std::to_string(code), LogLevel::ERROR);
-        if (this->blob != nullptr) {
-            blobClose(this->blob);
-            this->blob = nullptr;
-        }
+        this->wipeHandshake();
         return message3;
     }
 
-    std::copy(this->out, this->out + (this->params.l / 2) + 8, back_inserter(message3));
+    std::copy_n(this->out().begin(), Level::M3, back_inserter(message3));
     message3 = derEncode(0x7c, derEncode(0x82, message3));
-    return APDUEncode(APDU(Cla::Default, Instruction::BPACESteps, 0x00, 0x00, message3));
+    return this->encode(APDU(Cla::Default, Instruction::BPACESteps, 0x00, 0x00, message3));
 }
 
-bool Bpace::lastAuthStep(std::vector<octet> message3) {
-    int err = bakeBPACEStep6(message3.data(), this->state);
-    if (err != ERR_OK) {
-        logger->log(__FILE__, __LINE__, "Error in last step BPACE: " + std::to_string(err), LogLevel::ERROR);
-        // this->isAuthorized = false;
-    } else {
-        // this->isAuthorized = true;
-    }
-    err = bakeBPACEStepG(this->k0, this->state);
-    if (err != ERR_OK) {
-        logger->log(__FILE__, __LINE__, "Error in last step BPACE: " + std::to_string(err), LogLevel::ERROR);
-        // this->isAuthorized = false;
+// The key derived in step 4 is only kept once the card has confirmed it with message 4
+template <size_t L>
+err_t BpaceSession<L>::lastAuthStep(std::vector<octet> message4) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::BpaceStep6);
+    err_t err = ERR_BAD_INPUT;
+    if (!this->secure || message4.size() != Level::M4) {
+        logger->log(__FILE__, __LINE__, "Error in last step BPACE: bad message 4", LogLevel::ERROR);
     } else {
-        // this->isAuthorized = true;
+        err = traced("bakeBPACEStep6", [&]() { return bakeBPACEStep6(message4.data(), this->state()); });
+        if (err == ERR_OK) {
+            err = traced("bakeBPACEStepG", [&]() { return bakeBPACEStepG(this->key(), this->state()); });
+        }
+        if (err != ERR_OK) {
+            logger->log(__FILE__, __LINE__, "Error in last step BPACE: " + std::to_string(err), LogLevel::ERROR);
+            memWipe(this->key(), Level::KEY);
+        }
     }
 
-    if (this->blob != nullptr) {
-        blobClose(this->blob);
-        this->blob = nullptr;
-    }
+    this->wipeHandshake();
 
-    return true;
+    return err;
 }
 
-std::vector<octet> Bpace::sendM1() {
+template <size_t L>
+std::vector<octet> BpaceSession<L>::sendM1() {
     return pcsc.sendCommandToCard(this->createMessage1());
 }
 
-std::vector<octet> Bpace::sendM3(std::vector<octet> message2) {
+template <size_t L>
+std::vector<octet> BpaceSession<L>::sendM3(std::vector<octet> message2) {
     auto mess = this->createMessage3(message2);
     // mess.push_back(0x0c);
     return pcsc.sendCommandToCard(mess);
 }
 
-void Bpace::getKey(octet* key0) {
-    std::copy(this->k0, this->k0 + 32, key0);
+template <size_t L>
+void BpaceSession<L>::getKey(octet* key0) {
+    if (!this->secure) {
+        memSetZero(key0, 32);
+        return;
+    }
+    std::copy_n(this->key(), Level::KEY, key0);
 }
 
-std::vector<octet> Bpace::getKey() {
-    return std::vector<octet>(this->k0, this->k0 + 32);
+template <size_t L>
+std::vector<octet> BpaceSession<L>::getKey() {
+    std::vector<octet> key(32);
+    this->getKey(key.data());
+    return key;
 }
 
-bool Bpace::authorize() {
-    auto m2 = this->sendM1();
-
-    auto resp = pcsc.decodeResponse(m2);
-
-    if (resp->sw1 != 0x90) {
-        logger->log(__FILE__, __LINE__, "Error in BPACE step 1", LogLevel::ERROR);
+template <size_t L>
+bool BpaceSession<L>::authorize() {
+    this->pcsc.traceContext();
+    if (this->open() != ERR_OK) {
         return false;
     }
-    logger->log(__FILE__, __LINE__, "Successful BPACE step 1", LogLevel::INFO);
-
-    auto tempDecoded = derDecode(0x7c, resp->rdf, resp->rdf_len);
-    auto apduResp = derDecode(0x81, tempDecoded.data(), tempDecoded.size());
-
-    std::vector<octet> message3;
-    std::copy(apduResp.begin(), apduResp.end(), std::back_inserter(message3));
-
-    if (message3.empty()) {
-        this->logger->log(__FILE__, __LINE__, "Authorization failed. Message 2", LogLevel::ERROR);
+    auto message2 = this->stepPayload(this->sendM1(), 0x81, "Message 2");
+    if (message2.empty()) {
         return false;
     }
 
-    auto m4 = this->sendM3(message3);
-    resp = pcsc.decodeResponse(m4);
-    tempDecoded = derDecode(0x7c, resp->rdf, resp->rdf_len);
-    apduResp = derDecode(0x83, tempDecoded.data(), tempDecoded.size());
-
-    std::vector<octet> M4(apduResp.size());
-    std::copy(apduResp.begin(), apduResp.end(), M4.begin());
+    auto M4 = this->stepPayload(this->sendM3(message2), 0x83, "Message 4");
     if (M4.empty()) {
-        this->logger->log(__FILE__, __LINE__, "Authorization failed. Message 4", LogLevel::ERROR);
         return false;
     }
 
-    bool isAuthorized = lastAuthStep(M4);
-    if (isAuthorized) {
-        octet k0[32];
-        this->getKey(k0);
-        // this->sender->initSecureContext(k0, k1);
+    if (this->lastAuthStep(M4) != ERR_OK) {
+        return false;
     }
+    this->authorized = true;
     this->logger->log(__FILE__, __LINE__, "Successful authorization", LogLevel::INFO);
     return true;
-}
\ No newline at end of file
+}
+
+template <size_t L>
+Task<bool> BpaceSession<L>::authorize(EventLoop &loop) {
+    this->pcsc.traceContext();
+    if (co_await this->open(loop) != ERR_OK) {
+        co_return false;
+    }
+    auto message2 = this->stepPayload(co_await loop.transmit(this->pcsc, this->createMessage1()), 0x81, "Message 2");
+    if (message2.empty()) {
+        co_return false;
+    }
+    auto message4 =
+        this->stepPayload(co_await loop.transmit(this->pcsc, this->createMessage3(message2)), 0x83, "Message 4");
+    if (message4.empty()) {
+        co_return false;
+    }
+    if (this->lastAuthStep(message4) != ERR_OK) {
+        co_return false;
+    }
+    this->authorized = true;
+    this->logger->log(__FILE__, __LINE__, "Successful authorization", LogLevel::INFO);
+    co_return true;
+}
+
+// Unwraps the dynamic authentication data object 7C and returns the step message under tag
+template <size_t L>
+std::vector<octet> BpaceSession<L>::stepPayload(const std::vector<octet> &response, u32 tag, const std::string &step) {
+    auto resp = pcsc.decodeResponse(response);
+    if (resp->sw1 != 0x90) {
+        logger->log(__FILE__, __LINE__, "Authorization failed. " + step + ": status word", LogLevel::ERROR);
+        return std::vector<octet>();
+    }
+    auto outer = derDecode(0x7c, resp->rdf, resp->rdf_len);
+    auto payload = derDecode(tag, outer.data(), outer.size());
+    if (payload.empty()) {
+        logger->log(__FILE__, __LINE__, "Authorization failed. " + step, LogLevel::ERROR);
+    }
+    return payload;
+}
+
+template class BpaceSession<128>;
+template class BpaceSession<192>;
+template class BpaceSession<256>;
@@ -0,0 +1,191 @@
+#include <capabilityCache.h>
+
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+std::shared_ptr<CapabilityCache> CapabilityCache::cacheInstance;
+std::mutex cacheInstanceMutex;
+
+static std::string toHex(const std::vector<octet>& data) {
+    const char digits[] = "0123456789ABCDEF";
+    std::string res;
+    for (auto b : data) {
+        res.push_back(digits[b >> 4]);
+        res.push_back(digits[b & 0x0F]);
+    }
+    return res;
+}
+
+// The file may be corrupted or edited by hand, a bad field invalidates only its entry
+static boost::optional<std::vector<octet>> fromHex(const std::string& hex) {
+    if (hex.size() % 2 != 0) {
+        return boost::none;
+    }
+    std::vector<octet> res(hex.size() / 2);
+    for (size_t i = 0; i < res.size(); i++) {
+        auto [end, ec] = std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, res[i], 16);
+        if (ec != std::errc() || end != hex.data() + 2 * i + 2) {
+            return boost::none;
+        }
+    }
+    return res;
+}
+
+static boost::optional<size_t> parseSize(const std::string& text) {
+    size_t value = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (text.empty() || ec != std::errc() || end != text.data() + text.size()) {
+        return boost::none;
+    }
+    return value;
+}
+
+CapabilityCache::CapabilityCache() {
+    this->logger = Logger::getInstance();
+
+    std::string dir = directory();
+    if (!dir.empty()) {
+        this->path = (std::filesystem::path(dir) / "capabilities").string();
+    }
+    this->load();
+}
+
+std::string CapabilityCache::directory() {
+    std::filesystem::path dir;
+    if (const char* env = std::getenv("CARDLIB_CACHE_DIR")) {
+        dir = env;
+    } else if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        dir = std::filesystem::path(xdg) / "cardlib";
+    } else if (const char* home = std::getenv("HOME")) {
+        dir = std::filesystem::path(home) / ".cache" / "cardlib";
+    }
+    return dir.string();
+}
+
+std::shared_ptr<CapabilityCache> CapabilityCache::getInstance() {
+    std::lock_guard<std::mutex> lock(cacheInstanceMutex);
+    if (cacheInstance == nullptr) {
+        cacheInstance = std::shared_ptr<CapabilityCache>(new CapabilityCache());
+    }
+
+    return cacheInstance;
+}
+
+// Reader names end with slot and index numbers that differ between machines
+std::string CapabilityCache::readerModel(const std::string& reader) {
+    std::istringstream stream(reader);
+    std::vector<std::string> words;
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    while (!words.empty() && words.back().find_first_not_of("0123456789") == std::string::npos) {
+        words.pop_back();
+    }
+    std::string model;
+    for (auto& w : words) {
+        model += (model.empty() ? "" : " ") + w;
+    }
+    return model;
+}
+
+// One entry per line: atr, reader model, max command, max response, extended, chaining, sm, applets
+void CapabilityCache::load() {
+    if (this->path.empty()) {
+        return;
+    }
+    std::ifstream file(this->path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        std::string atr, reader, maxCommand, maxResponse, extended, chaining, sm, applets;
+        if (!std::getline(stream, atr, '\t') || !std::getline(stream, reader, '\t') ||
+            !std::getline(stream, maxCommand, '\t') || !std::getline(stream, maxResponse, '\t') ||
+            !std::getline(stream, extended, '\t') || !std::getline(stream, chaining, '\t') ||
+            !std::getline(stream, sm, '\t')) {
+            continue;
+        }
+        std::getline(stream, applets);
+
+        CardProfile profile;
+        auto command = parseSize(maxCommand);
+        auto response = parseSize(maxResponse);
+        if (command == boost::none || response == boost::none) {
+            continue;
+        }
+        profile.limits.maxCommand = command.get();
+        profile.limits.maxResponse = response.get();
+        profile.limits.extended = extended == "1";
+        profile.limits.chaining = chaining == "1";
+        profile.secureMessaging = sm == "1";
+        std::istringstream appletStream(applets);
+        std::string aid;
+        bool valid = true;
+        while (valid && std::getline(appletStream, aid, ',')) {
+            if (!aid.empty()) {
+                auto decoded = fromHex(aid);
+                valid = decoded != boost::none;
+                if (valid) {
+                    profile.applets.push_back(decoded.get());
+                }
+            }
+        }
+        if (!valid) {
+            logger->log(__FILE__, __LINE__, "Skipping invalid capability cache entry", LogLevel::WARN);
+            continue;
+        }
+        this->entries[atr + "\t" + reader] = profile;
+    }
+}
+
+bool CapabilityCache::save() {
+    if (this->path.empty()) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(this->path).parent_path(), ec);
+
+    // Other processes may be saving at the same time, each writes its own temporary file
+    std::string tmpPath = this->path + ".tmp" + std::to_string(getpid());
+    std::ofstream file(tmpPath, std::ios::trunc);
+    if (!file.good()) {
+        logger->log(__FILE__, __LINE__, "Cannot write capability cache: " + tmpPath, LogLevel::WARN);
+        return false;
+    }
+    for (auto& [key, profile] : this->entries) {
+        file << key << '\t' << profile.limits.maxCommand << '\t' << profile.limits.maxResponse << '\t'
+             << profile.limits.extended << '\t' << profile.limits.chaining << '\t' << profile.secureMessaging
+             << '\t';
+        for (size_t i = 0; i < profile.applets.size(); ++i) {
+            file << (i ? "," : "") << toHex(profile.applets[i]);
+        }
+        file << '\n';
+    }
+    file.close();
+    std::filesystem::rename(tmpPath, this->path, ec);
+    if (ec) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+boost::optional<CardProfile> CapabilityCache::find(const std::string& atr, const std::string& reader) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->entries.find(atr + "\t" + readerModel(reader));
+    if (it == this->entries.end()) {
+        return boost::none;
+    }
+    return it->second;
+}
+
+void CapabilityCache::store(const std::string& atr, const std::string& reader, const CardProfile& profile) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries[atr + "\t" + readerModel(reader)] = profile;
+    this->save();
+}
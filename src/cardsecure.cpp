@@ -1,5 +1,33 @@
 #include <cardsecure.h>
 
+// 0x87 data object, 0x99 status and 0x8E MAC added to a response under SM
+const size_t SM_RESPONSE_OVERHEAD = 20;
+
+CardSecure::CardSecure(const CardSecure& other) {
+    *this = other;
+}
+
+// SM state is flat memory, a copy continues from the same counter value.
+// An existing slot of the right size is reused, snapshots taken per command do not touch the arena.
+CardSecure& CardSecure::operator=(const CardSecure& other) {
+    if (this == &other) {
+        return *this;
+    }
+    this->logger = other.logger;
+    this->counter = other.counter;
+    if (!other.state) {
+        this->state = SecureSlot();
+        return *this;
+    }
+    if (!this->state || this->state.size() != other.state.size()) {
+        this->state = SecureArena::getInstance().acquire(other.state.size());
+    }
+    if (this->state) {
+        memCopy(this->state.data(), other.state.data(), other.state.size());
+    }
+    return *this;
+}
+
 void CardSecure::initSecure(octet key0[32]) {
     this->logger = Logger::getInstance();
     this->counter = 0;
@@ -7,10 +35,13 @@ void CardSecure::initSecure(octet key0[32]) {
     auto header = std::vector<octet>(16, 0xFF);
     
     
-    octet* stack = new octet[btokSM_keep()];
-    this->state = (void*)stack;
+    this->state = SecureArena::getInstance().acquire(btokSM_keep());
+    if (!this->state) {
+        logger->log(__FILE__, __LINE__, "Cannot allocate SM state", LogLevel::ERROR);
+        return;
+    }
 
-    btokSMStart(this->state, key0);
+    btokSMStart(this->state.data(), key0);
     
     
     // octet* stack = new octet[beltKRP_keep()];
@@ -43,14 +74,61 @@ void CardSecure::initSecure(octet key0[32]) {
 }
 
 
-boost::optional<APDU> CardSecure::APDUEncrypt(APDU command) {
+size_t CardSecure::plainResponseCapacity(size_t maxResponse) {
+    return maxResponse - SM_RESPONSE_OVERHEAD;
+}
 
+boost::optional<std::vector<octet>> CardSecure::wrapCommand(const APDU& command) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::SmWrap);
+    CARDLIB_TRACE_SPAN("SM wrap");
+    auto cmd = APDUToCmd(command);
+    if (cmd.empty() || !this->state) {
+        return boost::none;
+    }
 
-    btokSMCtrInc(this->state);
-    auto cmd = new octet[1024];
+    btokSMCtrInc(this->state.data());
     size_t cmdLen;
+    if (btokSMCmdWrap(0, &cmdLen, (const apdu_cmd_t*)cmd.data(), this->state.data()) != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Cannot wrap APDU", LogLevel::ERROR);
+        return boost::none;
+    }
+    std::vector<octet> wrapped(cmdLen);
+    if (btokSMCmdWrap(wrapped.data(), &cmdLen, (const apdu_cmd_t*)cmd.data(), this->state.data()) != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Cannot wrap APDU", LogLevel::ERROR);
+        return boost::none;
+    }
+    wrapped.resize(cmdLen);
+    return wrapped;
+}
 
-    btokSMCmdWrap(cmd, &cmdLen, APDUEncode(command).data(), this->state);
+boost::optional<std::vector<octet>> CardSecure::unwrapResponse(const std::vector<octet>& response) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::SmUnwrap);
+    CARDLIB_TRACE_SPAN("SM unwrap");
+    if (!this->state) {
+        return boost::none;
+    }
+    size_t size;
+    if (btokSMRespUnwrap(0, &size, response.data(), response.size(), this->state.data()) != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Cannot unwrap response", LogLevel::ERROR);
+        return boost::none;
+    }
+    std::vector<octet> buffer(size);
+    apdu_resp_t* resp = (apdu_resp_t*)buffer.data();
+    if (btokSMRespUnwrap(resp, &size, response.data(), response.size(), this->state.data()) != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Cannot unwrap response", LogLevel::ERROR);
+        return boost::none;
+    }
+    std::vector<octet> plain(apduRespEnc(0, resp));
+    apduRespEnc(plain.data(), resp);
+    return plain;
+}
+
+boost::optional<APDU> CardSecure::APDUEncrypt(APDU command) {
+    auto wrapped = this->wrapCommand(command);
+    if (wrapped == boost::none) {
+        return boost::none;
+    }
+    return APDUDecode(wrapped.get());
     // ++this->counter;
     // auto counterArr = static_cast<octet*>(static_cast<void*>(&this->counter));
     // std::vector<octet> iv(counterArr, counterArr + 16);
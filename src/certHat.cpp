@@ -1,17 +1,45 @@
 #include <certHat.h>
+#include <apducmd.h>
 #include <stdio.h>
 #include <iostream>
+#include <utility>
 
 CertHAT::CertHAT(std::vector<octet> objId, std::vector<octet> access) {
-    this->objId = std::vector<octet>(objId);
-    this->discretionaryData = std::vector<octet>(access);
+    this->objId = std::move(objId);
+    this->discretionaryData = std::move(access);
 }
 
 
 std::vector<octet> CertHAT::encode() {
     std::vector<octet> res;
-    
+    res.reserve(objId.size() + discretionaryData.size());
     std::copy(objId.begin(), objId.end() , std::back_inserter(res));
     std::copy(discretionaryData.begin(), discretionaryData.end() , std::back_inserter(res));
     return res;
 }
+
+// A CHAT is 7F4C { 06 oid, 04 or 53 access }, split the same way encode() joins it
+boost::optional<CertHAT> CertHAT::decode(std::span<const octet> data) {
+    u32 tag;
+    std::span<const octet> value;
+    size_t size = derTLV(data, tag, value);
+    if (size == 0 || tag != 0x7F4C) {
+        return boost::none;
+    }
+    std::span<const octet> oid;
+    size_t oidSize = derTLV(value, tag, oid);
+    if (oidSize == 0 || tag != 0x06) {
+        return boost::none;
+    }
+    size_t headerSize = size - value.size() + oidSize;
+    return CertHAT(std::vector<octet>(data.begin(), data.begin() + headerSize),
+                   std::vector<octet>(data.begin() + headerSize, data.begin() + size));
+}
+
+const std::vector<octet>& CertHAT::getObjectId() const {
+    return this->objId;
+}
+
+const std::vector<octet>& CertHAT::getDiscretionaryData() const {
+    return this->discretionaryData;
+}
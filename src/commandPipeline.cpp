@@ -0,0 +1,111 @@
+#include <commandPipeline.h>
+
+#include <algorithm>
+
+CommandPipeline::CommandPipeline(PCSC& pcsc, size_t depth)
+    : pcsc(pcsc), depth(std::clamp<size_t>(depth, 1, MAX_DEPTH)) {
+    this->logger = Logger::getInstance();
+    this->io = std::thread(&CommandPipeline::ioStage, this);
+}
+
+CommandPipeline::~CommandPipeline() {
+    this->toCard.push(nullptr);
+    this->io.join();
+}
+
+// The card answers in order, so responses come back in the order the commands were wrapped. Once
+// the run stops, the commands still queued are handed back unsent.
+void CommandPipeline::ioStage() {
+    while (true) {
+        Slot* slot = this->toCard.waitPop();
+        if (slot == nullptr) {
+            return;
+        }
+        slot->sent = !this->stopped.load(std::memory_order_acquire);
+        if (slot->sent) {
+            slot->response = this->pcsc.sendCommandToCard(std::move(slot->command));
+            slot->error = this->pcsc.getLastError();
+        }
+        this->fromCard.push(slot);
+    }
+}
+
+size_t CommandPipeline::run(
+    CardSecure& card,
+    const std::function<boost::optional<APDU>(size_t)>& next,
+    const std::function<bool(size_t, const boost::optional<std::vector<octet>>&)>& onResponse) {
+    size_t issued = 0, completed = 0, delivered = 0;
+    bool issuing = true, stopped = false, dropped = false;
+    Slot* lastSent = nullptr;
+    this->lastError = CardError::None;
+    this->stopped.store(false, std::memory_order_release);
+
+    // After a stop the remaining responses only need to be collected
+    auto complete = [&](Slot* slot) {
+        completed++;
+        if (slot->sent) {
+            lastSent = slot;
+        } else {
+            dropped = true;
+        }
+        if (stopped) {
+            return;
+        }
+        boost::optional<std::vector<octet>> plain;
+        if (slot->error == CardError::None && slot->response.empty()) {
+            slot->error = CardError::Transport;
+        }
+        if (slot->error == CardError::None) {
+            plain = slot->context.unwrapResponse(slot->response);
+        }
+        if (plain == boost::none) {
+            this->lastError = slot->error != CardError::None ? slot->error : CardError::SecureMessaging;
+        }
+        delivered++;
+        if (!onResponse(slot->index, plain) || plain == boost::none) {
+            issuing = false;
+            stopped = true;
+            this->stopped.store(true, std::memory_order_release);
+        }
+    };
+
+    while (issuing || completed < issued) {
+        if (issuing && issued - completed < this->depth) {
+            auto command = next(issued);
+            auto wrapped = command == boost::none ? boost::none : card.wrapCommand(command.get());
+            if (wrapped == boost::none) {
+                if (command != boost::none) {
+                    logger->log(__FILE__, __LINE__, "Pipeline stopped: cannot encrypt APDU", LogLevel::ERROR);
+                    this->lastError = CardError::SecureMessaging;
+                }
+                issuing = false;
+                continue;
+            }
+            Slot& slot = this->slots[issued % this->depth];
+            slot.index = issued++;
+            slot.command = std::move(wrapped.get());
+            slot.context = card;
+            this->toCard.push(&slot);
+
+            // Unwrap whatever the card already answered before wrapping further ahead
+            Slot* done;
+            while (this->fromCard.pop(done)) {
+                complete(done);
+            }
+            continue;
+        }
+        complete(this->fromCard.waitPop());
+    }
+    if (dropped && lastSent != nullptr) {
+        card = lastSent->context;
+    }
+    // The pipeline outlives the run, the copies of the SM state must not
+    for (size_t i = 0; i < std::min(issued, this->depth); ++i) {
+        this->slots[i].context = CardSecure();
+    }
+    return delivered;
+}
+
+CardError CommandPipeline::getLastError() const {
+    return this->lastError;
+}
@@ -0,0 +1,203 @@
+#include <cvCertificate.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <utility>
+
+static const char* hashOidForLevel(size_t l) {
+    switch (l) {
+        case 192:
+            return "1.2.112.0.2.0.34.101.77.12";
+        case 256:
+            return "1.2.112.0.2.0.34.101.77.13";
+        default:
+            return OID_BELT_HASH;
+    }
+}
+
+boost::optional<CVCertificate> CVCertificate::parse(std::span<const octet> data) {
+    CVCertificate cert;
+    u32 tag;
+    std::span<const octet> content;
+    size_t size = derTLV(data, tag, content);
+    if (size == 0 || tag != 0x7F21) {
+        return boost::none;
+    }
+    cert.raw = data.first(size);
+
+    std::span<const octet> bodyContent;
+    size_t bodySize = derTLV(content, tag, bodyContent);
+    if (bodySize == 0 || tag != 0x7F4E) {
+        return boost::none;
+    }
+    cert.body = content.first(bodySize);
+    if (derTLV(content.subspan(bodySize), tag, cert.signature) == 0 || tag != 0x5F37) {
+        return boost::none;
+    }
+
+    std::span<const octet> value;
+    for (size_t pos = 0; pos < bodyContent.size();) {
+        auto rest = bodyContent.subspan(pos);
+        size_t count = derTLV(rest, tag, value);
+        if (count == 0) {
+            return boost::none;
+        }
+        switch (tag) {
+            case 0x5F29:
+                cert.profileId = value;
+                break;
+            case 0x42:
+                cert.authorityRef = value;
+                break;
+            case 0x7F49: {
+                std::span<const octet> item;
+                for (size_t keyPos = 0; keyPos < value.size();) {
+                    size_t keyCount = derTLV(value.subspan(keyPos), tag, item);
+                    if (keyCount == 0) {
+                        return boost::none;
+                    }
+                    if (tag == 0x06) {
+                        cert.publicKeyOid = item;
+                    } else if (tag == 0x86) {
+                        cert.publicKey = item;
+                    }
+                    keyPos += keyCount;
+                }
+                break;
+            }
+            case 0x5F20:
+                cert.holderRef = value;
+                break;
+            case 0x7F4C:
+                cert.chat = rest.first(count);
+                break;
+            case 0x5F25:
+                cert.effectiveDate = value;
+                break;
+            case 0x5F24:
+                cert.expirationDate = value;
+                break;
+            case 0x65:
+                cert.extensions = value;
+                break;
+        }
+        pos += count;
+    }
+    if (cert.authorityRef.empty() || cert.publicKey.empty() || cert.holderRef.empty()) {
+        return boost::none;
+    }
+    return cert;
+}
+
+boost::optional<uint32_t> CVCertificate::date(std::span<const octet> value) {
+    if (value.size() != 6 || std::any_of(value.begin(), value.end(), [](octet digit) { return digit > 9; })) {
+        return boost::none;
+    }
+    uint32_t month = value[2] * 10 + value[3], day = value[4] * 10 + value[5];
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return boost::none;
+    }
+    return (2000 + value[0] * 10 + value[1]) * 10000 + month * 100 + day;
+}
+
+uint32_t CVCertificate::date(std::chrono::system_clock::time_point when) {
+    time_t seconds = std::chrono::system_clock::to_time_t(when);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    return (utc.tm_year + 1900) * 10000 + (utc.tm_mon + 1) * 100 + utc.tm_mday;
+}
+
+boost::optional<CertHAT> CVCertificate::getCertHAT() const {
+    if (this->chat.empty()) {
+        return boost::none;
+    }
+    return CertHAT::decode(this->chat);
+}
+
+bool CVCertificate::verify(const std::vector<octet>& issuerPubkey, SignatureVerifier& verifier) const {
+    // The level of the issuer key selects the hash: belt-hash for 128, bash for higher levels
+    size_t l = issuerPubkey.size() * 2;
+    Hasher hasher(l == 256 ? HashAlg::Bash512 : l == 192 ? HashAlg::Bash384 : HashAlg::BeltHash);
+    hasher.update(this->body.data(), this->body.size());
+
+    VerifyRequest request;
+    request.pubkey = issuerPubkey;
+    request.hash = hasher.finish();
+    request.signature = std::vector<octet>(this->signature.begin(), this->signature.end());
+    request.hashOid = hashOidForLevel(l);
+    return verifier.verify(request);
+}
+
+CVCertificateCache::CVCertificateCache(SignatureVerifier& verifier, size_t capacity)
+    : verifier(verifier), capacity(capacity) {
+    this->logger = Logger::getInstance();
+}
+
+CVCertificateCache::Entry CVCertificateCache::validate(std::span<const octet> certificate,
+                                                       const std::vector<octet>& issuerPubkey) {
+    Hasher hasher;
+    hasher.update(certificate.data(), certificate.size());
+    hasher.update(issuerPubkey.data(), issuerPubkey.size());
+    auto hash = hasher.finish();
+    Key key(hash.begin(), hash.end());
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->index.find(key);
+        if (it != this->index.end()) {
+            this->entries.splice(this->entries.begin(), this->entries, it->second);
+            return it->second->second;
+        }
+    }
+
+    Entry entry;
+    auto cert = CVCertificate::parse(certificate);
+    if (cert == boost::none) {
+        logger->log(__FILE__, __LINE__, "Cannot parse CV certificate", LogLevel::ERROR);
+    } else {
+        entry.verified = cert->verify(issuerPubkey, this->verifier);
+        entry.publicKey = std::vector<octet>(cert->publicKey.begin(), cert->publicKey.end());
+        entry.authorityRef = std::vector<octet>(cert->authorityRef.begin(), cert->authorityRef.end());
+        entry.holderRef = std::vector<octet>(cert->holderRef.begin(), cert->holderRef.end());
+        entry.effective = CVCertificate::date(cert->effectiveDate).value_or(0);
+        entry.expiration = CVCertificate::date(cert->expirationDate).value_or(0);
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->index.find(key) == this->index.end()) {
+        this->entries.emplace_front(key, entry);
+        this->index[key] = this->entries.begin();
+        if (this->entries.size() > this->capacity) {
+            this->index.erase(this->entries.back().first);
+            this->entries.pop_back();
+        }
+    }
+    return entry;
+}
+
+boost::optional<std::vector<octet>> CVCertificateCache::validateChain(
+    const std::vector<std::span<const octet>>& chain, const std::vector<octet>& anchorPubkey,
+    const std::vector<octet>& anchorRef, std::chrono::system_clock::time_point now) {
+    uint32_t today = CVCertificate::date(now);
+    std::vector<octet> issuer = anchorPubkey;
+    std::vector<octet> issuerRef = anchorRef;
+    for (auto& certificate : chain) {
+        auto entry = this->validate(certificate, issuer);
+        if (!entry.verified) {
+            return boost::none;
+        }
+        if (entry.authorityRef != issuerRef) {
+            logger->log(__FILE__, __LINE__, "CV certificate is not issued by the previous holder", LogLevel::ERROR);
+            return boost::none;
+        }
+        if (entry.effective == 0 || entry.expiration == 0 || today < entry.effective || today > entry.expiration) {
+            logger->log(__FILE__, __LINE__, "CV certificate is not valid on " + std::to_string(today),
+                        LogLevel::ERROR);
+            return boost::none;
+        }
+        issuer = std::move(entry.publicKey);
+        issuerRef = std::move(entry.holderRef);
+    }
+    return issuer;
+}
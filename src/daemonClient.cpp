@@ -0,0 +1,95 @@
+#include <daemonClient.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+DaemonClient::DaemonClient() {
+    this->logger = Logger::getInstance();
+}
+
+DaemonClient::~DaemonClient() {
+    if (this->fd >= 0) {
+        ::close(this->fd);
+    }
+}
+
+int DaemonClient::connectTo(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        logger->log(__FILE__, __LINE__, "Daemon socket path is too long", LogLevel::ERROR);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd < 0 || connect(this->fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        logger->log(__FILE__, __LINE__, "Cannot connect to daemon: " + path, LogLevel::ERROR);
+        if (this->fd >= 0) {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+boost::optional<std::vector<octet>> DaemonClient::request(DaemonOp op,
+                                                          u32 session,
+                                                          const std::vector<octet>& payload) {
+    DaemonFrame frame;
+    frame.code = static_cast<octet>(op);
+    frame.session = session;
+    frame.payload = payload;
+    if (this->fd < 0 || !sendFrame(this->fd, frame)) {
+        logger->log(__FILE__, __LINE__, "Cannot send request to daemon", LogLevel::ERROR);
+        return boost::none;
+    }
+    auto reply = recvFrame(this->fd);
+    if (reply == boost::none) {
+        logger->log(__FILE__, __LINE__, "No reply from daemon", LogLevel::ERROR);
+        return boost::none;
+    }
+    if (reply->code != static_cast<octet>(DaemonStatus::Ok)) {
+        logger->log(__FILE__, __LINE__, "Daemon error: " + std::to_string(reply->code), LogLevel::ERROR);
+        return boost::none;
+    }
+    this->lastSession = reply->session;
+    return reply->payload;
+}
+
+boost::optional<u32> DaemonClient::open(const std::string& password, Pwd pwd_type) {
+    std::vector<octet> payload(1, static_cast<octet>(pwd_type));
+    payload.insert(payload.end(), password.begin(), password.end());
+    if (this->request(DaemonOp::Open, 0, payload) == boost::none) {
+        return boost::none;
+    }
+    return this->lastSession;
+}
+
+boost::optional<std::vector<octet>> DaemonClient::transmit(u32 session, const APDU& command) {
+    auto apdu = APDUEncode(command);
+    if (apdu.empty()) {
+        return boost::none;
+    }
+    return this->request(DaemonOp::Transmit, session, apdu);
+}
+
+boost::optional<std::vector<octet>> DaemonClient::readEF(u32 session) {
+    return this->request(DaemonOp::ReadEF, session, {});
+}
+
+boost::optional<std::vector<octet>> DaemonClient::sign(u32 session, const std::vector<octet>& digest) {
+    return this->request(DaemonOp::Sign, session, digest);
+}
+
+bool DaemonClient::close(u32 session) {
+    return this->request(DaemonOp::Close, session, {}) != boost::none;
+}
+
+bool DaemonClient::terminate(u32 session) {
+    return this->request(DaemonOp::Terminate, session, {}) != boost::none;
+}
@@ -0,0 +1,87 @@
+#include <daemonProtocol.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+static bool writeAll(int fd, const octet* data, size_t len) {
+    while (len > 0) {
+        ssize_t count = write(fd, data, len);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        len -= count;
+    }
+    return true;
+}
+
+static bool readAll(int fd, octet* data, size_t len) {
+    while (len > 0) {
+        ssize_t count = read(fd, data, len);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        len -= count;
+    }
+    return true;
+}
+
+static void putU32(octet* dest, u32 value) {
+    for (size_t i = 0; i < 4; ++i) {
+        dest[i] = static_cast<octet>(value >> (8 * i));
+    }
+}
+
+static u32 getU32(const octet* src) {
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((u32)src[3] << 24);
+}
+
+bool sendFrame(int fd, const DaemonFrame& frame) {
+    if (frame.payload.size() > DAEMON_MAX_PAYLOAD) {
+        return false;
+    }
+    std::vector<octet> buffer(DAEMON_HEADER_SIZE + frame.payload.size());
+    buffer[0] = frame.code;
+    putU32(buffer.data() + 1, frame.session);
+    putU32(buffer.data() + 5, frame.payload.size());
+    std::copy(frame.payload.begin(), frame.payload.end(), buffer.begin() + DAEMON_HEADER_SIZE);
+    return writeAll(fd, buffer.data(), buffer.size());
+}
+
+boost::optional<DaemonFrame> recvFrame(int fd) {
+    octet header[DAEMON_HEADER_SIZE];
+    if (!readAll(fd, header, sizeof(header))) {
+        return boost::none;
+    }
+    DaemonFrame frame;
+    frame.code = header[0];
+    frame.session = getU32(header + 1);
+    u32 len = getU32(header + 5);
+    if (len > DAEMON_MAX_PAYLOAD) {
+        return boost::none;
+    }
+    frame.payload.resize(len);
+    if (!readAll(fd, frame.payload.data(), len)) {
+        return boost::none;
+    }
+    return frame;
+}
+
+std::string defaultDaemonSocket() {
+    if (const char* env = std::getenv("CARDLIB_SOCKET")) {
+        return env;
+    }
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR")) {
+        return std::string(runtime) + "/cardlibd.sock";
+    }
+    return "/tmp/cardlibd.sock";
+}
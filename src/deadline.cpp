@@ -0,0 +1,61 @@
+#include <deadline.h>
+
+Deadline Deadline::after(Clock::duration timeout) {
+    return at(Clock::now() + timeout);
+}
+
+Deadline Deadline::at(Clock::time_point when) {
+    Deadline deadline;
+    deadline.when = when;
+    deadline.state = std::make_shared<State>();
+    return deadline;
+}
+
+bool Deadline::isSet() const {
+    return this->state != nullptr;
+}
+
+bool Deadline::expired() const {
+    return this->state != nullptr && (this->cancelled() || Clock::now() >= this->when);
+}
+
+Deadline::Clock::time_point Deadline::getTime() const {
+    return this->when;
+}
+
+void Deadline::cancel() const {
+    if (this->state == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->state->mutex);
+        this->state->cancelled = true;
+    }
+    this->state->condition.notify_all();
+}
+
+bool Deadline::cancelled() const {
+    if (this->state == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(this->state->mutex);
+    return this->state->cancelled;
+}
+
+CardError Deadline::error() const {
+    if (this->cancelled()) {
+        return CardError::Cancelled;
+    }
+    return this->expired() ? CardError::DeadlineExceeded : CardError::None;
+}
+
+// Taking the mutex orders the notification after a waiter that is about to sleep
+void Deadline::notify() const {
+    if (this->state == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->state->mutex);
+    }
+    this->state->condition.notify_all();
+}
@@ -0,0 +1,190 @@
+#include <efCache.h>
+
+#include <capabilityCache.h>
+#include <hasher.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+std::shared_ptr<EfCache> EfCache::cacheInstance;
+std::mutex efCacheInstanceMutex;
+
+// Entry file: magic | data length | belt-hash of the data | data
+const char EF_CACHE_MAGIC[8] = {'C', 'L', 'E', 'F', 'v', '1', 0, 0};
+const size_t EF_CACHE_HASH = 32;
+const size_t EF_CACHE_HEADER = sizeof(EF_CACHE_MAGIC) + sizeof(uint64_t) + EF_CACHE_HASH;
+
+static std::string toHex(const std::vector<octet>& data) {
+    const char digits[] = "0123456789abcdef";
+    std::string res;
+    for (auto b : data) {
+        res.push_back(digits[b >> 4]);
+        res.push_back(digits[b & 0x0F]);
+    }
+    return res;
+}
+
+static std::vector<octet> beltHash(const octet* data, size_t len) {
+    Hasher hasher;
+    hasher.update(data, len);
+    return hasher.finish();
+}
+
+EfCache::EfCache() {
+    this->logger = Logger::getInstance();
+    std::string base = CapabilityCache::directory();
+    if (!base.empty()) {
+        this->dir = (std::filesystem::path(base) / "ef").string();
+    }
+}
+
+std::shared_ptr<EfCache> EfCache::getInstance() {
+    std::lock_guard<std::mutex> lock(efCacheInstanceMutex);
+    if (cacheInstance == nullptr) {
+        cacheInstance = std::shared_ptr<EfCache>(new EfCache());
+    }
+    return cacheInstance;
+}
+
+void EfCache::allow(const std::vector<octet>& efId) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->allowed.insert(efId);
+}
+
+bool EfCache::cacheable(const std::vector<octet>& efId) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return !this->dir.empty() && this->allowed.count(efId) != 0;
+}
+
+std::string EfCache::key(const std::string& atr, const std::vector<octet>& efId, std::span<const octet> head) {
+    Hasher hasher;
+    hasher.update(reinterpret_cast<const octet*>(atr.data()), atr.size());
+    octet idLength = static_cast<octet>(efId.size());
+    hasher.update(&idLength, 1);
+    hasher.update(efId.data(), efId.size());
+    hasher.update(head.data(), std::min(head.size(), PROBE));
+    return toHex(hasher.finish());
+}
+
+bool EfCache::tailMatches(const std::vector<octet>& cached, const std::vector<octet>& tail) {
+    return cached.size() > PROBE && tail.size() == PROBE && std::equal(tail.begin(), tail.end(), cached.end() - PROBE);
+}
+
+// A file that is truncated or fails its hash is dropped, the caller then reads the card
+boost::optional<EfCache::Mapping> EfCache::map(const std::string& key) {
+    std::string path = (std::filesystem::path(this->dir) / key).string();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return boost::none;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) > EF_CACHE_HEADER) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return boost::none;
+    }
+
+    const octet* base = static_cast<const octet*>(map);
+    Mapping mapping{base + EF_CACHE_HEADER, static_cast<size_t>(st.st_size) - EF_CACHE_HEADER};
+    uint64_t length;
+    std::memcpy(&length, base + sizeof(EF_CACHE_MAGIC), sizeof(length));
+    bool valid = std::memcmp(base, EF_CACHE_MAGIC, sizeof(EF_CACHE_MAGIC)) == 0 && length == mapping.size;
+    if (valid) {
+        auto hash = beltHash(mapping.data, mapping.size);
+        valid = std::equal(hash.begin(), hash.end(), base + sizeof(EF_CACHE_MAGIC) + sizeof(length));
+    }
+    if (!valid) {
+        munmap(map, st.st_size);
+        logger->log(__FILE__, __LINE__, "Dropping corrupt EF cache entry " + key, LogLevel::WARN);
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return boost::none;
+    }
+    return mapping;
+}
+
+void EfCache::unmap(const Mapping& mapping) {
+    munmap(const_cast<octet*>(mapping.data - EF_CACHE_HEADER), mapping.size + EF_CACHE_HEADER);
+}
+
+boost::optional<std::vector<octet>> EfCache::find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->dir.empty()) {
+        return boost::none;
+    }
+    auto it = this->mapped.find(key);
+    if (it != this->mapped.end()) {
+        this->lru.splice(this->lru.begin(), this->lru, it->second);
+    } else {
+        auto mapping = this->map(key);
+        if (mapping == boost::none) {
+            return boost::none;
+        }
+        // The least recently used entry is unmapped when too many are, a long-running process
+        // sees many cards
+        this->lru.emplace_front(key, mapping.get());
+        this->mapped[key] = this->lru.begin();
+        if (this->lru.size() > MAX_MAPPED) {
+            this->unmap(this->lru.back().second);
+            this->mapped.erase(this->lru.back().first);
+            this->lru.pop_back();
+        }
+    }
+    const Mapping& mapping = this->lru.front().second;
+    return std::vector<octet>(mapping.data, mapping.data + mapping.size);
+}
+
+// Written to a private temporary file and renamed, readers in other processes never see a partial entry
+bool EfCache::store(const std::string& key, const std::vector<octet>& data) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->dir.empty() || data.empty()) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(this->dir, ec);
+
+    std::string path = (std::filesystem::path(this->dir) / key).string();
+    std::string tmpPath = path + ".tmp" + std::to_string(getpid());
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        logger->log(__FILE__, __LINE__, "Cannot write EF cache entry: " + tmpPath, LogLevel::WARN);
+        return false;
+    }
+    std::vector<octet> file(EF_CACHE_HEADER);
+    uint64_t length = data.size();
+    auto hash = beltHash(data.data(), data.size());
+    std::memcpy(file.data(), EF_CACHE_MAGIC, sizeof(EF_CACHE_MAGIC));
+    std::memcpy(file.data() + sizeof(EF_CACHE_MAGIC), &length, sizeof(length));
+    std::copy(hash.begin(), hash.end(), file.begin() + sizeof(EF_CACHE_MAGIC) + sizeof(length));
+    file.insert(file.end(), data.begin(), data.end());
+
+    bool written = write(fd, file.data(), file.size()) == static_cast<ssize_t>(file.size());
+    written = close(fd) == 0 && written;
+    if (written) {
+        std::filesystem::rename(tmpPath, path, ec);
+    }
+    if (!written || ec) {
+        std::filesystem::remove(tmpPath, ec);
+        logger->log(__FILE__, __LINE__, "Cannot write EF cache entry: " + path, LogLevel::WARN);
+        return false;
+    }
+
+    // Lookups hand out copies, so the old mapping can go right away
+    auto it = this->mapped.find(key);
+    if (it != this->mapped.end()) {
+        this->unmap(it->second->second);
+        this->lru.erase(it->second);
+        this->mapped.erase(it);
+    }
+    return true;
+}
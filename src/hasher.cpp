@@ -0,0 +1,115 @@
+#include <hasher.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+// Window handed to the hash function before the pages behind it are released
+const size_t MAP_WINDOW = 8 << 20;
+const size_t READ_BLOCK = 1 << 20;
+const size_t READ_ALIGN = 4096;
+
+Hasher::Hasher(HashAlg alg) : alg(alg) {
+    if (alg == HashAlg::BeltHash) {
+        this->state.resize(beltHash_keep());
+        beltHashStart(this->state.data());
+    } else {
+        this->state.resize(bashHash_keep());
+        bashHashStart(this->state.data(), hashLength(alg) * 4);
+    }
+}
+
+size_t Hasher::hashLength(HashAlg alg) {
+    switch (alg) {
+        case HashAlg::Bash384:
+            return 48;
+        case HashAlg::Bash512:
+            return 64;
+        default:
+            return 32;
+    }
+}
+
+void Hasher::update(const octet* data, size_t len) {
+    if (this->alg == HashAlg::BeltHash) {
+        beltHashStepH(data, len, this->state.data());
+    } else {
+        bashHashStepH(data, len, this->state.data());
+    }
+}
+
+std::vector<octet> Hasher::finish() {
+    std::vector<octet> hash(hashLength(this->alg));
+    if (this->alg == HashAlg::BeltHash) {
+        beltHashStepG(hash.data(), this->state.data());
+    } else {
+        bashHashStepG(hash.data(), hash.size(), this->state.data());
+    }
+    return hash;
+}
+
+DocumentHasher::DocumentHasher(size_t threads) : pool(threads) {}
+
+std::vector<octet> DocumentHasher::hashFileSync(const std::string& path, HashAlg alg) {
+    auto logger = Logger::getInstance();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        logger->log(__FILE__, __LINE__, "Cannot open file for hashing: " + path, LogLevel::ERROR);
+        return std::vector<octet>();
+    }
+
+    Hasher hasher(alg);
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (map != MAP_FAILED) {
+        const octet* data = static_cast<const octet*>(map);
+        size_t size = st.st_size;
+        madvise(map, size, MADV_SEQUENTIAL);
+        for (size_t offset = 0; offset < size; offset += MAP_WINDOW) {
+            size_t len = std::min(MAP_WINDOW, size - offset);
+            if (offset + len < size) {
+                madvise((void*)(data + offset + len), std::min(MAP_WINDOW, size - offset - len), MADV_WILLNEED);
+            }
+            hasher.update(data + offset, len);
+            madvise((void*)(data + offset), len, MADV_DONTNEED);
+        }
+        munmap(map, size);
+    } else {
+        // Pipes, devices and mmap failures fall back to plain reads
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        octet* buffer = static_cast<octet*>(std::aligned_alloc(READ_ALIGN, READ_BLOCK));
+        ssize_t count;
+        while ((count = read(fd, buffer, READ_BLOCK)) > 0) {
+            hasher.update(buffer, count);
+        }
+        std::free(buffer);
+        if (count < 0) {
+            close(fd);
+            logger->log(__FILE__, __LINE__, "Cannot read file for hashing: " + path, LogLevel::ERROR);
+            return std::vector<octet>();
+        }
+    }
+    close(fd);
+    return hasher.finish();
+}
+
+std::shared_future<std::vector<octet>> DocumentHasher::hashFile(const std::string& path, HashAlg alg) {
+    return this->pool.submit([path, alg]() { return hashFileSync(path, alg); }).share();
+}
+
+std::vector<std::shared_future<std::vector<octet>>> DocumentHasher::hashFiles(const std::vector<std::string>& paths,
+                                                                              HashAlg alg) {
+    std::vector<std::shared_future<std::vector<octet>>> hashes;
+    for (auto& path : paths) {
+        hashes.push_back(this->hashFile(path, alg));
+    }
+    return hashes;
+}
@@ -31,6 +31,9 @@ void Logger::log(std::string codeFile,
                  int codeLine,
                  std::string message,
                  LogLevel messageLevel = LogLevel::DEBUG) {
+    if (messageLevel > this->logLevel) {
+        return;
+    }
     std::string logType;
     // Set Log Level Name
     switch (messageLevel) {
@@ -0,0 +1,316 @@
+#include <passiveAuth.h>
+
+#include <apducmd.h>
+
+#include <algorithm>
+
+struct HashOid {
+    std::vector<octet> der;
+    HashAlg alg;
+    const char* name;
+};
+
+// Contents of the OIDs of belt-hash and bash-hash
+static const HashOid HASH_OIDS[] = {
+    {{0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x1F, 0x51}, HashAlg::BeltHash, "1.2.112.0.2.0.34.101.31.81"},
+    {{0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x4D, 0x0B}, HashAlg::Bash256, "1.2.112.0.2.0.34.101.77.11"},
+    {{0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x4D, 0x0C}, HashAlg::Bash384, "1.2.112.0.2.0.34.101.77.12"},
+    {{0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x4D, 0x0D}, HashAlg::Bash512, "1.2.112.0.2.0.34.101.77.13"},
+};
+
+// id-signedData and id-messageDigest
+static const std::vector<octet> OID_SIGNED_DATA = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02};
+static const std::vector<octet> OID_MESSAGE_DIGEST = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04};
+
+// Takes the next TLV off the front of data if it carries the expected tag
+static bool next(std::span<const octet>& data, u32 tag, std::span<const octet>& value,
+                 std::span<const octet>* tlv = nullptr) {
+    u32 actual;
+    std::span<const octet> content;
+    size_t count = derTLV(data, actual, content);
+    if (count == 0 || actual != tag) {
+        return false;
+    }
+    if (tlv != nullptr) {
+        *tlv = data.first(count);
+    }
+    value = content;
+    data = data.subspan(count);
+    return true;
+}
+
+static bool equals(std::span<const octet> value, const std::vector<octet>& expected) {
+    return std::equal(value.begin(), value.end(), expected.begin(), expected.end());
+}
+
+// AlgorithmIdentifier with a hash OID, the parameters are ignored
+static const HashOid* hashAlgorithm(std::span<const octet> identifier) {
+    std::span<const octet> oid;
+    if (!next(identifier, 0x06, oid)) {
+        return nullptr;
+    }
+    for (auto& known : HASH_OIDS) {
+        if (equals(oid, known.der)) {
+            return &known;
+        }
+    }
+    return nullptr;
+}
+
+// LDSSecurityObject ::= SEQUENCE { version, hashAlgorithm, SEQUENCE OF { dataGroupNumber, hash } }
+static bool parseContent(std::span<const octet> data, SecurityObject& object) {
+    std::span<const octet> lds, value, identifier, hashes;
+    if (!next(data, 0x30, lds) || !next(lds, 0x02, value) || !next(lds, 0x30, identifier) ||
+        !next(lds, 0x30, hashes)) {
+        return false;
+    }
+    auto alg = hashAlgorithm(identifier);
+    if (alg == nullptr) {
+        return false;
+    }
+    object.groupHash = alg->alg;
+
+    std::span<const octet> entry, number, hash;
+    while (!hashes.empty()) {
+        if (!next(hashes, 0x30, entry) || !next(entry, 0x02, number) || !next(entry, 0x04, hash) ||
+            number.empty() || number.size() > 2 || hash.size() != Hasher::hashLength(alg->alg)) {
+            return false;
+        }
+        int group = 0;
+        for (auto b : number) {
+            group = (group << 8) | b;
+        }
+        object.groupHashes[group] = hash;
+    }
+    return true;
+}
+
+// ContentInfo { signedData, [0] SignedData { version, digestAlgorithms, encapContentInfo,
+// [0] certificates, [1] crls, signerInfos } }, optionally inside the EF.SOD template 77
+boost::optional<SecurityObject> SecurityObject::parse(std::span<const octet> data) {
+    SecurityObject object;
+    std::span<const octet> value, info, signedData, encap, signers, signer;
+    if (next(data, 0x77, value)) {
+        data = value;
+    }
+    if (!next(data, 0x30, info) || !next(info, 0x06, value) || !equals(value, OID_SIGNED_DATA) ||
+        !next(info, 0xA0, value) || !next(value, 0x30, signedData)) {
+        return boost::none;
+    }
+    if (!next(signedData, 0x02, value) || !next(signedData, 0x31, value) || !next(signedData, 0x30, encap) ||
+        !next(encap, 0x06, value) || !next(encap, 0xA0, value) || !next(value, 0x04, object.content)) {
+        return boost::none;
+    }
+    next(signedData, 0xA0, value);
+    next(signedData, 0xA1, value);
+    if (!next(signedData, 0x31, signers) || !next(signers, 0x30, signer)) {
+        return boost::none;
+    }
+
+    // SignerInfo { version, sid, digestAlgorithm, [0] signedAttrs, signatureAlgorithm, signature }
+    u32 tag;
+    std::span<const octet> identifier, attrs;
+    if (!next(signer, 0x02, value)) {
+        return boost::none;
+    }
+    // sid is an IssuerAndSerialNumber or a [0] key identifier, the key is given by the caller
+    size_t sid = derTLV(signer, tag, value);
+    if (sid == 0) {
+        return boost::none;
+    }
+    signer = signer.subspan(sid);
+    if (!next(signer, 0x30, identifier)) {
+        return boost::none;
+    }
+    auto digest = hashAlgorithm(identifier);
+    if (digest == nullptr) {
+        return boost::none;
+    }
+    object.digestHash = digest->alg;
+    object.digestOid = digest->name;
+    if (next(signer, 0xA0, attrs, &object.signedAttrs)) {
+        std::span<const octet> attribute, type, values;
+        while (!attrs.empty()) {
+            if (!next(attrs, 0x30, attribute) || !next(attribute, 0x06, type) || !next(attribute, 0x31, values)) {
+                return boost::none;
+            }
+            if (equals(type, OID_MESSAGE_DIGEST) && !next(values, 0x04, object.messageDigest)) {
+                return boost::none;
+            }
+        }
+        if (object.messageDigest.empty()) {
+            return boost::none;
+        }
+    }
+    if (!next(signer, 0x30, value) || !next(signer, 0x04, object.signature)) {
+        return boost::none;
+    }
+
+    if (!parseContent(object.content, object)) {
+        return boost::none;
+    }
+    return object;
+}
+
+// With signed attributes the signature covers them as a SET and they carry the content digest
+bool SecurityObject::verify(const std::vector<octet>& signerPubkey, SignatureVerifier& verifier) const {
+    Hasher contentHasher(this->digestHash);
+    contentHasher.update(this->content.data(), this->content.size());
+    auto contentHash = contentHasher.finish();
+
+    VerifyRequest request;
+    request.pubkey = signerPubkey;
+    request.signature = std::vector<octet>(this->signature.begin(), this->signature.end());
+    request.hashOid = this->digestOid;
+    if (this->signedAttrs.empty()) {
+        request.hash = contentHash;
+    } else {
+        if (!equals(this->messageDigest, contentHash)) {
+            return false;
+        }
+        const octet set = 0x31;
+        Hasher attrsHasher(this->digestHash);
+        attrsHasher.update(&set, 1);
+        attrsHasher.update(this->signedAttrs.data() + 1, this->signedAttrs.size() - 1);
+        request.hash = attrsHasher.finish();
+    }
+    return verifier.verify(request);
+}
+
+PassiveAuthenticator::PassiveAuthenticator(SignatureVerifier& verifier, size_t threads)
+    : verifier(verifier), pool(threads) {
+    this->logger = Logger::getInstance();
+}
+
+// The signature check running on the pool reads the parsed object
+PassiveAuthenticator::~PassiveAuthenticator() {
+    if (this->signature.valid()) {
+        this->signature.wait();
+    }
+}
+
+bool PassiveAuthenticator::load(std::vector<octet> securityObject, const std::vector<octet>& signerPubkey) {
+    if (this->signature.valid()) {
+        this->signature.wait();
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->digests.clear();
+    }
+    this->raw = std::move(securityObject);
+    this->object = SecurityObject::parse(this->raw);
+    if (this->object == boost::none) {
+        logger->log(__FILE__, __LINE__, "Cannot parse security object", LogLevel::ERROR);
+        this->signature = std::shared_future<bool>();
+        return false;
+    }
+    this->signature = this->pool.submit([this, signerPubkey]() {
+        return this->object->verify(signerPubkey, this->verifier);
+    }).share();
+    return true;
+}
+
+bool PassiveAuthenticator::signatureValid() {
+    if (!this->signature.valid()) {
+        return false;
+    }
+    if (!this->signature.get()) {
+        logger->log(__FILE__, __LINE__, "Security object signature is invalid", LogLevel::ERROR);
+        return false;
+    }
+    return true;
+}
+
+PassiveAuthenticator::Digest* PassiveAuthenticator::digest(int group) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto& entry = this->digests[group];
+    if (entry == nullptr) {
+        entry = std::make_unique<Digest>();
+    }
+    return entry.get();
+}
+
+// A chunk that neither starts the file nor continues it leaves a gap, checkRead() then fails
+void PassiveAuthenticator::update(int group, size_t offset, std::span<const octet> chunk) {
+    if (this->object == boost::none || this->object->groupHashes.count(group) == 0) {
+        return;
+    }
+    Digest* digest = this->digest(group);
+    std::lock_guard<std::mutex> lock(digest->mutex);
+    if (offset == 0) {
+        digest->hasher.emplace(this->object->groupHash);
+        digest->hashed = 0;
+    }
+    if (digest->hasher == boost::none || offset != digest->hashed) {
+        digest->hasher = boost::none;
+        return;
+    }
+    digest->hasher->update(chunk.data(), chunk.size());
+    digest->hashed += chunk.size();
+}
+
+bool PassiveAuthenticator::checkRead(int group) {
+    if (this->object == boost::none) {
+        return false;
+    }
+    std::vector<octet> hash;
+    {
+        Digest* digest = this->digest(group);
+        std::lock_guard<std::mutex> lock(digest->mutex);
+        if (digest->hasher != boost::none) {
+            hash = digest->hasher->finish();
+        }
+        digest->hasher = boost::none;
+        digest->hashed = 0;
+    }
+    if (hash.empty()) {
+        logger->log(__FILE__, __LINE__, "DG" + std::to_string(group) + " was not read in full", LogLevel::ERROR);
+        return false;
+    }
+    return this->matches(group, hash) && this->signatureValid();
+}
+
+bool PassiveAuthenticator::check(int group, std::span<const octet> data) {
+    if (this->object == boost::none) {
+        return false;
+    }
+    return this->matches(group, this->hashGroup(data)) && this->signatureValid();
+}
+
+std::vector<bool> PassiveAuthenticator::checkBatch(const std::vector<std::pair<int, std::vector<octet>>>& groups) {
+    std::vector<bool> results(groups.size(), false);
+    if (this->object == boost::none) {
+        return results;
+    }
+    std::vector<std::future<bool>> futures;
+    futures.reserve(groups.size());
+    for (auto& group : groups) {
+        futures.push_back(
+            this->pool.submit([this, &group]() { return this->matches(group.first, this->hashGroup(group.second)); }));
+    }
+    bool signatureOk = this->signatureValid();
+    for (size_t i = 0; i < futures.size(); i++) {
+        results[i] = futures[i].get() && signatureOk;
+    }
+    return results;
+}
+
+std::vector<octet> PassiveAuthenticator::hashGroup(std::span<const octet> data) const {
+    Hasher hasher(this->object->groupHash);
+    hasher.update(data.data(), data.size());
+    return hasher.finish();
+}
+
+bool PassiveAuthenticator::matches(int group, const std::vector<octet>& hash) const {
+    auto it = this->object->groupHashes.find(group);
+    if (it == this->object->groupHashes.end()) {
+        logger->log(__FILE__, __LINE__, "DG" + std::to_string(group) + " is not in the security object",
+                    LogLevel::ERROR);
+        return false;
+    }
+    if (!equals(it->second, hash)) {
+        logger->log(__FILE__, __LINE__, "DG" + std::to_string(group) + " hash mismatch", LogLevel::ERROR);
+        return false;
+    }
+    return true;
+}
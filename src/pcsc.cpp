@@ -1,88 +1,521 @@
 #include "pcsc.h"
 
+#include <capabilityCache.h>
+
+#include <algorithm>
 #include <iomanip>
+#include <thread>
 
 #define CHECK(f, rv)             \
     if (SCARD_S_SUCCESS != rv) { \
         printf(f ": %ld\n", rv); \
-        return -1;               \
+        return rv;               \
     }
 
+// PC/SC part 10 definitions, reader.h is not shipped with the bundled headers
+#define SCARD_CTL_CODE(code) (0x42000000 + (code))
+#define CM_IOCTL_GET_FEATURE_REQUEST SCARD_CTL_CODE(3400)
+#define FEATURE_GET_TLV_PROPERTIES 0x12
+#define PCSCv2_PART10_PROPERTY_dwMaxAPDUDataSize 0x0A
+
+const size_t SHORT_MAX_COMMAND = 255;
+const size_t SHORT_MAX_RESPONSE = 256;
+const size_t EXTENDED_MAX_COMMAND = 65535;
+const size_t EXTENDED_MAX_RESPONSE = 65536;
+
 // auto logger = Logger::getInstance();
 
-PCSC::PCSC() {
+PCSC::PCSC() : PCSC(nullptr) {}
+
+PCSC::PCSC(std::shared_ptr<CardTransport> transport)
+    : transport(transport), traceSession(Tracer::nextSessionId()) {
     this->logger = Logger::getInstance();
-    this->logger->setLogOutput("CONSOLE");
-    this->logger->setLogLevel("INFO");
-    this->initPCSC();
 }
 
-int PCSC::initPCSC() {
-    logger->log(__FILE__, __LINE__, "PCSC initialization started", LogLevel::INFO);
-    LONG result;
+PCSC::PCSC(const PCSC& other)
+    : handle(other.handle),
+      dwReaderState(other.dwReaderState),
+      dwAtrLen(other.dwAtrLen),
+      atr(other.atr),
+      limits(other.limits),
+      profile(other.profile),
+      transport(other.transport),
+      connected(other.connected),
+      lastError(other.lastError),
+      traceReader(other.traceReader),
+      traceSession(other.traceSession),
+      logger(other.logger) {
+    std::copy(other.pbAtr, other.pbAtr + sizeof(other.pbAtr), this->pbAtr);
+}
+
+int PCSC::connect() {
+    std::lock_guard<std::mutex> lock(this->connectMutex);
+    if (this->isConnected()) {
+        return SCARD_S_SUCCESS;
+    }
+    if (this->transport != nullptr) {
+        this->limits = this->transport->getLimits();
+        this->profile.limits = this->limits;
+        this->atr = this->transport->getATR();
+        this->connected = true;
+        this->traceReader = Tracer::getInstance().readerId("transport");
+        return SCARD_S_SUCCESS;
+    }
+    int result = this->initPCSC();
+    this->connected = result == SCARD_S_SUCCESS;
+    this->lastError = this->classify(result);
+    return result;
+}
+
+// Keeps the context and handle, a warm reset drops every card-side state including SM keys
+int PCSC::reconnect(bool reset) {
+    std::lock_guard<std::mutex> lock(this->connectMutex);
+    if (this->transport != nullptr) {
+        return this->transport->reconnect(reset);
+    }
+    if (this->handle == nullptr) {
+        this->lastError = CardError::ReaderLost;
+        return SCARD_E_INVALID_HANDLE;
+    }
+    LONG result = this->handle->reconnect(reset);
+    this->lastError = this->classify(result);
+    CHECK("SCardReconnect", result)
+    logger->log(__FILE__, __LINE__, reset ? "Card reconnected with reset" : "Card reconnected", LogLevel::INFO);
+    return this->checkReaderStatus();
+}
 
-    result = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &this->hContext);
-    CHECK("SCardEstablishContext", result)
+// The resource manager or the reader went away, start over from a new context. Other copies
+// keep the old handle until they reestablish too.
+int PCSC::reestablish() {
+    {
+        std::lock_guard<std::mutex> lock(this->connectMutex);
+        PcscRegistry::getInstance()->forget(this->handle);
+        this->handle = nullptr;
+        this->connected = false;
+    }
+    return this->connect();
+}
 
-    result = SCardListReaders(this->hContext, NULL, NULL, &this->dwReaders);
-    CHECK("SCardListReaders", result)
+void PCSC::traceContext() const {
+    Tracer::setContext(this->traceReader, this->traceSession);
+}
 
-    this->mszReaders = static_cast<LPTSTR>(calloc(this->dwReaders, sizeof(char)));
-    result = SCardListReaders(hContext, NULL, mszReaders, &dwReaders);
-    CHECK("SCardListReaders", result)
-    logger->log(__FILE__, __LINE__, "Reader name: " + std::string(this->mszReaders), LogLevel::INFO);
+CardError PCSC::getLastError() const {
+    return this->lastError;
+}
 
-    result = SCardConnect(this->hContext,
-                          mszReaders,
-                          SCARD_SHARE_SHARED,
-                          SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
-                          &hCard,
-                          &dwActiveProtocol);
+CardError PCSC::classify(LONG result) {
+    switch (result) {
+        case SCARD_S_SUCCESS:
+            return CardError::None;
+        case SCARD_E_TIMEOUT:
+            return CardError::Timeout;
+        case SCARD_E_CANCELLED:
+            return CardError::Cancelled;
+        case SCARD_W_RESET_CARD:
+            return CardError::CardReset;
+        case SCARD_W_REMOVED_CARD:
+        case SCARD_E_NO_SMARTCARD:
+        case SCARD_W_UNPOWERED_CARD:
+        case SCARD_W_UNRESPONSIVE_CARD:
+            return CardError::CardRemoved;
+        case SCARD_E_NO_SERVICE:
+        case SCARD_E_SERVICE_STOPPED:
+        case SCARD_E_READER_UNAVAILABLE:
+        case SCARD_E_UNKNOWN_READER:
+        case SCARD_E_INVALID_HANDLE:
+        case SCARD_E_NO_READERS_AVAILABLE:
+            return CardError::ReaderLost;
+        default:
+            return CardError::Transport;
+    }
+}
+
+std::future<int> PCSC::connectAsync() {
+    return std::async(std::launch::async, [this]() { return this->connect(); });
+}
+
+// A handle abandoned through another copy is not used again
+bool PCSC::isConnected() const {
+    return this->connected && (this->transport != nullptr || (this->handle != nullptr && this->handle->isValid()));
+}
+
+int PCSC::initPCSC() {
+    this->traceContext();
+    CARDLIB_TRACE_SPAN("initPCSC");
+    logger->log(__FILE__, __LINE__, "PCSC initialization started", LogLevel::INFO);
+    LONG result = PcscRegistry::getInstance()->connect("", this->handle);
     CHECK("SCardConnect", result)
+    logger->log(__FILE__, __LINE__, "Reader name: " + this->handle->getReaderName(), LogLevel::INFO);
+    this->traceReader = Tracer::getInstance().readerId(this->handle->getReaderName());
+    this->traceContext();
 
-    switch (dwActiveProtocol) {
-        case SCARD_PROTOCOL_T0:
-            this->pioSendPci = *SCARD_PCI_T0;
-            break;
+    this->checkReaderStatus();
+    this->atr = ATR::parse(this->pbAtr, this->dwAtrLen);
 
-        case SCARD_PROTOCOL_T1:
-            this->pioSendPci = *SCARD_PCI_T1;
-            break;
+    boost::optional<CardProfile> cached;
+    if (this->atr != boost::none) {
+        cached = CapabilityCache::getInstance()->find(this->atr->toHex(), this->getReaderName());
+    }
+    if (cached != boost::none) {
+        this->profile = cached.get();
+        this->limits = this->profile.limits;
+        this->rxBuffer.resize(this->limits.maxResponse + 2);
+        logger->log(__FILE__, __LINE__, "Card capabilities loaded from cache", LogLevel::INFO);
+    } else {
+        this->discoverLimits();
+        this->profile.limits = this->limits;
+        this->saveProfile();
     }
     logger->log(__FILE__, __LINE__, "Successful pcsc initialization", LogLevel::INFO);
     return 0;
 }
 
 int PCSC::checkReaderStatus() {
-    DWORD dwAtrLen = sizeof(this->pbAtr);
-    LONG result = SCardStatus(this->hCard,
-                              this->mszReaders,
-                              &this->dwReaders,
+    this->dwAtrLen = sizeof(this->pbAtr);
+    DWORD readerLength = 0;
+    DWORD protocol = 0;
+    LONG result = SCardStatus(this->handle->get(),
+                              NULL,
+                              &readerLength,
                               &this->dwReaderState,
-                              &this->dwActiveProtocol,
+                              &protocol,
                               this->pbAtr,
-                              &dwAtrLen);
+                              &this->dwAtrLen);
     logger->log(__FILE__, __LINE__, "Successful pcsc intialization", LogLevel::INFO);
     CHECK("SCardStatus", result);
     return result;
 }
 
+boost::optional<DWORD> PCSC::readerMaxApduSize() {
+    BYTE buffer[256];
+    DWORD length = 0;
+    LONG result = SCardControl(
+        this->handle->get(), CM_IOCTL_GET_FEATURE_REQUEST, NULL, 0, buffer, sizeof(buffer), &length);
+    if (result != SCARD_S_SUCCESS) {
+        return boost::none;
+    }
+
+    DWORD propertiesIoctl = 0;
+    for (DWORD i = 0; i + 6 <= length; i += 6) {
+        if (buffer[i] == FEATURE_GET_TLV_PROPERTIES && buffer[i + 1] == 4) {
+            propertiesIoctl = (buffer[i + 2] << 24) | (buffer[i + 3] << 16) | (buffer[i + 4] << 8) | buffer[i + 5];
+        }
+    }
+    if (propertiesIoctl == 0) {
+        return boost::none;
+    }
+
+    result = SCardControl(this->handle->get(), propertiesIoctl, NULL, 0, buffer, sizeof(buffer), &length);
+    if (result != SCARD_S_SUCCESS) {
+        return boost::none;
+    }
+    for (DWORD i = 0; i + 2 <= length; i += 2 + buffer[i + 1]) {
+        DWORD len = buffer[i + 1];
+        if (buffer[i] == PCSCv2_PART10_PROPERTY_dwMaxAPDUDataSize && len == 4 && i + 2 + len <= length) {
+            return (DWORD)(buffer[i + 2] | (buffer[i + 3] << 8) | (buffer[i + 4] << 16) | (buffer[i + 5] << 24));
+        }
+    }
+    return boost::none;
+}
+
+// READ BINARY of the current EF with an extended Le of 255, which leaves the selection as it is
+// and fits the short receive buffer. Only statuses that come after the length was parsed count as
+// support: data, warnings or no such file. A card that rejects the form or fails in any other way
+// is taken as short only. Runs under connect(), so it goes to the reader directly.
+bool PCSC::probeExtendedApdu() {
+    std::vector<octet> probe = {0x00, 0xB0, 0x00, 0x00, 0x00, 0x00, 0xFF};
+    ++this->transmitCount;
+    auto response = this->transmitDirect(probe);
+    if (response.size() < 2) {
+        return false;
+    }
+    octet sw1 = response[response.size() - 2];
+    octet sw2 = response[response.size() - 1];
+    return sw1 == 0x90 || sw1 == 0x61 || sw1 == 0x62 || sw1 == 0x63 || (sw1 == 0x6A && sw2 == 0x82);
+}
+
+int PCSC::discoverLimits() {
+    this->limits = ApduLimits();
+    this->rxBuffer.resize(this->limits.maxResponse + 2);
+
+    bool atrExtended = this->atr != boost::none && this->atr->supportsExtendedLength();
+    this->limits.chaining = this->atr != boost::none && this->atr->supportsChaining();
+
+    // Extended APDUs over T=0 need ENVELOPE, short ones are enough there
+    if (this->handle->getProtocol() != SCARD_PROTOCOL_T1) {
+        logger->log(__FILE__, __LINE__, "Short APDU only: protocol is not T=1", LogLevel::INFO);
+        return 0;
+    }
+
+    auto readerMax = this->readerMaxApduSize();
+    if (readerMax != boost::none && readerMax.get() == 0) {
+        logger->log(__FILE__, __LINE__, "Short APDU only: reader does not support extended APDU", LogLevel::INFO);
+        return 0;
+    }
+
+    this->limits.extended = atrExtended || this->probeExtendedApdu();
+    if (this->limits.extended) {
+        this->limits.maxCommand = EXTENDED_MAX_COMMAND;
+        this->limits.maxResponse = EXTENDED_MAX_RESPONSE;
+        if (readerMax != boost::none) {
+            this->limits.maxCommand = std::min<size_t>(this->limits.maxCommand, readerMax.get());
+            this->limits.maxResponse = std::min<size_t>(this->limits.maxResponse, readerMax.get());
+        }
+        this->limits.maxCommand = std::max(this->limits.maxCommand, SHORT_MAX_COMMAND);
+        this->limits.maxResponse = std::max(this->limits.maxResponse, SHORT_MAX_RESPONSE);
+        this->rxBuffer.resize(this->limits.maxResponse + 2);
+    }
+    logger->log(__FILE__,
+                __LINE__,
+                "APDU limits: command " + std::to_string(this->limits.maxCommand) + ", response " +
+                    std::to_string(this->limits.maxResponse),
+                LogLevel::INFO);
+    return 0;
+}
+
+const ApduLimits& PCSC::getLimits() const {
+    return this->limits;
+}
+
+const CardProfile& PCSC::getProfile() const {
+    return this->profile;
+}
+
+const boost::optional<ATR>& PCSC::getATR() const {
+    return this->atr;
+}
+
+std::string PCSC::getReaderName() const {
+    return this->handle == nullptr ? std::string() : this->handle->getReaderName();
+}
+
+void PCSC::addApplet(const std::vector<octet>& aid) {
+    auto& applets = this->profile.applets;
+    if (std::find(applets.begin(), applets.end(), aid) == applets.end()) {
+        applets.push_back(aid);
+        this->saveProfile();
+    }
+}
+
+void PCSC::setSecureMessaging(bool supported) {
+    if (this->profile.secureMessaging != supported) {
+        this->profile.secureMessaging = supported;
+        this->saveProfile();
+    }
+}
+
+uint64_t PCSC::getTransmitCount() const {
+    return this->transmitCount.load();
+}
+
+void PCSC::saveProfile() {
+    if (this->atr == boost::none) {
+        return;
+    }
+    CapabilityCache::getInstance()->store(this->atr->toHex(), this->getReaderName(), this->profile);
+}
+
+int PCSC::openChannel() {
+    auto resp = this->decodeResponse(
+        this->sendCommandToCard(APDUEncode(APDU(Cla::Default, Instruction::ManageChannel, 0x00, 0x00, {}, 1))));
+    if (resp->sw1 != 0x90 || resp->rdf_len != 1 || resp->rdf[0] == 0) {
+        logger->log(__FILE__, __LINE__, "Cannot open a logical channel", LogLevel::ERROR);
+        return -1;
+    }
+    // Channels past MAX_CHANNEL need the further CLA coding, so the one granted is closed from the
+    // basic channel rather than left open on the card
+    octet granted = resp->rdf[0];
+    if (granted > APDU::MAX_CHANNEL) {
+        logger->log(__FILE__, __LINE__, "Card opened unsupported logical channel " + std::to_string(granted),
+                    LogLevel::ERROR);
+        auto closed = this->decodeResponse(
+            this->sendCommandToCard(APDUEncode(APDU(Cla::Default, Instruction::ManageChannel, 0x80, granted))));
+        if (closed->sw1 != 0x90) {
+            logger->log(__FILE__, __LINE__, "Cannot close logical channel " + std::to_string(granted),
+                        LogLevel::ERROR);
+        }
+        return -1;
+    }
+    return granted;
+}
+
+// The basic channel cannot be closed
+bool PCSC::closeChannel(octet channel) {
+    if (channel == 0 || channel > APDU::MAX_CHANNEL) {
+        return false;
+    }
+    APDU command(Cla::Default, Instruction::ManageChannel, 0x80, channel);
+    command.channel = channel;
+    auto resp = this->decodeResponse(this->sendCommandToCard(APDUEncode(command)));
+    if (resp->sw1 != 0x90) {
+        logger->log(__FILE__, __LINE__, "Cannot close logical channel " + std::to_string(channel), LogLevel::ERROR);
+        return false;
+    }
+    return true;
+}
+
 std::vector<octet> PCSC::sendCommandToCard(std::vector<octet> cmd) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::Transmit);
+    if (this->deadline.expired()) {
+        this->lastError = this->deadline.error();
+        return std::vector<octet>();
+    }
+    if (!this->isConnected() && this->connect() != SCARD_S_SUCCESS) {
+        return std::vector<octet>();
+    }
+    ++this->transmitCount;
+    this->traceContext();
+    CARDLIB_TRACE_SPAN("SCardTransmit");
+    if (this->deadline.isSet()) {
+        return this->transmitGuarded(std::move(cmd));
+    }
+    return this->transmitDirect(std::move(cmd));
+}
+
+std::vector<octet> PCSC::sendCommandToCard(std::vector<octet> cmd, const Deadline& deadline) {
+    DeadlineScope scope(*this, deadline);
+    return this->sendCommandToCard(std::move(cmd));
+}
+
+void PCSC::setDeadline(const Deadline& deadline) {
+    this->deadline = deadline;
+}
+
+const Deadline& PCSC::getDeadline() const {
+    return this->deadline;
+}
+
+// The exchange runs on the worker of this connection holding a copy of it. If the deadline passes
+// first the worker is retired: the caller goes on at once and the next exchange connects afresh
+// on a new worker. PC/SC cannot interrupt SCardTransmit, so the retired worker stays blocked until
+// the card answers; MAX_RETIRED caps how many may be stuck at once. The card is reset and the
+// handle released by the caller if the exchange is already over, otherwise by the retired worker
+// as soon as it returns.
+std::vector<octet> PCSC::transmitGuarded(std::vector<octet> cmd) {
+    enum { Running, Done, Abandoned };
+    struct Exchange {
+        std::atomic<int> state{Running};
+        std::vector<octet> response;
+        CardError error = CardError::None;
+    };
+    if (this->worker == nullptr) {
+        if (TransmitWorker::retired() >= TransmitWorker::MAX_RETIRED) {
+            logger->log(__FILE__, __LINE__, "Too many abandoned exchanges still on the reader", LogLevel::ERROR);
+            this->lastError = CardError::ReaderLost;
+            return std::vector<octet>();
+        }
+        this->worker = std::make_unique<TransmitWorker>();
+    }
+    auto exchange = std::make_shared<Exchange>();
+    Deadline deadline = this->deadline;
+    this->worker->post([exchange, deadline, link = PCSC(*this), cmd = std::move(cmd)]() mutable {
+        exchange->response = link.transmitDirect(std::move(cmd));
+        exchange->error = link.lastError;
+        int running = Running;
+        if (!exchange->state.compare_exchange_strong(running, Done)) {
+            return;
+        }
+        deadline.notify();
+    });
+
+    deadline.wait([&]() { return exchange->state.load() != Running; });
+    int running = Running;
+    if (exchange->state.compare_exchange_strong(running, Abandoned)) {
+        auto handle = this->handle;
+        this->abandonConnection();
+        std::function<void()> teardown;
+        if (handle != nullptr) {
+            teardown = [handle]() { handle->release(); };
+        }
+        if (!this->worker->retire(teardown) && teardown != nullptr) {
+            teardown();
+        }
+        this->worker = nullptr;
+        this->lastError = deadline.cancelled() ? CardError::Cancelled : CardError::DeadlineExceeded;
+        logger->log(__FILE__,
+                    __LINE__,
+                    deadline.cancelled() ? "Command cancelled" : "Command deadline exceeded",
+                    LogLevel::WARN);
+        return std::vector<octet>();
+    }
+    this->lastError = exchange->error;
+    return std::move(exchange->response);
+}
+
+// The card may still be working on the command, so the handle is not used again and the card is
+// reset when it is released.
+void PCSC::abandonConnection() {
+    std::lock_guard<std::mutex> lock(this->connectMutex);
+    if (this->handle != nullptr) {
+        this->handle->abandon();
+        PcscRegistry::getInstance()->forget(this->handle);
+        this->handle = nullptr;
+    }
+    this->connected = false;
+}
+
+// Runs on the thread doing the exchange, the caller's or a transmit worker
+std::vector<octet> PCSC::transmitDirect(std::vector<octet> cmd) {
+    CARDLIB_ALLOC_SCOPE(AllocSite::Transmit);
     LONG result;
-    octet response[255];
-    size_t responseLength = sizeof(response);
+    if (this->transport != nullptr) {
+        auto response = this->transport->transmit(cmd);
+        this->lastError = response.empty() ? CardError::Transport : CardError::None;
+        return response;
+    }
+    if (this->rxBuffer.empty()) {
+        this->rxBuffer.resize(this->limits.maxResponse + 2);
+    }
+    DWORD responseLength = this->rxBuffer.size();
     result = SCardTransmit(
-        this->hCard, &this->pioSendPci, cmd.data(), cmd.size(), NULL, response, &responseLength);
+        this->handle->get(), this->handle->getSendPci(), cmd.data(), cmd.size(), NULL, this->rxBuffer.data(), &responseLength);
+    this->lastError = this->classify(result);
     if (result != SCARD_S_SUCCESS) {
         logger->log(__FILE__, __LINE__, "Command sending error: " + std::to_string(result), LogLevel::ERROR);
         return std::vector<octet>();
     }
-    return std::vector<octet>(response, response + responseLength);
+    return std::vector<octet>(this->rxBuffer.begin(), this->rxBuffer.begin() + responseLength);
+}
+
+std::vector<octet> PCSC::sendCommandChained(const APDU& command) {
+    if (command.cdf.size() > this->limits.maxCommand && !this->limits.chaining) {
+        logger->log(__FILE__, __LINE__, "Command data is too long and the card does not support chaining",
+                    LogLevel::ERROR);
+        return std::vector<octet>();
+    }
+    std::vector<octet> response;
+    for (auto& part : APDUChain(command, this->limits.maxCommand)) {
+        response = this->sendCommandToCard(APDUEncode(part));
+        if (response.size() < 2) {
+            return std::vector<octet>();
+        }
+        if (response[response.size() - 2] != 0x90) {
+            return response;
+        }
+    }
+    return response;
 }
 
+// A malformed response decodes to an empty one with zero status words
 std::shared_ptr<apdu_resp_t> PCSC::decodeResponse(std::vector<octet> response) {
-    apdu_resp_t* resp = new apdu_resp_t[2048];
-    apduRespDec(resp, response.data(), response.size());
-    std::shared_ptr<apdu_resp_t> apduResp(resp);
-    return apduResp;
-}
\ No newline at end of file
+    size_t size = apduRespDec(0, response.data(), response.size());
+    bool valid = size != SIZE_MAX;
+    if (!valid) {
+        size = sizeof(apdu_resp_t);
+    }
+    apdu_resp_t* resp = static_cast<apdu_resp_t*>(::operator new(size));
+    memSetZero(resp, size);
+    if (valid) {
+        apduRespDec(resp, response.data(), response.size());
+    }
+    return std::shared_ptr<apdu_resp_t>(resp, [](apdu_resp_t* p) { ::operator delete(p); });
+}
+
+DeadlineScope::DeadlineScope(PCSC& pcsc, const Deadline& deadline) : pcsc(pcsc), previous(pcsc.getDeadline()) {
+    pcsc.setDeadline(deadline);
+}
+
+DeadlineScope::~DeadlineScope() {
+    this->pcsc.setDeadline(this->previous);
+}
@@ -0,0 +1,204 @@
+#include <pcscRegistry.h>
+
+std::shared_ptr<PcscRegistry> PcscRegistry::registryInstance;
+std::mutex registryInstanceMutex;
+
+static const SCARD_IO_REQUEST* sendPci(DWORD protocol) {
+    return protocol == SCARD_PROTOCOL_T1 ? SCARD_PCI_T1 : SCARD_PCI_T0;
+}
+
+// The resource manager was restarted, the context has to be established again
+static bool contextLost(LONG result) {
+    return result == SCARD_E_NO_SERVICE || result == SCARD_E_SERVICE_STOPPED || result == SCARD_E_INVALID_HANDLE;
+}
+
+CardHandle::CardHandle(SCARDCONTEXT context, SCARDHANDLE card, std::string readerName, DWORD protocol)
+    : context(context), card(card), readerName(std::move(readerName)), protocol(protocol) {}
+
+CardHandle::~CardHandle() {
+    this->release();
+}
+
+void CardHandle::release() {
+    if (!this->released.exchange(true)) {
+        SCardDisconnect(this->card, this->disposition.load());
+        SCardReleaseContext(this->context);
+    }
+}
+
+SCARDHANDLE CardHandle::get() const {
+    return this->card;
+}
+
+SCARDCONTEXT CardHandle::getContext() const {
+    return this->context;
+}
+
+const std::string& CardHandle::getReaderName() const {
+    return this->readerName;
+}
+
+DWORD CardHandle::getProtocol() const {
+    return this->protocol.load();
+}
+
+const SCARD_IO_REQUEST* CardHandle::getSendPci() const {
+    return sendPci(this->protocol.load());
+}
+
+LONG CardHandle::reconnect(bool reset) {
+    DWORD active = 0;
+    LONG result = SCardReconnect(this->card,
+                                 SCARD_SHARE_SHARED,
+                                 SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                                 reset ? SCARD_RESET_CARD : SCARD_LEAVE_CARD,
+                                 &active);
+    if (result == SCARD_S_SUCCESS) {
+        this->protocol = active;
+    }
+    return result;
+}
+
+void CardHandle::abandon() {
+    if (this->valid.exchange(false)) {
+        this->disposition = SCARD_RESET_CARD;
+    }
+}
+
+bool CardHandle::isValid() const {
+    return this->valid.load();
+}
+
+PcscRegistry::PcscRegistry() {
+    this->logger = Logger::getInstance();
+}
+
+PcscRegistry::~PcscRegistry() {
+    if (this->established) {
+        SCardReleaseContext(this->context);
+    }
+}
+
+std::shared_ptr<PcscRegistry> PcscRegistry::getInstance() {
+    std::lock_guard<std::mutex> lock(registryInstanceMutex);
+    if (registryInstance == nullptr) {
+        registryInstance = std::shared_ptr<PcscRegistry>(new PcscRegistry());
+    }
+    return registryInstance;
+}
+
+LONG PcscRegistry::establish() {
+    if (this->established) {
+        return SCARD_S_SUCCESS;
+    }
+    LONG result = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &this->context);
+    this->established = result == SCARD_S_SUCCESS;
+    return result;
+}
+
+LONG PcscRegistry::listReaders(std::vector<std::string>& readers) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->listReadersLocked(readers);
+}
+
+LONG PcscRegistry::listReadersLocked(std::vector<std::string>& readers) {
+    readers.clear();
+    LONG result = SCARD_S_SUCCESS;
+    std::vector<char> names;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        result = this->establish();
+        if (result != SCARD_S_SUCCESS) {
+            return result;
+        }
+        DWORD length = 0;
+        result = SCardListReaders(this->context, NULL, NULL, &length);
+        if (result == SCARD_S_SUCCESS) {
+            names.resize(length);
+            result = SCardListReaders(this->context, NULL, names.data(), &length);
+        }
+        if (!contextLost(result)) {
+            break;
+        }
+        SCardReleaseContext(this->context);
+        this->established = false;
+    }
+    if (result != SCARD_S_SUCCESS) {
+        return result;
+    }
+    // Reader names come as a multi-string ending with an empty name
+    for (size_t i = 0; i < names.size() && names[i] != '\0';) {
+        readers.emplace_back(&names[i]);
+        i += readers.back().size() + 1;
+    }
+    return readers.empty() ? SCARD_E_NO_READERS_AVAILABLE : SCARD_S_SUCCESS;
+}
+
+// Connecting can take a while for a card that is powering up, so the lock is not held for it; if
+// another thread got there first its handle wins and ours is closed.
+LONG PcscRegistry::connect(const std::string& reader, std::shared_ptr<CardHandle>& handle) {
+    std::string name = reader;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (name.empty()) {
+            std::vector<std::string> readers;
+            LONG result = this->listReadersLocked(readers);
+            if (result != SCARD_S_SUCCESS) {
+                return result;
+            }
+            name = readers.front();
+        }
+        auto it = this->handles.find(name);
+        if (it != this->handles.end()) {
+            handle = it->second.lock();
+            if (handle != nullptr && handle->isValid()) {
+                return SCARD_S_SUCCESS;
+            }
+            this->handles.erase(it);
+        }
+    }
+
+    SCARDCONTEXT context;
+    LONG result = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &context);
+    if (result != SCARD_S_SUCCESS) {
+        return result;
+    }
+    SCARDHANDLE card;
+    DWORD protocol = 0;
+    result = SCardConnect(
+        context, name.c_str(), SCARD_SHARE_SHARED, SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, &card, &protocol);
+    if (result != SCARD_S_SUCCESS) {
+        SCardReleaseContext(context);
+        return result;
+    }
+    auto connected = std::shared_ptr<CardHandle>(new CardHandle(context, card, name, protocol));
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto& entry = this->handles[name];
+    handle = entry.lock();
+    if (handle == nullptr || !handle->isValid()) {
+        entry = connected;
+        handle = connected;
+        logger->log(__FILE__, __LINE__, "Connected to reader " + name, LogLevel::INFO);
+    }
+    return SCARD_S_SUCCESS;
+}
+
+void PcscRegistry::forget(const std::shared_ptr<CardHandle>& handle) {
+    if (handle == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->handles.find(handle->getReaderName());
+    if (it != this->handles.end() && it->second.lock() == handle) {
+        this->handles.erase(it);
+    }
+}
+
+size_t PcscRegistry::openHandles() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    size_t count = 0;
+    for (auto& entry : this->handles) {
+        count += entry.second.expired() ? 0 : 1;
+    }
+    return count;
+}
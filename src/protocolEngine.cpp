@@ -0,0 +1,170 @@
+#include <protocolEngine.h>
+
+#include <algorithm>
+#include <new>
+
+namespace {
+
+struct FreeLists {
+    void* heads[FramePool::CLASSES]{};
+    size_t counts[FramePool::CLASSES]{};
+
+    ~FreeLists() {
+        for (auto head : this->heads) {
+            while (head != nullptr) {
+                void* next = *static_cast<void**>(head);
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+};
+
+thread_local FreeLists freeLists;
+
+}  // namespace
+
+void* FramePool::allocate(size_t size) {
+    size_t index = (size + GRANULE - 1) / GRANULE - 1;
+    if (index >= CLASSES) {
+        return ::operator new(size);
+    }
+    void* frame = freeLists.heads[index];
+    if (frame == nullptr) {
+        return ::operator new((index + 1) * GRANULE);
+    }
+    freeLists.heads[index] = *static_cast<void**>(frame);
+    freeLists.counts[index]--;
+    return frame;
+}
+
+// A frame freed on another thread joins that thread's list, the blocks are interchangeable
+void FramePool::deallocate(void* frame, size_t size) noexcept {
+    size_t index = (size + GRANULE - 1) / GRANULE - 1;
+    if (index >= CLASSES || freeLists.counts[index] >= MAX_CACHED) {
+        ::operator delete(frame);
+        return;
+    }
+    *static_cast<void**>(frame) = freeLists.heads[index];
+    freeLists.heads[index] = frame;
+    freeLists.counts[index]++;
+}
+
+EventLoop::EventLoop(size_t ioThreads) {
+    if (ioThreads == 0) {
+        ioThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < ioThreads; ++i) {
+        this->ioThreads.emplace_back(&EventLoop::ioWorker, this);
+    }
+}
+
+EventLoop::~EventLoop() {
+    this->stop();
+    for (auto& thread : this->ioThreads) {
+        thread.join();
+    }
+}
+
+EventLoop::Exchange EventLoop::transmit(PCSC& pcsc, std::vector<octet> command) {
+    return Exchange(*this, pcsc, std::move(command));
+}
+
+EventLoop::Connect EventLoop::connect(PCSC& pcsc) {
+    return Connect(*this, pcsc);
+}
+
+void EventLoop::run() {
+    while (true) {
+        Operation* batch;
+        {
+            std::unique_lock<std::mutex> lock(this->readyMutex);
+            this->readyCondition.wait(lock, [this]() {
+                return this->readyHead != nullptr || this->active == 0 || this->stopping;
+            });
+            if (this->readyHead == nullptr || this->stopping) {
+                return;
+            }
+            batch = this->readyHead;
+            this->readyHead = this->readyTail = nullptr;
+        }
+        // The operation lives in the frame being resumed, read the link first
+        while (batch != nullptr) {
+            Operation* next = batch->next;
+            batch->handle.resume();
+            batch = next;
+        }
+    }
+}
+
+void EventLoop::stop() {
+    this->stopping = true;
+    // Waiters check the flag under their own mutex, taking each one orders the store before the wakeup
+    {
+        std::lock_guard<std::mutex> lock(this->readyMutex);
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->ioMutex);
+    }
+    this->readyCondition.notify_all();
+    this->ioCondition.notify_all();
+}
+
+size_t EventLoop::pending() const {
+    return this->active;
+}
+
+void EventLoop::post(Operation* operation) {
+    operation->next = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(this->readyMutex);
+        if (this->readyTail != nullptr) {
+            this->readyTail->next = operation;
+        } else {
+            this->readyHead = operation;
+        }
+        this->readyTail = operation;
+    }
+    this->readyCondition.notify_one();
+}
+
+void EventLoop::submit(Operation* operation) {
+    operation->next = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(this->ioMutex);
+        if (this->ioTail != nullptr) {
+            this->ioTail->next = operation;
+        } else {
+            this->ioHead = operation;
+        }
+        this->ioTail = operation;
+    }
+    this->ioCondition.notify_one();
+}
+
+void EventLoop::finish() {
+    if (--this->active == 0) {
+        std::lock_guard<std::mutex> lock(this->readyMutex);
+        this->readyCondition.notify_all();
+    }
+}
+
+void EventLoop::ioWorker() {
+    while (true) {
+        Operation* operation;
+        {
+            std::unique_lock<std::mutex> lock(this->ioMutex);
+            this->ioCondition.wait(lock, [this]() { return this->ioHead != nullptr || this->stopping; });
+            if (this->ioHead == nullptr) {
+                return;
+            }
+            operation = this->ioHead;
+            this->ioHead = operation->next;
+            if (this->ioHead == nullptr) {
+                this->ioTail = nullptr;
+            }
+        }
+        operation->execute();
+        this->post(operation);
+    }
+}
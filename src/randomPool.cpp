@@ -0,0 +1,182 @@
+#include <randomPool.h>
+
+#include <bee2/core/mem.h>
+#include <bee2/crypto/brng.h>
+
+#include <pthread.h>
+#include <sys/random.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <thread>
+
+// Bumped in the child of every fork(), whose generators and reservoir are copies of the parent's
+static std::atomic<unsigned> forkGeneration{0};
+
+RandomPool::RandomPool() {
+    this->logger = Logger::getInstance();
+    pthread_atfork(&RandomPool::beforeFork, &RandomPool::afterForkParent, &RandomPool::afterForkChild);
+    this->reservoir = SecureArena::getInstance().acquire(RESERVOIR * SEED);
+    if (!this->reservoir) {
+        logger->log(__FILE__, __LINE__, "Cannot allocate entropy reservoir", LogLevel::ERROR);
+        return;
+    }
+    std::thread(&RandomPool::refill, this).detach();
+}
+
+// The mutex is held across fork() so the child does not inherit it locked by another thread
+void RandomPool::beforeFork() {
+    getInstance().mutex.lock();
+}
+
+void RandomPool::afterForkParent() {
+    getInstance().mutex.unlock();
+}
+
+void RandomPool::afterForkChild() {
+    forkGeneration.fetch_add(1, std::memory_order_relaxed);
+    getInstance().mutex.unlock();
+}
+
+RandomPool& RandomPool::getInstance() {
+    // Never destroyed: the refill thread and thread-local generators may outlive static destruction
+    static RandomPool* pool = new RandomPool();
+    return *pool;
+}
+
+void RandomPool::stepR(void* buf, size_t count, void*) {
+    RandomPool::getInstance().generate(buf, count);
+}
+
+// Slot layout: brngCTR state | output buffer, unread output sits at the end of the buffer
+RandomPool::Generator& RandomPool::local() {
+    static thread_local Generator generator;
+    if (!generator.slot) {
+        generator.slot = SecureArena::getInstance().acquire(brngCTR_keep() + BUFFER);
+        if (!generator.slot) {
+            logger->log(__FILE__, __LINE__, "Cannot allocate random generator", LogLevel::ERROR);
+            std::abort();
+        }
+        generator.generation = forkGeneration.load(std::memory_order_relaxed);
+        this->rekey(generator);
+    }
+    // Output of a generator copied by fork() would repeat in the parent and the child
+    unsigned generation = forkGeneration.load(std::memory_order_relaxed);
+    if (generator.generation != generation) {
+        generator.generation = generation;
+        this->rekey(generator);
+    }
+    return generator;
+}
+
+// Output drawn from the old key is mixed into the new one, so a bad seed cannot lower the entropy
+void RandomPool::rekey(Generator& generator) {
+    octet seed[SEED], mix[SEED];
+    this->takeSeed(seed);
+    if (generator.produced != 0) {
+        brngCTRStepR(mix, SEED, generator.slot.data());
+        for (size_t i = 0; i < SEED; ++i) {
+            seed[i] ^= mix[i];
+        }
+    }
+    brngCTRStart(generator.slot.data(), seed, seed + 32);
+    memWipe(seed, sizeof(seed));
+    memWipe(mix, sizeof(mix));
+    memWipe(generator.slot.data() + brngCTR_keep(), BUFFER);
+    generator.available = 0;
+    generator.produced = 0;
+}
+
+void RandomPool::generate(void* buf, size_t count) {
+    Generator& generator = this->local();
+    octet* out = static_cast<octet*>(buf);
+    octet* buffer = generator.slot.data() + brngCTR_keep();
+
+    while (count != 0) {
+        if (generator.produced >= RESEED_BYTES) {
+            this->rekey(generator);
+        }
+        // Large requests bypass the buffer
+        if (generator.available == 0 && count >= BUFFER) {
+            size_t chunk = std::min(count, RESEED_BYTES - generator.produced);
+            brngCTRStepR(out, chunk, generator.slot.data());
+            generator.produced += chunk;
+            out += chunk;
+            count -= chunk;
+            continue;
+        }
+        if (generator.available == 0) {
+            brngCTRStepR(buffer, BUFFER, generator.slot.data());
+            generator.available = BUFFER;
+            generator.produced += BUFFER;
+        }
+        // Served bytes are wiped so they cannot be read back from the buffer
+        size_t chunk = std::min(count, generator.available);
+        octet* from = buffer + BUFFER - generator.available;
+        std::copy(from, from + chunk, out);
+        memWipe(from, chunk);
+        generator.available -= chunk;
+        out += chunk;
+        count -= chunk;
+    }
+}
+
+// Falls back to the OS directly while the reservoir is empty
+void RandomPool::takeSeed(octet* seed) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        // The child of a fork() drops the seeds it shares with the parent and starts its own refill
+        unsigned generation = forkGeneration.load(std::memory_order_relaxed);
+        if (this->generation != generation) {
+            this->generation = generation;
+            if (this->reservoir) {
+                memWipe(this->reservoir.data(), this->seeds * SEED);
+                this->seeds = 0;
+                std::thread(&RandomPool::refill, this).detach();
+            }
+        }
+        if (this->seeds != 0) {
+            octet* from = this->reservoir.data() + --this->seeds * SEED;
+            std::copy(from, from + SEED, seed);
+            memWipe(from, SEED);
+            if (this->seeds < RESERVOIR / 2) {
+                this->drained.notify_one();
+            }
+            return;
+        }
+    }
+    this->osEntropy(seed, SEED);
+}
+
+void RandomPool::refill() {
+    octet seed[SEED];
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->drained.wait(lock, [this]() { return this->seeds < RESERVOIR; });
+        lock.unlock();
+        this->osEntropy(seed, SEED);
+        lock.lock();
+        if (this->seeds < RESERVOIR) {
+            std::copy(seed, seed + SEED, this->reservoir.data() + this->seeds++ * SEED);
+        }
+        memWipe(seed, sizeof(seed));
+    }
+}
+
+// Keys cannot be generated without entropy, so running out of it is fatal
+void RandomPool::osEntropy(octet* buf, size_t count) {
+    while (count != 0) {
+        ssize_t read = getrandom(buf, count, 0);
+        if (read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger->log(__FILE__, __LINE__, "Cannot read OS entropy", LogLevel::ERROR);
+            std::abort();
+        }
+        buf += read;
+        count -= read;
+    }
+}
@@ -0,0 +1,60 @@
+#include <readCheckpoint.h>
+
+#include <bee2/core/mem.h>
+
+#include <algorithm>
+
+ReadCheckpoint::ReadCheckpoint() {
+    this->logger = Logger::getInstance();
+}
+
+ReadCheckpoint::~ReadCheckpoint() {
+    this->clear();
+}
+
+void ReadCheckpoint::save(const std::string& card, const std::vector<octet>& efId, std::vector<octet> data) {
+    this->clear();
+    if (data.empty()) {
+        return;
+    }
+    this->card = card;
+    this->efId = efId;
+    this->data = std::move(data);
+    logger->log(__FILE__,
+                __LINE__,
+                "EF read interrupted, " + std::to_string(this->data.size()) + " bytes kept",
+                LogLevel::INFO);
+}
+
+void ReadCheckpoint::clear() {
+    if (!this->data.empty()) {
+        memWipe(this->data.data(), this->data.size());
+    }
+    this->data.clear();
+    this->efId.clear();
+    this->card.clear();
+}
+
+boost::optional<std::pair<size_t, size_t>> ReadCheckpoint::overlap(const std::string& card,
+                                                                   const std::vector<octet>& efId) {
+    if (this->data.empty() || card != this->card || efId != this->efId) {
+        return boost::none;
+    }
+    size_t length = std::min(OVERLAP, this->data.size());
+    return std::make_pair(this->data.size() - length, length);
+}
+
+std::vector<octet> ReadCheckpoint::resume(const std::vector<octet>& reread) {
+    size_t length = std::min(OVERLAP, this->data.size());
+    std::vector<octet> prefix;
+    if (!this->data.empty() && reread.size() == length &&
+        std::equal(reread.begin(), reread.end(), this->data.end() - length)) {
+        prefix = std::move(this->data);
+        logger->log(__FILE__, __LINE__, "EF read resumed at offset " + std::to_string(prefix.size()), LogLevel::INFO);
+    } else {
+        logger->log(__FILE__, __LINE__, "EF changed since the read was interrupted, reading from the start",
+                    LogLevel::WARN);
+    }
+    this->clear();
+    return prefix;
+}
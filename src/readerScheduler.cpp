@@ -0,0 +1,179 @@
+#include <readerScheduler.h>
+
+#include <algorithm>
+#include <tuple>
+
+ScheduledTransport::ScheduledTransport(std::shared_ptr<ReaderScheduler> scheduler, uint32_t flow)
+    : scheduler(std::move(scheduler)), flow(flow) {}
+
+ScheduledTransport::~ScheduledTransport() {
+    this->scheduler->close(this->flow);
+}
+
+std::vector<octet> ScheduledTransport::transmit(const std::vector<octet>& cmd) {
+    ReaderBatch batch(*this);
+    return this->scheduler->getReader().sendCommandToCard(cmd);
+}
+
+ApduLimits ScheduledTransport::getLimits() {
+    ReaderBatch batch(*this);
+    PCSC& reader = this->scheduler->getReader();
+    if (!reader.isConnected()) {
+        reader.connect();
+    }
+    return reader.getLimits();
+}
+
+boost::optional<ATR> ScheduledTransport::getATR() {
+    ReaderBatch batch(*this);
+    PCSC& reader = this->scheduler->getReader();
+    if (!reader.isConnected()) {
+        reader.connect();
+    }
+    return reader.getATR();
+}
+
+int ScheduledTransport::reconnect(bool reset) {
+    ReaderBatch batch(*this);
+    return this->scheduler->getReader().reconnect(reset);
+}
+
+void ScheduledTransport::hold() {
+    this->scheduler->acquire(this->flow);
+}
+
+void ScheduledTransport::release() {
+    this->scheduler->release(this->flow);
+}
+
+ReaderBatch::ReaderBatch(ScheduledTransport& transport) : transport(transport) {
+    this->transport.hold();
+}
+
+ReaderBatch::~ReaderBatch() {
+    this->transport.release();
+}
+
+ReaderScheduler::ReaderScheduler(std::shared_ptr<PCSC> reader) : reader(std::move(reader)) {
+    this->logger = Logger::getInstance();
+}
+
+std::shared_ptr<ReaderScheduler> ReaderScheduler::create(std::shared_ptr<PCSC> reader) {
+    return std::shared_ptr<ReaderScheduler>(new ReaderScheduler(std::move(reader)));
+}
+
+std::shared_ptr<ScheduledTransport> ReaderScheduler::session(Priority priority, uint32_t weight) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    uint32_t flow = this->nextFlow++;
+    this->flows[flow] = Flow{priority, static_cast<double>(std::max<uint32_t>(weight, 1))};
+    return std::shared_ptr<ScheduledTransport>(new ScheduledTransport(this->shared_from_this(), flow));
+}
+
+void ReaderScheduler::setPriority(const ScheduledTransport& transport, Priority priority) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->flows.at(transport.flow).priority = priority;
+    }
+    this->turn.notify_all();
+}
+
+PCSC& ReaderScheduler::getReader() {
+    return *this->reader;
+}
+
+// The waiting session with the highest priority and the smallest virtual start time goes next
+bool ReaderScheduler::eligible(uint32_t flow) const {
+    auto best = this->flows.end();
+    for (auto it = this->flows.begin(); it != this->flows.end(); ++it) {
+        if (it->second.waiting == 0) {
+            continue;
+        }
+        if (best == this->flows.end() ||
+            std::tie(it->second.priority, it->second.tag) < std::tie(best->second.priority, best->second.tag)) {
+            best = it;
+        }
+    }
+    return best != this->flows.end() && best->first == flow;
+}
+
+// A released session goes before every waiting one, so the reader is kept for its next exchange
+bool ReaderScheduler::ahead(uint32_t flow) const {
+    const Flow& current = this->flows.at(flow);
+    bool waiters = false;
+    for (auto& [id, other] : this->flows) {
+        if (other.waiting == 0) {
+            continue;
+        }
+        if (std::tie(other.priority, other.tag) <= std::tie(current.priority, current.tag)) {
+            return false;
+        }
+        waiters = true;
+    }
+    return waiters;
+}
+
+// The reader is kept for another session between its exchanges, unless this one has a higher priority
+bool ReaderScheduler::blocked(uint32_t flow) const {
+    if (this->reserved == 0 || this->reserved == flow || std::chrono::steady_clock::now() >= this->reservedUntil) {
+        return false;
+    }
+    auto it = this->flows.find(this->reserved);
+    return it != this->flows.end() && it->second.priority <= this->flows.at(flow).priority;
+}
+
+// A session that was idle starts at the current virtual time and cannot spend credit it saved up
+void ReaderScheduler::acquire(uint32_t flow) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    Flow& current = this->flows.at(flow);
+    if (this->owner == flow) {
+        current.holds++;
+        return;
+    }
+    if (current.waiting++ == 0) {
+        current.tag = std::max(current.tag, this->virtualTime);
+    }
+    while (this->owner != flow && (this->owner != 0 || !this->eligible(flow) || this->blocked(flow))) {
+        if (this->reserved != 0) {
+            this->turn.wait_until(lock, this->reservedUntil);
+        } else {
+            this->turn.wait(lock);
+        }
+    }
+    current.waiting--;
+    if (this->owner == 0) {
+        this->owner = flow;
+        this->grantedAt = std::chrono::steady_clock::now();
+        this->virtualTime = current.tag;
+        this->reserved = 0;
+    }
+    current.holds++;
+}
+
+// Card time used while holding the reader is charged against the session's weight
+void ReaderScheduler::release(uint32_t flow) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Flow& current = this->flows.at(flow);
+        if (--current.holds != 0) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        auto used = std::chrono::duration_cast<std::chrono::microseconds>(now - this->grantedAt);
+        current.tag += std::max<double>(used.count(), 1) / current.weight;
+        this->owner = 0;
+        this->reserved = this->ahead(flow) ? flow : 0;
+        this->reservedUntil = now + ANTICIPATION;
+    }
+    this->turn.notify_all();
+}
+
+void ReaderScheduler::close(uint32_t flow) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->flows.erase(flow);
+        if (this->reserved == flow) {
+            this->reserved = 0;
+        }
+    }
+    this->turn.notify_all();
+}
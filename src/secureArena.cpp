@@ -0,0 +1,114 @@
+#include <secureArena.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Slots mapped at once when a size class runs out
+const size_t SLOTS_PER_SLAB = 16;
+
+SecureSlot::SecureSlot(octet* ptr, size_t len) : ptr(ptr), len(len) {}
+
+SecureSlot::SecureSlot(SecureSlot&& other) noexcept : ptr(other.ptr), len(other.len) {
+    other.ptr = nullptr;
+    other.len = 0;
+}
+
+SecureSlot& SecureSlot::operator=(SecureSlot&& other) noexcept {
+    if (this != &other) {
+        if (this->ptr != nullptr) {
+            SecureArena::getInstance().release(this->ptr, this->len);
+        }
+        this->ptr = other.ptr;
+        this->len = other.len;
+        other.ptr = nullptr;
+        other.len = 0;
+    }
+    return *this;
+}
+
+SecureSlot::~SecureSlot() {
+    if (this->ptr != nullptr) {
+        SecureArena::getInstance().release(this->ptr, this->len);
+    }
+}
+
+octet* SecureSlot::data() const {
+    return this->ptr;
+}
+
+size_t SecureSlot::size() const {
+    return this->len;
+}
+
+SecureSlot::operator bool() const {
+    return this->ptr != nullptr;
+}
+
+SecureArena::SecureArena() {
+    this->logger = Logger::getInstance();
+    this->pageSize = sysconf(_SC_PAGESIZE);
+}
+
+SecureArena& SecureArena::getInstance() {
+    // Never destroyed: slots held by static objects may be released after exit
+    static SecureArena* arena = new SecureArena();
+    return *arena;
+}
+
+// Slab layout: guard | slot | guard | slot | ... | guard
+bool SecureArena::grow(Pool& pool, size_t pages) {
+    size_t stride = (pages + 1) * this->pageSize;
+    size_t total = SLOTS_PER_SLAB * stride + this->pageSize;
+    void* map = mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        logger->log(__FILE__, __LINE__, "Cannot map secure arena slab", LogLevel::ERROR);
+        return false;
+    }
+
+    octet* base = static_cast<octet*>(map);
+    for (size_t i = 0; i < SLOTS_PER_SLAB; ++i) {
+        octet* slot = base + this->pageSize + i * stride;
+        size_t slotSize = pages * this->pageSize;
+        if (mprotect(slot, slotSize, PROT_READ | PROT_WRITE) != 0) {
+            logger->log(__FILE__, __LINE__, "Cannot unprotect secure arena slot", LogLevel::ERROR);
+            continue;
+        }
+#ifdef MADV_DONTDUMP
+        madvise(slot, slotSize, MADV_DONTDUMP);
+#endif
+        if (mlock(slot, slotSize) != 0 && !this->lockWarned) {
+            this->lockWarned = true;
+            logger->log(__FILE__, __LINE__, "Cannot lock secure arena memory, check RLIMIT_MEMLOCK", LogLevel::WARN);
+        }
+        pool.free.push_back(slot);
+        ++pool.slots;
+    }
+    return !pool.free.empty();
+}
+
+SecureSlot SecureArena::acquire(size_t size) {
+    size_t pages = (size + this->pageSize - 1) / this->pageSize;
+    if (pages == 0) {
+        pages = 1;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Pool& pool = this->pools[pages];
+    if (pool.free.empty() && !this->grow(pool, pages)) {
+        return SecureSlot();
+    }
+    octet* slot = pool.free.back();
+    pool.free.pop_back();
+    return SecureSlot(slot, size);
+}
+
+void SecureArena::release(octet* ptr, size_t len) {
+    size_t pages = (len + this->pageSize - 1) / this->pageSize;
+    if (pages == 0) {
+        pages = 1;
+    }
+    memWipe(ptr, pages * this->pageSize);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pools[pages].free.push_back(ptr);
+}
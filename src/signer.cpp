@@ -0,0 +1,98 @@
+#include <signer.h>
+
+#include <future>
+
+// Each signer prepares its digests on its own worker, so concurrent batches do not queue behind
+// each other
+Signer::Signer(PCSC& pcsc, CardSecure& card, octet channel)
+    : pcsc(pcsc), card(card), channel(channel), worker(1) {
+    this->logger = Logger::getInstance();
+}
+
+// Wrapping advances the SM counter, so it happens on the card loop right before the command is sent
+boost::optional<std::vector<octet>> Signer::wrap(const std::vector<octet>& digest) {
+    auto command = APDU(Cla::Default, Instruction::PerformSecurityOperation, 0x9E, 0x9A, digest, 256);
+    command.channel = this->channel;
+    return this->card.wrapCommand(command);
+}
+
+boost::optional<std::vector<octet>> Signer::complete(const std::vector<octet>& response) {
+    if (response.empty()) {
+        logger->log(__FILE__, __LINE__, "Signing failed: no response from card", LogLevel::ERROR);
+        return boost::none;
+    }
+    auto plain = this->card.unwrapResponse(response);
+    if (plain == boost::none) {
+        logger->log(__FILE__, __LINE__, "Signing failed: cannot decrypt response", LogLevel::ERROR);
+        return boost::none;
+    }
+    auto res = pcsc.decodeResponse(plain.get());
+    if (res->sw1 != 0x90) {
+        logger->log(__FILE__,
+                    __LINE__,
+                    "Signing failed: card status " + std::to_string(res->sw1) + " " + std::to_string(res->sw2),
+                    LogLevel::ERROR);
+        return boost::none;
+    }
+    return std::vector<octet>(res->rdf, res->rdf + res->rdf_len);
+}
+
+// The next digest is prepared while the card signs the current one. The pending preparation is
+// waited for before returning, it refers to the caller's data.
+template <typename Source>
+std::vector<boost::optional<std::vector<octet>>> Signer::signBatch(size_t count, Source source) {
+    std::vector<boost::optional<std::vector<octet>>> signatures(count);
+    if (count == 0) {
+        return signatures;
+    }
+    this->pcsc.traceContext();
+
+    auto next = this->worker.submit([&]() { return source(0); });
+    for (size_t i = 0; i < count; ++i) {
+        auto digest = next.get();
+        if (i + 1 < count) {
+            next = this->worker.submit([&, i]() { return source(i + 1); });
+        }
+        if (digest.empty()) {
+            logger->log(__FILE__, __LINE__, "Signing skipped: no digest", LogLevel::WARN);
+            continue;
+        }
+        auto command = this->wrap(digest);
+        if (command == boost::none) {
+            logger->log(__FILE__, __LINE__, "Signing failed: cannot encrypt APDU", LogLevel::ERROR);
+            break;
+        }
+        signatures[i] = this->complete(pcsc.sendCommandToCard(command.get()));
+        if (signatures[i] == boost::none) {
+            // The card has dropped or desynchronized the SM session, later commands would fail too
+            break;
+        }
+    }
+    if (next.valid()) {
+        next.wait();
+    }
+    return signatures;
+}
+
+boost::optional<std::vector<octet>> Signer::sign(const std::vector<octet>& digest) {
+    return this->signDigests({digest})[0];
+}
+
+std::vector<boost::optional<std::vector<octet>>> Signer::signDigests(const std::vector<std::vector<octet>>& digests) {
+    return this->signBatch(digests.size(), [&](size_t i) { return digests[i]; });
+}
+
+// Hashes still being computed are waited for by the worker preparing them, not by the card loop
+std::vector<boost::optional<std::vector<octet>>> Signer::signDigests(
+    const std::vector<std::shared_future<std::vector<octet>>>& digests) {
+    return this->signBatch(digests.size(), [&](size_t i) { return digests[i].get(); });
+}
+
+std::vector<boost::optional<std::vector<octet>>> Signer::signDocuments(
+    const std::vector<std::vector<octet>>& documents) {
+    return this->signBatch(documents.size(), [&](size_t i) {
+        std::vector<octet> digest(32);
+        beltHash(digest.data(), documents[i].data(), documents[i].size());
+        return digest;
+    });
+}
@@ -0,0 +1,215 @@
+#include <terminalAuth.h>
+
+#include <cvCertificate.h>
+#include <tracer.h>
+
+#include <bee2/core/mem.h>
+
+#include <algorithm>
+
+template <size_t L>
+TerminalHandshake<L>::TerminalHandshake(SecureSlot slot, size_t message3Size)
+    : slot(std::move(slot)), message3Size(message3Size) {}
+
+template <size_t L>
+TerminalHandshake<L>::operator bool() const {
+    return static_cast<bool>(this->slot);
+}
+
+template <size_t L>
+octet *TerminalHandshake<L>::key() const {
+    return this->slot.data();
+}
+
+template <size_t L>
+octet *TerminalHandshake<L>::out() const {
+    return this->slot.data() + Level::KEY;
+}
+
+template <size_t L>
+void *TerminalHandshake<L>::state() const {
+    return this->slot.data() + Level::KEY + Level::M1;
+}
+
+template <size_t L>
+std::vector<octet> TerminalHandshake<L>::message1() const {
+    if (!this->slot) {
+        return std::vector<octet>();
+    }
+    return std::vector<octet>(this->out(), this->out() + Level::M1);
+}
+
+template <size_t L>
+std::vector<octet> TerminalHandshake<L>::message3(const std::vector<octet> &message2) {
+    std::vector<octet> message3;
+    if (!this->slot || message2.size() != Level::M2) {
+        Logger::getInstance()->log(__FILE__, __LINE__, "Error in step4 BAUTH: bad message 2", LogLevel::ERROR);
+        return message3;
+    }
+    message3.resize(this->message3Size);
+    err_t code = traced("btokBAUTHTStep4",
+                        [&]() { return btokBAUTHTStep4(message3.data(), message2.data(), this->state()); });
+    if (code != ERR_OK) {
+        Logger::getInstance()->log(__FILE__, __LINE__, "Error in step4 BAUTH: " + std::to_string(code), LogLevel::ERROR);
+        message3.clear();
+    }
+    return message3;
+}
+
+// The state is wiped with the slot once the handshake is dropped
+template <size_t L>
+bool TerminalHandshake<L>::deriveKey(octet key[32]) {
+    if (!this->slot) {
+        return false;
+    }
+    err_t code = traced("btokBAUTHTStepG", [&]() { return btokBAUTHTStepG(this->key(), this->state()); });
+    if (code != ERR_OK) {
+        Logger::getInstance()->log(__FILE__, __LINE__, "Error in last step BAUTH: " + std::to_string(code), LogLevel::ERROR);
+        return false;
+    }
+    std::copy_n(this->key(), Level::KEY, key);
+    this->slot = SecureSlot();
+    return true;
+}
+
+template <size_t L>
+TerminalKeyPool<L>::TerminalKeyPool(const std::vector<octet> &privateKey, std::vector<octet> certificate, size_t capacity)
+    : certificate(std::move(certificate)), capacity(std::max<size_t>(capacity, 1)) {
+    this->logger = Logger::getInstance();
+
+    auto parsed = CVCertificate::parse(this->certificate);
+    if (parsed == boost::none || parsed->publicKey.size() != Level::PUBKEY) {
+        logger->log(__FILE__, __LINE__, "Bad terminal certificate", LogLevel::ERROR);
+        return;
+    }
+    this->holderRef.assign(parsed->holderRef.begin(), parsed->holderRef.end());
+
+    if (privateKey.size() != L / 4 || curveParams() == nullptr) {
+        logger->log(__FILE__, __LINE__, "Bad terminal private key", LogLevel::ERROR);
+        return;
+    }
+    this->privateKey = SecureArena::getInstance().acquire(privateKey.size());
+    if (!this->privateKey) {
+        logger->log(__FILE__, __LINE__, "Cannot allocate terminal key", LogLevel::ERROR);
+        return;
+    }
+    std::copy(privateKey.begin(), privateKey.end(), this->privateKey.data());
+
+    this->cert.data = this->certificate.data();
+    this->cert.len = this->certificate.size();
+    this->cert.val = certPublicKey;
+    this->valid = true;
+    this->worker = std::thread(&TerminalKeyPool::refill, this);
+}
+
+template <size_t L>
+TerminalKeyPool<L>::~TerminalKeyPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->taken.notify_one();
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+}
+
+template <size_t L>
+bool TerminalKeyPool<L>::isValid() const {
+    return this->valid;
+}
+
+template <size_t L>
+const std::vector<octet> &TerminalKeyPool<L>::getHolderRef() const {
+    return this->holderRef;
+}
+
+template <size_t L>
+size_t TerminalKeyPool<L>::ready() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stock.size();
+}
+
+template <size_t L>
+TerminalHandshake<L> TerminalKeyPool<L>::take() {
+    if (!this->valid) {
+        return TerminalHandshake<L>();
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->stock.empty()) {
+            auto handshake = std::move(this->stock.front());
+            this->stock.pop_front();
+            this->taken.notify_one();
+            return handshake;
+        }
+    }
+    logger->log(__FILE__, __LINE__, "Terminal key pool is empty, preparing inline", LogLevel::DEBUG);
+    return this->prepare();
+}
+
+// Start and step 2 depend only on the terminal: the ephemeral key pair and message 1
+template <size_t L>
+TerminalHandshake<L> TerminalKeyPool<L>::prepare() {
+    auto slot = SecureArena::getInstance().acquire(Level::slot());
+    if (!slot) {
+        logger->log(__FILE__, __LINE__, "Cannot allocate BAUTH state", LogLevel::ERROR);
+        return TerminalHandshake<L>();
+    }
+    TerminalHandshake<L> handshake(std::move(slot), Level::M3 + this->certificate.size());
+    err_t code = btokBAUTHTStart(handshake.state(), curveParams(), &this->settings, this->privateKey.data(), &this->cert);
+    if (code == ERR_OK) {
+        code = btokBAUTHTStep2(handshake.out(), handshake.state());
+    }
+    if (code != ERR_OK) {
+        logger->log(__FILE__, __LINE__, "Cannot prepare BAUTH: " + std::to_string(code), LogLevel::ERROR);
+        return TerminalHandshake<L>();
+    }
+    return handshake;
+}
+
+template <size_t L>
+void TerminalKeyPool<L>::refill() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->taken.wait(lock, [this]() { return this->stopping || this->stock.size() < this->capacity; });
+        if (this->stopping) {
+            return;
+        }
+        lock.unlock();
+        auto handshake = this->prepare();
+        lock.lock();
+        if (!handshake) {
+            // Out of secure memory or a broken key, sessions fall back to preparing inline
+            return;
+        }
+        this->stock.push_back(std::move(handshake));
+    }
+}
+
+template <size_t L>
+const bign_params *TerminalKeyPool<L>::curveParams() {
+    static bign_params params;
+    static const err_t status = bignParamsStd(&params, BpaceLevel<L>::CURVE);
+    return status == ERR_OK ? &params : nullptr;
+}
+
+// bake takes the terminal public key from its CV certificate, which must match the curve in use
+template <size_t L>
+err_t TerminalKeyPool<L>::certPublicKey(octet *pubkey, const bign_params *params, const octet *data, size_t len) {
+    auto parsed = CVCertificate::parse(std::span<const octet>(data, len));
+    if (parsed == boost::none || params == nullptr || parsed->publicKey.size() != params->l / 2) {
+        return ERR_BAD_CERT;
+    }
+    if (pubkey != nullptr) {
+        std::copy(parsed->publicKey.begin(), parsed->publicKey.end(), pubkey);
+    }
+    return ERR_OK;
+}
+
+template class TerminalHandshake<128>;
+template class TerminalHandshake<192>;
+template class TerminalHandshake<256>;
+template class TerminalKeyPool<128>;
+template class TerminalKeyPool<192>;
+template class TerminalKeyPool<256>;
@@ -0,0 +1,43 @@
+#include <threadPool.h>
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        this->workers.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->condition.notify_all();
+    for (auto& worker : this->workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return this->workers.size();
+}
+
+void ThreadPool::worker() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+            if (this->tasks.empty()) {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,207 @@
+#include <tracer.h>
+
+#include <logger.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+static thread_local uint32_t contextReader = 0;
+static thread_local uint32_t contextSession = 0;
+
+static uint64_t monotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint32_t threadId() {
+    static thread_local uint32_t id = static_cast<uint32_t>(syscall(SYS_gettid));
+    return id;
+}
+
+static std::string jsonEscape(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Started from the environment on first use, the trace is then written when the process exits
+Tracer& Tracer::getInstance() {
+    static Tracer* instance = []() {
+        auto tracer = new Tracer();
+        const char* path = std::getenv("CARDLIB_TRACE");
+        if (path != nullptr && *path != '\0' && tracer->start(path)) {
+            std::atexit([]() { Tracer::getInstance().stop(); });
+        }
+        return tracer;
+    }();
+    return *instance;
+}
+
+// Waits for the spans that passed the check in record() before tracing stopped
+void Tracer::drain() const {
+    while (this->recording.load() != 0) {
+        std::this_thread::yield();
+    }
+}
+
+bool Tracer::start(const std::string& path, size_t capacity) {
+    if (this->active) {
+        return false;
+    }
+    this->drain();
+    this->path = path;
+    this->capacity = capacity;
+    this->events.reset(new TraceEvent[capacity]);
+    this->cursor = 0;
+    this->overflow = 0;
+    this->origin = monotonicNs();
+    this->active.store(true, std::memory_order_release);
+    return true;
+}
+
+bool Tracer::stop() {
+    if (!this->active.exchange(false)) {
+        return false;
+    }
+    this->drain();
+    return this->write();
+}
+
+uint64_t Tracer::now() const {
+    return monotonicNs() - this->origin;
+}
+
+size_t Tracer::dropped() const {
+    return this->overflow.load(std::memory_order_relaxed);
+}
+
+// The buffer is only touched while counted in recording and tracing is active, so start() and
+// stop() never swap or read it under a span being written
+void Tracer::record(const char* name, uint64_t start, uint64_t end, uint32_t reader, uint32_t session) {
+    this->recording.fetch_add(1);
+    if (!this->active.load()) {
+        this->recording.fetch_sub(1);
+        return;
+    }
+    size_t index = this->cursor.fetch_add(1, std::memory_order_relaxed);
+    if (index >= this->capacity) {
+        this->overflow.fetch_add(1, std::memory_order_relaxed);
+        this->recording.fetch_sub(1);
+        return;
+    }
+    TraceEvent& event = this->events[index];
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    event.reader = reader;
+    event.session = session;
+    event.thread = threadId();
+    event.ready.store(true, std::memory_order_release);
+    this->recording.fetch_sub(1);
+}
+
+// Reader 0 stands for spans recorded before any reader was attached
+uint32_t Tracer::readerId(const std::string& readerName) {
+    std::lock_guard<std::mutex> lock(this->readersMutex);
+    for (size_t i = 0; i < this->readers.size(); ++i) {
+        if (this->readers[i] == readerName) {
+            return i + 1;
+        }
+    }
+    this->readers.push_back(readerName);
+    return this->readers.size();
+}
+
+uint32_t Tracer::nextSessionId() {
+    static std::atomic<uint32_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tracer::setContext(uint32_t reader, uint32_t session) {
+    contextReader = reader;
+    contextSession = session;
+}
+
+// Called once recording has drained, so every counted span is complete
+bool Tracer::write() {
+    FILE* file = std::fopen(this->path.c_str(), "w");
+    if (file == nullptr) {
+        Logger::getInstance()->log(__FILE__, __LINE__, "Cannot write trace to " + this->path, LogLevel::ERROR);
+        return false;
+    }
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"no reader\"}}");
+    {
+        std::lock_guard<std::mutex> lock(this->readersMutex);
+        for (size_t i = 0; i < this->readers.size(); ++i) {
+            std::fprintf(file,
+                         ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":\"r%zu %s\"}}",
+                         i + 1,
+                         i + 1,
+                         jsonEscape(this->readers[i]).c_str());
+        }
+    }
+    size_t count = std::min(this->cursor.load(), this->capacity);
+    for (size_t i = 0; i < count; ++i) {
+        const TraceEvent& event = this->events[i];
+        if (!event.ready.load(std::memory_order_acquire)) {
+            continue;
+        }
+        std::fprintf(file,
+                     ",\n{\"name\":\"%s r%" PRIu32 " s%" PRIu32 "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                     "\"pid\":%" PRIu32 ",\"tid\":%" PRIu32 ",\"args\":{\"thread\":%" PRIu32 "}}",
+                     event.name,
+                     event.reader,
+                     event.session,
+                     event.start / 1000.0,
+                     event.duration / 1000.0,
+                     event.reader,
+                     event.session,
+                     event.thread);
+    }
+    std::fprintf(file, "\n]}\n");
+    bool ok = std::fclose(file) == 0;
+    if (this->dropped() != 0) {
+        Logger::getInstance()->log(
+            __FILE__, __LINE__, "Trace buffer full, dropped " + std::to_string(this->dropped()) + " spans", LogLevel::WARN);
+    }
+    return ok;
+}
+
+TraceSpan::TraceSpan(const char* name) : name(name) {
+    Tracer& tracer = Tracer::getInstance();
+    if (!tracer.enabled()) {
+        this->name = nullptr;
+        return;
+    }
+    this->start = tracer.now();
+}
+
+TraceSpan::~TraceSpan() {
+    if (this->name == nullptr) {
+        return;
+    }
+    Tracer& tracer = Tracer::getInstance();
+    if (tracer.enabled()) {
+        tracer.record(this->name, this->start, tracer.now(), contextReader, contextSession);
+    }
+}
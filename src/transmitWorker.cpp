@@ -0,0 +1,79 @@
+#include <transmitWorker.h>
+
+static std::atomic<size_t> retiredWorkers{0};
+
+TransmitWorker::TransmitWorker() : state(std::make_shared<State>()) {
+    this->thread = std::thread(&TransmitWorker::run, this->state);
+}
+
+// A retired worker may still be inside the card call, it exits on its own once that returns
+TransmitWorker::~TransmitWorker() {
+    bool retired;
+    {
+        std::lock_guard<std::mutex> lock(this->state->mutex);
+        this->state->stopping = true;
+        retired = this->state->retired;
+    }
+    this->state->wake.notify_one();
+    if (retired) {
+        this->thread.detach();
+    } else {
+        this->thread.join();
+    }
+}
+
+void TransmitWorker::post(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(this->state->mutex);
+        this->state->job = std::move(job);
+    }
+    this->state->wake.notify_one();
+}
+
+bool TransmitWorker::retire(std::function<void()> teardown) {
+    std::lock_guard<std::mutex> lock(this->state->mutex);
+    if (!this->state->running) {
+        return false;
+    }
+    this->state->retired = true;
+    this->state->teardown = std::move(teardown);
+    retiredWorkers++;
+    return true;
+}
+
+size_t TransmitWorker::retired() {
+    return retiredWorkers.load();
+}
+
+void TransmitWorker::run(std::shared_ptr<State> state) {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->wake.wait(lock, [&]() { return state->stopping || state->job != nullptr; });
+            if (state->job == nullptr) {
+                return;
+            }
+            job = std::move(state->job);
+            state->job = nullptr;
+            state->running = true;
+        }
+        job();
+        job = nullptr;
+
+        std::function<void()> teardown;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->running = false;
+            if (!state->retired) {
+                continue;
+            }
+            teardown = std::move(state->teardown);
+        }
+        if (teardown != nullptr) {
+            teardown();
+        }
+        retiredWorkers--;
+        return;
+    }
+}
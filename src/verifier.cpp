@@ -0,0 +1,120 @@
+#include <verifier.h>
+
+#include <algorithm>
+#include <mutex>
+
+SignatureVerifier::SignatureVerifier(size_t threads, size_t maxKeys) : pool(threads), maxKeys(maxKeys) {
+    this->logger = Logger::getInstance();
+}
+
+static const char* curveName(size_t l) {
+    switch (l) {
+        case 128:
+            return "1.2.112.0.2.0.34.101.45.3.1";
+        case 192:
+            return "1.2.112.0.2.0.34.101.45.3.2";
+        case 256:
+            return "1.2.112.0.2.0.34.101.45.3.3";
+        default:
+            return nullptr;
+    }
+}
+
+std::shared_ptr<const SignatureVerifier::KeyContext> SignatureVerifier::keyContext(const std::vector<octet>& pubkey) {
+    octet keyHash[32];
+    beltHash(keyHash, pubkey.data(), pubkey.size());
+    std::string id(keyHash, keyHash + sizeof(keyHash));
+    {
+        std::lock_guard<std::mutex> lock(this->keyMutex);
+        auto it = this->keys.find(id);
+        if (it != this->keys.end()) {
+            this->lru.splice(this->lru.begin(), this->lru, it->second);
+            return it->second->second;
+        }
+    }
+
+    // A public key is two coordinates of 2 * l bits each, so twice its size in bytes is l
+    auto context = std::make_shared<KeyContext>();
+    context->valid = false;
+    const char* curve = curveName(pubkey.size() * 2);
+    if (curve != nullptr && bignParamsStd(&context->params, curve) == ERR_OK) {
+        context->valid = bignPubkeyVal(&context->params, pubkey.data()) == ERR_OK;
+    }
+    if (!context->valid) {
+        logger->log(__FILE__, __LINE__, "Invalid bign public key", LogLevel::WARN);
+    }
+
+    // The least recently used key goes when the cache is full
+    std::lock_guard<std::mutex> lock(this->keyMutex);
+    auto it = this->keys.find(id);
+    if (it != this->keys.end()) {
+        return it->second->second;
+    }
+    this->lru.emplace_front(id, context);
+    this->keys[id] = this->lru.begin();
+    if (this->lru.size() > this->maxKeys) {
+        this->keys.erase(this->lru.back().first);
+        this->lru.pop_back();
+    }
+    return context;
+}
+
+std::shared_ptr<const std::vector<octet>> SignatureVerifier::oidDer(const std::string& oid) {
+    {
+        std::shared_lock<std::shared_mutex> lock(this->mutex);
+        auto it = this->oids.find(oid);
+        if (it != this->oids.end()) {
+            return it->second;
+        }
+    }
+
+    octet buffer[128];
+    size_t len = sizeof(buffer);
+    if (bignOidToDER(buffer, &len, oid.c_str()) != ERR_OK) {
+        return nullptr;
+    }
+    auto der = std::make_shared<const std::vector<octet>>(buffer, buffer + len);
+
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->oids.emplace(oid, der);
+    return der;
+}
+
+bool SignatureVerifier::verify(const VerifyRequest& request) {
+    auto context = this->keyContext(request.pubkey);
+    if (!context->valid) {
+        return false;
+    }
+    size_t l = context->params.l;
+    if (request.hash.size() != l / 4 || request.signature.size() != 3 * l / 8) {
+        return false;
+    }
+    auto der = this->oidDer(request.hashOid);
+    if (der == nullptr) {
+        logger->log(__FILE__, __LINE__, "Invalid hash OID: " + request.hashOid, LogLevel::ERROR);
+        return false;
+    }
+    return bignVerify(&context->params,
+                      der->data(),
+                      der->size(),
+                      request.hash.data(),
+                      request.signature.data(),
+                      request.pubkey.data()) == ERR_OK;
+}
+
+std::vector<bool> SignatureVerifier::verifyBatch(const std::vector<VerifyRequest>& requests) {
+    std::vector<char> results(requests.size(), 0);
+    size_t parts = std::min(this->pool.size(), requests.size());
+    std::vector<std::future<void>> done;
+    for (size_t part = 0; part < parts; ++part) {
+        done.push_back(this->pool.submit([&, part]() {
+            for (size_t i = part; i < requests.size(); i += parts) {
+                results[i] = this->verify(requests[i]);
+            }
+        }));
+    }
+    for (auto& f : done) {
+        f.get();
+    }
+    return std::vector<bool>(results.begin(), results.end());
+}
@@ -0,0 +1,103 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <allocStats.h>
+#include <apducmd.h>
+#include <bpace.h>
+#include <cardsecure.h>
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+
+// Heap allocations allowed per operation, lower them as the paths become allocation-free
+static const size_t APDU_ENCODE_BUDGET = 2;
+static const size_t DER_BUDGET = 1;
+static const size_t SM_WRAP_BUDGET = 1;
+static const size_t SM_UNWRAP_BUDGET = 2;
+static const size_t TRANSMIT_BUDGET = 2;
+static const size_t BPACE_INIT_BUDGET = 16;
+static const size_t BPACE_STEP2_BUDGET = 16;
+static const size_t BPACE_STEP4_BUDGET = 16;
+static const size_t BPACE_STEP6_BUDGET = 4;
+
+static const size_t RUNS = 16;
+
+static bool withinBudget(AllocSite site, size_t perOp, size_t ops) {
+    if (AllocStats::checkBudget(site, perOp * ops)) {
+        return true;
+    }
+    std::fprintf(stderr, "%s: %zu allocations for %zu operations, budget is %zu each\n",
+                 AllocStats::siteName(site), AllocStats::get(site).allocs, ops, perOp);
+    return false;
+}
+
+// Frees are charged to the site that made the block, so a site whose blocks are all gone again
+// by the end of the operation balances
+static bool balanced(AllocSite site) {
+    auto c = AllocStats::get(site);
+    if (c.frees == c.allocs) {
+        return true;
+    }
+    std::fprintf(stderr, "%s: %zu allocations, %zu frees\n", AllocStats::siteName(site), c.allocs, c.frees);
+    return false;
+}
+
+// The first run fills lazily created state such as the logger and the tracer
+static void measure(const std::function<void()>& operation) {
+    operation();
+    AllocStats::reset();
+    for (size_t i = 0; i < RUNS; ++i) {
+        operation();
+    }
+}
+
+int main() {
+    if (!AllocStats::enabled()) {
+        std::fprintf(stderr, "alloc-budget: built without CARDLIB_ALLOC_STATS\n");
+        return 1;
+    }
+    Logger::getInstance()->setLogPreferences("", LogLevel::ERROR, LogOutput::CONSOLE);
+
+    APDU select(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, std::vector<octet>(16, 0xA5));
+    measure([&]() { APDUEncode(select); });
+    CHECK(withinBudget(AllocSite::ApduEncode, APDU_ENCODE_BUDGET, RUNS));
+
+    std::vector<octet> value(64, 0x5A);
+    measure([&]() { derEncode(0x7C, value); });
+    CHECK(withinBudget(AllocSite::Der, DER_BUDGET, RUNS));
+
+    // One BPACE per run, then a secured read so wrap and unwrap are charged per secured APDU and
+    // transmit per APDU sent in the run
+    uint64_t apdus = 0;
+    uint64_t transmits = 0;
+    bool ok = true;
+    measure([&]() {
+        Bpace bpace(CAN, Pwd::CAN, simCard());
+        CardSecure card;
+        ok = ok && authorize(bpace, card);
+        if (!ok) {
+            return;
+        }
+        uint64_t before = bpace.getPCSC().getTransmitCount();
+        ok = bpace.chooseEF(card) && !bpace.readEF(card).empty();
+        apdus += bpace.getPCSC().getTransmitCount() - before;
+        transmits += bpace.getPCSC().getTransmitCount();
+    });
+    CHECK(ok);
+    CHECK(withinBudget(AllocSite::BpaceInit, BPACE_INIT_BUDGET, RUNS));
+    CHECK(withinBudget(AllocSite::BpaceStep2, BPACE_STEP2_BUDGET, RUNS));
+    CHECK(withinBudget(AllocSite::BpaceStep4, BPACE_STEP4_BUDGET, RUNS));
+    CHECK(withinBudget(AllocSite::BpaceStep6, BPACE_STEP6_BUDGET, RUNS));
+    CHECK(withinBudget(AllocSite::SmWrap, SM_WRAP_BUDGET, apdus));
+    CHECK(withinBudget(AllocSite::SmUnwrap, SM_UNWRAP_BUDGET, apdus));
+    CHECK(withinBudget(AllocSite::Transmit, TRANSMIT_BUDGET, transmits));
+    for (size_t i = 1; i < static_cast<size_t>(AllocSite::Count); ++i) {
+        CHECK(balanced(static_cast<AllocSite>(i)));
+    }
+
+    if (checkFailures != 0) {
+        std::fprintf(stderr, "%s", AllocStats::report().c_str());
+    }
+    return checkResult("alloc-budget");
+}
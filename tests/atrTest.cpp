@@ -0,0 +1,90 @@
+#include "check.h"
+
+#include <atr.h>
+#include <capabilityCache.h>
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+static boost::optional<ATR> parse(const std::vector<octet>& atr) {
+    return ATR::parse(atr.data(), atr.size());
+}
+
+static void parsesInterfaceAndHistoricalBytes() {
+    // T=0 only, two historical bytes and no TCK
+    auto contact = parse({0x3B, 0x02, 0x14, 0x50});
+    CHECK(contact != boost::none);
+    CHECK(contact->supportsProtocol(0) && !contact->supportsProtocol(1));
+    CHECK(contact->getCardType() == CardType::Contact);
+    CHECK(contact->getHistoricalBytes() == std::vector<octet>({0x14, 0x50}));
+    CHECK(contact->toHex() == "3B021450");
+
+    // PC/SC part 3 ATR of a contactless card announcing chaining and extended lengths in 73
+    auto contactless = parse({0x3B, 0x85, 0x80, 0x01, 0x80, 0x73, 0x00, 0x00, 0xC0, 0x37});
+    CHECK(contactless != boost::none);
+    CHECK(contactless->supportsProtocol(0) && contactless->supportsProtocol(1));
+    CHECK(contactless->getCardType() == CardType::Contactless);
+    CHECK(contactless->supportsChaining());
+    CHECK(contactless->supportsExtendedLength());
+
+    auto storage = parse({0x3B, 0x8F, 0x80, 0x01, 0x80, 0x4F, 0x0C, 0xA0, 0x00, 0x00, 0x03, 0x06,
+                          0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x6A});
+    CHECK(storage != boost::none);
+    CHECK(storage->getCardType() == CardType::ContactlessStorage);
+    CHECK(!storage->supportsExtendedLength());
+}
+
+static void rejectsMalformedAtrs() {
+    CHECK(parse({}) == boost::none);
+    CHECK(parse({0x00, 0x00}) == boost::none);
+    // TD1 announced but missing
+    CHECK(parse({0x3B, 0x80}) == boost::none);
+    // Historical bytes cut short
+    CHECK(parse({0x3B, 0x85, 0x80, 0x01, 0x80, 0x73}) == boost::none);
+    // Bad TCK
+    CHECK(parse({0x3B, 0x85, 0x80, 0x01, 0x80, 0x73, 0x00, 0x00, 0xC0, 0x36}) == boost::none);
+}
+
+// Entries with bad numbers or AIDs are skipped, the rest of the file is still used
+static void skipsInvalidCacheEntries(const std::string& dir) {
+    {
+        std::ofstream file(std::filesystem::path(dir) / "capabilities");
+        file << "3B021450\tReader A\t255\t256\t0\t0\t1\tA000000001\n";
+        file << "3B021451\tReader A\tmany\t256\t0\t0\t1\t\n";
+        file << "3B021452\tReader A\t255\t256\t0\t0\t1\tA0,XYZ\n";
+        file << "truncated\n";
+    }
+    auto cache = CapabilityCache::getInstance();
+    auto valid = cache->find("3B021450", "Reader A 00 01");
+    CHECK(valid != boost::none);
+    if (valid != boost::none) {
+        CHECK(valid->limits.maxCommand == 255 && valid->secureMessaging);
+        CHECK(valid->applets == std::vector<std::vector<octet>>({{0xA0, 0x00, 0x00, 0x00, 0x01}}));
+    }
+    CHECK(cache->find("3B021451", "Reader A") == boost::none);
+    CHECK(cache->find("3B021452", "Reader A") == boost::none);
+
+    CardProfile profile;
+    profile.limits.maxCommand = 1000;
+    profile.limits.extended = true;
+    cache->store("3B021453", "Reader B 01 00", profile);
+    CHECK(std::filesystem::exists(std::filesystem::path(dir) / "capabilities"));
+    auto stored = cache->find("3B021453", "Reader B 02 00");
+    CHECK(stored != boost::none && stored->limits.maxCommand == 1000 && stored->limits.extended);
+}
+
+int main() {
+    std::string dir = tempDirectory();
+    setenv("CARDLIB_CACHE_DIR", dir.c_str(), 1);
+    Logger::getInstance()->setLogPreferences("", LogLevel::ERROR, LogOutput::CONSOLE);
+
+    parsesInterfaceAndHistoricalBytes();
+    rejectsMalformedAtrs();
+    skipsInvalidCacheEntries(dir);
+
+    std::filesystem::remove_all(dir);
+    return checkResult("atr");
+}
@@ -0,0 +1,35 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdlib.h>
+
+#include <cstdio>
+#include <string>
+
+// Minimal assertions for the test executables, main returns checkResult()
+inline int checkFailures = 0;
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            checkFailures++;                                                                 \
+        }                                                                                    \
+    } while (0)
+
+// Fresh directory for the on-disk caches, so runs do not see each other's entries
+inline std::string tempDirectory() {
+    char dir[] = "/tmp/cardlib-test-XXXXXX";
+    return mkdtemp(dir) != nullptr ? std::string(dir) : std::string();
+}
+
+inline int checkResult(const char* name) {
+    if (checkFailures != 0) {
+        std::fprintf(stderr, "%s: %d check(s) failed\n", name, checkFailures);
+        return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <commandPipeline.h>
+
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Short APDUs, so a chunk is what fits in 256 bytes with the SM overhead
+static const size_t CHUNK = CardSecure::plainResponseCapacity(256);
+
+static const std::vector<octet> FID_SHORT = {0x01, 0x02};
+
+static APDU readBinary(size_t offset) {
+    return APDU(Cla::Default, Instruction::ReadBinary, static_cast<octet>(offset >> 8), static_cast<octet>(offset), {},
+                CHUNK);
+}
+
+// One secured READ BINARY without recovery, it only unwraps if the SM counters are in step
+static bool inStep(PCSC& pcsc, CardSecure& card) {
+    auto wrapped = card.wrapCommand(readBinary(0));
+    if (wrapped == boost::none) {
+        return false;
+    }
+    auto plain = card.unwrapResponse(pcsc.sendCommandToCard(wrapped.get()));
+    return plain != boost::none && plain->size() >= 2 && (*plain)[plain->size() - 2] == 0x90;
+}
+
+// A file that fits in one chunk takes one READ BINARY, a longer one at most one past its end
+static void readAheadStopsAtEnd() {
+    size_t size = 5 * CHUNK + 10;
+    auto sim = simCard(1ms, size, false);
+    std::vector<octet> small(100, 0x5A);
+    sim->setEF(FID_SHORT, small);
+    Bpace bpace(CAN, Pwd::CAN, sim);
+    CardSecure card;
+    CHECK(authorize(bpace, card));
+    auto& pcsc = bpace.getPCSC();
+
+    CHECK(bpace.chooseEF(card, FID_SHORT));
+    auto before = pcsc.getTransmitCount();
+    CHECK(bpace.readEF(card) == small);
+    CHECK(pcsc.getTransmitCount() - before == 1);
+
+    CHECK(bpace.chooseEF(card));
+    before = pcsc.getTransmitCount();
+    CHECK(simulated(bpace.readEF(card), size));
+    auto sent = pcsc.getTransmitCount() - before;
+    CHECK(sent >= 6 && sent <= 7);
+
+    // The commands wrapped past the end were dropped, SM goes on from the last one sent
+    CHECK(inStep(pcsc, card));
+    CHECK(bpace.chooseEF(card, FID_SHORT) && bpace.readEF(card) == small);
+    CHECK(bpace.chooseEF(card) && simulated(bpace.readEF(card), size));
+}
+
+// Stopping on the first response drops the queued commands and rewinds the SM state to match
+static void stopDropsQueuedCommands() {
+    auto sim = simCard(1ms, 2048, false);
+    Bpace bpace(CAN, Pwd::CAN, sim);
+    CardSecure card;
+    CHECK(connect(bpace, card));
+    auto& pcsc = bpace.getPCSC();
+
+    CommandPipeline pipeline(pcsc, CommandPipeline::MAX_DEPTH);
+    std::vector<octet> first;
+    auto before = pcsc.getTransmitCount();
+    size_t delivered = pipeline.run(
+        card,
+        [](size_t i) -> boost::optional<APDU> { return readBinary(i * CHUNK); },
+        [&](size_t, const boost::optional<std::vector<octet>>& plain) {
+            CHECK(plain != boost::none && plain->size() == CHUNK + 2);
+            if (plain != boost::none) {
+                first.assign(plain->begin(), plain->end() - 2);
+            }
+            return false;
+        });
+    CHECK(delivered == 1 && pipeline.getLastError() == CardError::None);
+    CHECK(simulated(first, CHUNK));
+    CHECK(pcsc.getTransmitCount() - before <= 2);
+    CHECK(inStep(pcsc, card));
+
+    CHECK(simulated(bpace.readEF(card), 2048));
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    readAheadStopsAtEnd();
+    stopDropsQueuedCommands();
+
+    return checkResult("commandPipeline");
+}
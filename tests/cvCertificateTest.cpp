@@ -0,0 +1,180 @@
+#include "check.h"
+#include "testKey.h"
+
+#include <cvCertificate.h>
+#include <hasher.h>
+
+#include <chrono>
+#include <vector>
+
+static const std::vector<octet> OID_EID_CHAT = {0x04, 0x00, 0x7F, 0x00, 0x07, 0x03, 0x01, 0x02, 0x02};
+static const std::vector<octet> OID_BIGN_PUBKEY = {0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x2D, 0x02, 0x01};
+
+static std::vector<octet> bytes(const char* text) {
+    return std::vector<octet>(text, text + std::char_traits<char>::length(text));
+}
+
+static std::vector<octet> join(std::initializer_list<std::vector<octet>> parts) {
+    std::vector<octet> res;
+    for (auto& part : parts) {
+        res.insert(res.end(), part.begin(), part.end());
+    }
+    return res;
+}
+
+static std::vector<octet> chat() {
+    return derEncode(0x7F4C, join({derEncode(0x06, OID_EID_CHAT), derEncode(0x53, {0x00, 0x00, 0x00, 0x00, 0x03})}));
+}
+
+static std::vector<octet> body(const char* authority, const char* holder, const std::vector<octet>& pubkey) {
+    return derEncode(0x7F4E,
+                     join({derEncode(0x5F29, {0x00}),
+                           derEncode(0x42, bytes(authority)),
+                           derEncode(0x7F49, join({derEncode(0x06, OID_BIGN_PUBKEY), derEncode(0x86, pubkey)})),
+                           derEncode(0x5F20, bytes(holder)),
+                           chat(),
+                           derEncode(0x5F25, {0x02, 0x06, 0x00, 0x01, 0x00, 0x01}),
+                           derEncode(0x5F24, {0x02, 0x09, 0x00, 0x01, 0x00, 0x01})}));
+}
+
+// Body signed with belt-hash by the issuer, as for a 128-bit issuer key
+static std::vector<octet> certificate(const std::vector<octet>& body, const TestKey& issuer) {
+    Hasher hasher;
+    hasher.update(body.data(), body.size());
+    return derEncode(0x7F21, join({body, derEncode(0x5F37, issuer.sign(hasher.finish()))}));
+}
+
+static bool equals(std::span<const octet> value, const std::vector<octet>& expected) {
+    return std::equal(value.begin(), value.end(), expected.begin(), expected.end());
+}
+
+static void parsesFields(const TestKey& issuer, const TestKey& holder) {
+    auto data = certificate(body("BYCVCA00001", "BYTERM00001", holder.pubkey), issuer);
+    auto cert = CVCertificate::parse(data);
+    CHECK(cert != boost::none);
+    if (cert == boost::none) {
+        return;
+    }
+    CHECK(cert->raw.size() == data.size());
+    CHECK(equals(cert->authorityRef, bytes("BYCVCA00001")));
+    CHECK(equals(cert->holderRef, bytes("BYTERM00001")));
+    CHECK(equals(cert->publicKeyOid, OID_BIGN_PUBKEY));
+    CHECK(equals(cert->publicKey, holder.pubkey));
+    CHECK(equals(cert->effectiveDate, {0x02, 0x06, 0x00, 0x01, 0x00, 0x01}));
+    CHECK(equals(cert->expirationDate, {0x02, 0x09, 0x00, 0x01, 0x00, 0x01}));
+    CHECK(cert->extensions.empty());
+    CHECK(cert->signature.size() == 48);
+
+    auto hat = cert->getCertHAT();
+    CHECK(hat != boost::none && hat->encode() == chat());
+}
+
+static void rejectsMalformed(const TestKey& issuer, const TestKey& holder) {
+    auto data = certificate(body("BYCVCA00001", "BYTERM00001", holder.pubkey), issuer);
+    CHECK(CVCertificate::parse(std::span<const octet>(data).first(data.size() - 1)) == boost::none);
+
+    auto wrongTag = data;
+    wrongTag[1] = 0x22;
+    CHECK(CVCertificate::parse(wrongTag) == boost::none);
+
+    // Holder reference is mandatory
+    auto noHolder = derEncode(0x7F4E,
+                              join({derEncode(0x42, bytes("BYCVCA00001")),
+                                    derEncode(0x7F49, derEncode(0x86, holder.pubkey))}));
+    CHECK(CVCertificate::parse(certificate(noHolder, issuer)) == boost::none);
+}
+
+static void verifiesSignature(const TestKey& issuer, const TestKey& holder) {
+    SignatureVerifier verifier(2);
+    auto data = certificate(body("BYCVCA00001", "BYTERM00001", holder.pubkey), issuer);
+    auto cert = CVCertificate::parse(data);
+    CHECK(cert != boost::none && cert->verify(issuer.pubkey, verifier));
+    CHECK(cert != boost::none && !cert->verify(holder.pubkey, verifier));
+
+    auto tampered = data;
+    tampered[tampered.size() - 1] ^= 0x01;
+    auto bad = CVCertificate::parse(tampered);
+    CHECK(bad != boost::none && !bad->verify(issuer.pubkey, verifier));
+}
+
+static std::chrono::system_clock::time_point day(int year, unsigned month, unsigned day) {
+    return std::chrono::sys_days(std::chrono::year(year) / month / day);
+}
+
+static void parsesDates() {
+    CHECK(CVCertificate::date(std::vector<octet>{0x02, 0x06, 0x00, 0x01, 0x00, 0x01}) == 20260101u);
+    CHECK(CVCertificate::date(std::vector<octet>{0x02, 0x06, 0x01, 0x03, 0x00, 0x01}) == boost::none);
+    CHECK(CVCertificate::date(std::vector<octet>{0x02, 0x06, 0x00, 0x0A, 0x00, 0x01}) == boost::none);
+    CHECK(CVCertificate::date(std::vector<octet>{0x02, 0x06, 0x00, 0x01}) == boost::none);
+    CHECK(CVCertificate::date(day(2027, 6, 15)) == 20270615u);
+}
+
+// CVCA -> DV -> terminal, the chain yields the terminal key and any broken link fails it
+static void validatesChain(const TestKey& cvca, const TestKey& dv, const TestKey& terminal) {
+    SignatureVerifier verifier(2);
+    CVCertificateCache cache(verifier, 1);
+    auto cvcaRef = bytes("BYCVCA00001");
+    auto dvCert = certificate(body("BYCVCA00001", "BYDV000001", dv.pubkey), cvca);
+    auto terminalCert = certificate(body("BYDV000001", "BYTERM00001", terminal.pubkey), dv);
+    auto now = day(2027, 6, 15);
+
+    auto key = cache.validateChain({dvCert, terminalCert}, cvca.pubkey, cvcaRef, now);
+    CHECK(key != boost::none && *key == terminal.pubkey);
+    // Served again after eviction from the single entry cache
+    key = cache.validateChain({dvCert, terminalCert}, cvca.pubkey, cvcaRef, now);
+    CHECK(key != boost::none && *key == terminal.pubkey);
+
+    CHECK(cache.validateChain({terminalCert, dvCert}, cvca.pubkey, cvcaRef, now) == boost::none);
+    CHECK(cache.validateChain({terminalCert}, cvca.pubkey, cvcaRef, now) == boost::none);
+    CHECK(!cache.validate(std::vector<octet>{0x7F, 0x21, 0x00}, cvca.pubkey).verified);
+}
+
+// Signed by the right key but naming another authority or anchor
+static void checksReferences(const TestKey& cvca, const TestKey& dv, const TestKey& terminal) {
+    SignatureVerifier verifier(2);
+    CVCertificateCache cache(verifier);
+    auto dvCert = certificate(body("BYCVCA00001", "BYDV000001", dv.pubkey), cvca);
+    auto mislinked = certificate(body("BYDV000002", "BYTERM00001", terminal.pubkey), dv);
+    auto terminalCert = certificate(body("BYDV000001", "BYTERM00001", terminal.pubkey), dv);
+    auto now = day(2027, 6, 15);
+
+    CHECK(cache.validateChain({dvCert, mislinked}, cvca.pubkey, bytes("BYCVCA00001"), now) == boost::none);
+    CHECK(cache.validateChain({dvCert, terminalCert}, cvca.pubkey, bytes("BYCVCA00002"), now) == boost::none);
+    CHECK(cache.validateChain({dvCert, terminalCert}, cvca.pubkey, bytes("BYCVCA00001"), now) != boost::none);
+}
+
+// Valid from 2026-01-01 through 2029-01-01, checked again on every use of a cached entry
+static void checksDates(const TestKey& cvca, const TestKey& dv) {
+    SignatureVerifier verifier(2);
+    CVCertificateCache cache(verifier);
+    auto dvCert = certificate(body("BYCVCA00001", "BYDV000001", dv.pubkey), cvca);
+    auto cvcaRef = bytes("BYCVCA00001");
+
+    CHECK(cache.validateChain({dvCert}, cvca.pubkey, cvcaRef, day(2027, 6, 15)) != boost::none);
+    CHECK(cache.validateChain({dvCert}, cvca.pubkey, cvcaRef, day(2026, 1, 1)) != boost::none);
+    CHECK(cache.validateChain({dvCert}, cvca.pubkey, cvcaRef, day(2029, 1, 1)) != boost::none);
+    CHECK(cache.validateChain({dvCert}, cvca.pubkey, cvcaRef, day(2029, 1, 2)) == boost::none);
+    CHECK(cache.validateChain({dvCert}, cvca.pubkey, cvcaRef, day(2025, 12, 31)) == boost::none);
+    CHECK(cache.validate(dvCert, cvca.pubkey).verified);
+
+    auto noDates = derEncode(0x7F4E,
+                             join({derEncode(0x42, bytes("BYCVCA00001")),
+                                   derEncode(0x7F49, derEncode(0x86, dv.pubkey)),
+                                   derEncode(0x5F20, bytes("BYDV000001"))}));
+    CHECK(cache.validateChain({certificate(noDates, cvca)}, cvca.pubkey, cvcaRef, day(2027, 6, 15)) == boost::none);
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+    TestKey cvca, dv, terminal;
+
+    parsesFields(cvca, dv);
+    rejectsMalformed(cvca, dv);
+    verifiesSignature(cvca, dv);
+    parsesDates();
+    validatesChain(cvca, dv, terminal);
+    checksReferences(cvca, dv, terminal);
+    checksDates(cvca, dv);
+
+    return checkResult("cvCertificate");
+}
@@ -0,0 +1,97 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <apducmd.h>
+#include <bpace.h>
+#include <cardsecure.h>
+#include <deadline.h>
+#include <transmitWorker.h>
+
+#include <thread>
+#include <vector>
+
+static const auto LATENCY = std::chrono::milliseconds(50);
+static const auto TIMEOUT = std::chrono::milliseconds(5);
+
+static std::vector<octet> selectApdu() {
+    return APDUEncode(APDU(Cla::Default, Instruction::FilesSelect, 0x04, 0x0C, {0x01, 0x01}));
+}
+
+static std::chrono::milliseconds since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+}
+
+// Abandoned exchanges keep running on their retired workers until the card answers
+static bool settled() {
+    auto start = std::chrono::steady_clock::now();
+    while (TransmitWorker::retired() != 0 && since(start) < std::chrono::seconds(2)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return TransmitWorker::retired() == 0;
+}
+
+static void expiredDeadlineSendsNothing() {
+    PCSC pcsc(simCard());
+    CHECK(pcsc.sendCommandToCard(selectApdu(), Deadline::after(std::chrono::milliseconds(0))).empty());
+    CHECK(pcsc.getLastError() == CardError::DeadlineExceeded);
+    CHECK(pcsc.getTransmitCount() == 0);
+}
+
+// The caller gets control back at the deadline or on cancel, not when the card answers, and the
+// session starts over on the next open()
+static void readStopsEarly(bool cancel) {
+    Bpace bpace(CAN, Pwd::CAN, simCard(LATENCY));
+    CardSecure card;
+    CHECK(connect(bpace, card));
+
+    auto deadline = cancel ? Deadline::after(std::chrono::seconds(10)) : Deadline::after(TIMEOUT);
+    std::thread canceller;
+    if (cancel) {
+        canceller = std::thread([deadline]() {
+            std::this_thread::sleep_for(TIMEOUT);
+            deadline.cancel();
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    CHECK(bpace.readEF(card, deadline).empty());
+    CHECK(since(start) < LATENCY - TIMEOUT);
+    CHECK(bpace.getLastError() == (cancel ? CardError::Cancelled : CardError::DeadlineExceeded));
+    if (canceller.joinable()) {
+        canceller.join();
+    }
+
+    CHECK(settled());
+    CardSecure reopened;
+    CHECK(connect(bpace, reopened));
+    CHECK(bpace.readEF(reopened).size() == 2048);
+}
+
+// Each abandoned exchange holds a retired worker, past the limit the reader is refused outright
+static void limitsAbandonedExchanges() {
+    PCSC pcsc(simCard(LATENCY));
+    for (size_t i = 0; i < TransmitWorker::MAX_RETIRED; ++i) {
+        CHECK(pcsc.sendCommandToCard(selectApdu(), Deadline::after(std::chrono::milliseconds(1))).empty());
+        CHECK(pcsc.getLastError() == CardError::DeadlineExceeded);
+    }
+    CHECK(TransmitWorker::retired() == TransmitWorker::MAX_RETIRED);
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK(pcsc.sendCommandToCard(selectApdu(), Deadline::after(std::chrono::seconds(1))).empty());
+    CHECK(pcsc.getLastError() == CardError::ReaderLost);
+    CHECK(since(start) < LATENCY);
+
+    CHECK(settled());
+    auto response = pcsc.sendCommandToCard(selectApdu(), Deadline::after(std::chrono::seconds(1)));
+    CHECK(response == std::vector<octet>({0x90, 0x00}));
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    expiredDeadlineSendsNothing();
+    readStopsEarly(false);
+    readStopsEarly(true);
+    limitsAbandonedExchanges();
+
+    return checkResult("deadline");
+}
@@ -0,0 +1,121 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <efCache.h>
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static const std::vector<octet> EF_ID = {0x01, 0x01};
+
+struct Read {
+    std::vector<octet> data;
+    uint64_t transmits = 0;
+};
+
+// Fresh session with a fresh simulated card holding efSize bytes, short APDUs only
+static Read readEF(size_t efSize) {
+    Read read;
+    Bpace bpace(CAN, Pwd::CAN, simCard(std::chrono::microseconds(0), efSize, false));
+    CardSecure card;
+    if (!connect(bpace, card)) {
+        return read;
+    }
+    uint64_t before = bpace.getPCSC().getTransmitCount();
+    read.data = bpace.readEF(card);
+    read.transmits = bpace.getPCSC().getTransmitCount() - before;
+    return read;
+}
+
+// Mappings of the process backed by files under dir
+static size_t mappings(const std::filesystem::path& dir) {
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    size_t count = 0;
+    while (std::getline(maps, line)) {
+        if (line.find(dir.string()) != std::string::npos) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static size_t entries(const std::filesystem::path& dir) {
+    std::error_code ec;
+    size_t count = 0;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator();
+         ++it) {
+        ++count;
+    }
+    return count;
+}
+
+int main() {
+    std::string dir = tempDirectory();
+    setenv("CARDLIB_CACHE_DIR", dir.c_str(), 1);
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+    auto efDir = std::filesystem::path(dir) / "ef";
+
+    // Not allowed: every read goes to the card and nothing is written
+    auto first = readEF(2048);
+    auto second = readEF(2048);
+    CHECK(simulated(first.data, 2048) && simulated(second.data, 2048));
+    CHECK(first.transmits > 2 && second.transmits == first.transmits);
+    CHECK(entries(efDir) == 0);
+
+    EfCache::getInstance()->allow(EF_ID);
+
+    // Miss: the head probe, then the whole file, which is stored
+    auto miss = readEF(2048);
+    CHECK(simulated(miss.data, 2048));
+    CHECK(miss.transmits == first.transmits + 1);
+    CHECK(entries(efDir) == 1);
+
+    // Hit: the head and tail probes only
+    auto hit = readEF(2048);
+    CHECK(simulated(hit.data, 2048));
+    CHECK(hit.transmits == 2);
+
+    // Same head but a shorter file: the tail probe fails and the card is read
+    auto shorter = readEF(1024);
+    CHECK(simulated(shorter.data, 1024));
+    CHECK(shorter.transmits > 2);
+
+    // The entry just stored is not mapped yet, corrupted on disk it is dropped and refilled from the card
+    for (auto& entry : std::filesystem::directory_iterator(efDir)) {
+        std::fstream file(entry.path(), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-1, std::ios::end);
+        char last = static_cast<char>(file.get() ^ 0x01);
+        file.seekp(-1, std::ios::end);
+        file.put(last);
+    }
+    auto corrupt = readEF(1024);
+    CHECK(simulated(corrupt.data, 1024));
+    CHECK(corrupt.transmits > 2 && entries(efDir) == 1);
+    CHECK(readEF(1024).transmits == 2);
+
+    // More entries than may stay mapped: the oldest are unmapped and mapped again when used
+    auto cache = EfCache::getInstance();
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < EfCache::MAX_MAPPED + 8; ++i) {
+        keys.push_back(EfCache::key("atr" + std::to_string(i), EF_ID, std::vector<octet>(EfCache::PROBE)));
+        CHECK(cache->store(keys.back(), std::vector<octet>(64, static_cast<octet>(i))));
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto found = cache->find(keys[i]);
+        CHECK(found != boost::none && found->size() == 64 && found->front() == static_cast<octet>(i));
+    }
+    CHECK(mappings(efDir) == EfCache::MAX_MAPPED);
+    auto oldest = cache->find(keys.front());
+    CHECK(oldest != boost::none && oldest->front() == 0);
+    CHECK(mappings(efDir) == EfCache::MAX_MAPPED);
+
+    std::filesystem::remove_all(dir);
+    return checkResult("efCache");
+}
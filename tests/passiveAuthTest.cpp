@@ -0,0 +1,191 @@
+#include "check.h"
+#include "simSession.h"
+#include "testKey.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <hasher.h>
+#include <passiveAuth.h>
+
+#include <vector>
+
+static const std::vector<octet> OID_BELT_HASH_DER = {0x2A, 0x70, 0x00, 0x02, 0x00, 0x22, 0x65, 0x1F, 0x51};
+static const std::vector<octet> OID_SIGNED_DATA = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02};
+static const std::vector<octet> OID_CONTENT_TYPE = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x03};
+static const std::vector<octet> OID_MESSAGE_DIGEST = {0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x09, 0x04};
+static const std::vector<octet> OID_LDS_SECURITY_OBJECT = {0x67, 0x81, 0x08, 0x01, 0x01, 0x01};
+
+static const size_t CHUNK = 256;
+
+static const std::vector<octet> FID_DG1 = {0x01, 0x01};
+static const std::vector<octet> FID_DG2 = {0x01, 0x02};
+static const std::vector<octet> FID_SOD = {0x01, 0x1D};
+
+static std::vector<octet> join(std::initializer_list<std::vector<octet>> parts) {
+    std::vector<octet> res;
+    for (auto& part : parts) {
+        res.insert(res.end(), part.begin(), part.end());
+    }
+    return res;
+}
+
+static std::vector<octet> hash(const std::vector<octet>& data) {
+    Hasher hasher;
+    hasher.update(data.data(), data.size());
+    return hasher.finish();
+}
+
+static std::vector<octet> groupHash(int group, const std::vector<octet>& data) {
+    return derEncode(0x30, join({derEncode(0x02, {static_cast<octet>(group)}), derEncode(0x04, hash(data))}));
+}
+
+// EF.SOD over two data groups, the signer signs the signed attributes carrying the content digest
+static std::vector<octet> securityObject(const std::vector<octet>& dg1, const std::vector<octet>& dg2,
+                                         const TestKey& signer) {
+    auto algorithm = derEncode(0x30, derEncode(0x06, OID_BELT_HASH_DER));
+    auto lds = derEncode(0x30, join({derEncode(0x02, {0x00}), algorithm,
+                                     derEncode(0x30, join({groupHash(1, dg1), groupHash(2, dg2)}))}));
+    auto attrs = join({derEncode(0x30, join({derEncode(0x06, OID_CONTENT_TYPE),
+                                             derEncode(0x31, derEncode(0x06, OID_LDS_SECURITY_OBJECT))})),
+                       derEncode(0x30, join({derEncode(0x06, OID_MESSAGE_DIGEST),
+                                             derEncode(0x31, derEncode(0x04, hash(lds)))}))});
+    auto signature = signer.sign(hash(derEncode(0x31, attrs)));
+    auto signerInfo = derEncode(0x30, join({derEncode(0x02, {0x01}), derEncode(0x80, {0x01, 0x02, 0x03}), algorithm,
+                                            derEncode(0xA0, attrs), algorithm, derEncode(0x04, signature)}));
+    auto signedData = derEncode(0x30, join({derEncode(0x02, {0x03}), derEncode(0x31, algorithm),
+                                            derEncode(0x30, join({derEncode(0x06, OID_LDS_SECURITY_OBJECT),
+                                                                  derEncode(0xA0, derEncode(0x04, lds))})),
+                                            derEncode(0x31, signerInfo)}));
+    return derEncode(0x77, derEncode(0x30, join({derEncode(0x06, OID_SIGNED_DATA), derEncode(0xA0, signedData)})));
+}
+
+// DG1 is the EF of the simulated card, read over BPACE and SM
+static std::vector<octet> readDataGroup() {
+    Bpace bpace(CAN, Pwd::CAN, simCard(std::chrono::microseconds(0), 700, false));
+    CardSecure card;
+    if (!connect(bpace, card)) {
+        return {};
+    }
+    return bpace.readEF(card);
+}
+
+static void stream(PassiveAuthenticator& auth, int group, const std::vector<octet>& data, size_t from = 0) {
+    for (size_t offset = from; offset < data.size(); offset += CHUNK) {
+        auth.update(group, offset, std::span<const octet>(data).subspan(offset, std::min(CHUNK, data.size() - offset)));
+    }
+}
+
+static void parsesSecurityObject(const std::vector<octet>& sod) {
+    auto object = SecurityObject::parse(sod);
+    CHECK(object != boost::none);
+    if (object == boost::none) {
+        return;
+    }
+    CHECK(object->groupHash == HashAlg::BeltHash && object->digestHash == HashAlg::BeltHash);
+    CHECK(object->digestOid == OID_BELT_HASH);
+    CHECK(object->groupHashes.size() == 2 && object->groupHashes.count(1) == 1 && object->groupHashes.count(2) == 1);
+    CHECK(object->signature.size() == 48);
+    CHECK(!object->signedAttrs.empty() && object->messageDigest.size() == 32);
+
+    CHECK(SecurityObject::parse(std::span<const octet>(sod).first(sod.size() - 1)) == boost::none);
+    CHECK(SecurityObject::parse(std::vector<octet>{0x77, 0x02, 0x30, 0x00}) == boost::none);
+}
+
+static void checksDataGroups(const std::vector<octet>& sod, const TestKey& signer, const std::vector<octet>& dg1,
+                             const std::vector<octet>& dg2) {
+    SignatureVerifier verifier(2);
+    PassiveAuthenticator auth(verifier, 2);
+    CHECK(auth.load(sod, signer.pubkey));
+    CHECK(auth.signatureValid());
+
+    CHECK(auth.check(1, dg1) && auth.check(2, dg2));
+    auto changed = dg2;
+    changed[3] ^= 0x01;
+    CHECK(!auth.check(2, changed));
+    CHECK(!auth.check(3, dg2));
+    CHECK(auth.checkBatch({{1, dg1}, {2, changed}, {2, dg2}}) == std::vector<bool>({true, false, true}));
+
+    // Streamed reads: in order, restarted from 0, with a gap, and never read
+    stream(auth, 1, dg1);
+    CHECK(auth.checkRead(1));
+    stream(auth, 1, std::vector<octet>(dg1.begin(), dg1.begin() + 300));
+    stream(auth, 1, dg1);
+    CHECK(auth.checkRead(1));
+    auth.update(2, 0, std::span<const octet>(dg2).first(10));
+    auth.update(2, 20, std::span<const octet>(dg2).subspan(20));
+    CHECK(!auth.checkRead(2));
+    CHECK(!auth.checkRead(2));
+    // Streaming a different DG1 than the one checked does not let check() pass on the stream
+    stream(auth, 1, dg1);
+    auto other = dg1;
+    other[0] ^= 0x01;
+    CHECK(!auth.check(1, other));
+}
+
+static void rejectsBadSignature(const std::vector<octet>& sod, const TestKey& signer, const TestKey& other,
+                                const std::vector<octet>& dg2) {
+    SignatureVerifier verifier(2);
+    PassiveAuthenticator auth(verifier, 2);
+    CHECK(auth.load(sod, other.pubkey));
+    CHECK(!auth.signatureValid() && !auth.check(2, dg2));
+
+    auto tampered = sod;
+    tampered[tampered.size() - 1] ^= 0x01;
+    CHECK(auth.load(tampered, signer.pubkey));
+    CHECK(!auth.signatureValid());
+
+    CHECK(!auth.load(std::vector<octet>(sod.begin(), sod.begin() + 20), signer.pubkey));
+    CHECK(!auth.signatureValid() && !auth.check(2, dg2));
+}
+
+// EF.SOD and both data groups selected by file id on the card, the data groups checked as they are
+// read. The second card holds a DG2 the security object does not cover.
+static bool readsFromCard(const std::vector<octet>& sod, const TestKey& signer, const std::vector<octet>& dg2) {
+    auto sim = simCard(std::chrono::microseconds(0), 700, false);
+    sim->setEF(FID_DG2, dg2);
+    sim->setEF(FID_SOD, sod);
+    Bpace bpace(CAN, Pwd::CAN, sim);
+    CardSecure card;
+    CHECK(authorize(bpace, card));
+    CHECK(bpace.chooseEF(card, FID_SOD));
+    auto read = bpace.readEF(card);
+    CHECK(read == sod);
+
+    SignatureVerifier verifier(2);
+    PassiveAuthenticator auth(verifier, 2);
+    CHECK(auth.load(read, signer.pubkey));
+    int group = 0;
+    bpace.setReadObserver([&](size_t offset, std::span<const octet> chunk) { auth.update(group, offset, chunk); });
+    group = 2;
+    CHECK(bpace.chooseEF(card, FID_DG2) && bpace.readEF(card) == dg2);
+    bool dg2Valid = auth.checkRead(2);
+    group = 1;
+    CHECK(bpace.chooseEF(card, FID_DG1) && simulated(bpace.readEF(card), 700));
+    CHECK(auth.checkRead(1));
+    CHECK(!bpace.chooseEF(card, {0x01, 0x0F}));
+    CHECK(auth.signatureValid());
+    return dg2Valid;
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+    TestKey signer, other;
+
+    auto dg1 = readDataGroup();
+    CHECK(dg1.size() == 700);
+    std::vector<octet> dg2(50);
+    for (size_t i = 0; i < dg2.size(); ++i) {
+        dg2[i] = static_cast<octet>(3 * i);
+    }
+    auto sod = securityObject(dg1, dg2, signer);
+
+    parsesSecurityObject(sod);
+    checksDataGroups(sod, signer, dg1, dg2);
+    rejectsBadSignature(sod, signer, other, dg2);
+    CHECK(readsFromCard(sod, signer, dg2));
+    auto changed = dg2;
+    changed[0] ^= 0x01;
+    CHECK(!readsFromCard(sod, signer, changed));
+
+    return checkResult("passiveAuth");
+}
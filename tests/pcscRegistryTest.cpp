@@ -0,0 +1,197 @@
+#include "check.h"
+
+#include <deadline.h>
+#include <pcsc.h>
+#include <pcscRegistry.h>
+#include <transmitWorker.h>
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One reader with a card that has no reader properties. The PC/SC calls made by the library are
+// answered here, these definitions take precedence over the ones in libpcsclite. A new reader
+// model gives a connection the capability cache has not seen.
+static const octet CARD_ATR[] = {0x3B, 0x00};
+
+static std::atomic<int> connections{0};
+static std::atomic<long> lastDisposition{-1};
+static std::atomic<int> transmitDelayMs{0};
+static std::atomic<DWORD> protocol{SCARD_PROTOCOL_T0};
+static std::atomic<int> readerIndex{0};
+static std::atomic<uint16_t> probeStatus{0x9000};
+static std::mutex commandsMutex;
+static std::vector<std::vector<octet>> commands;
+
+static std::string readers() {
+    std::string name = "Test Reader R" + std::to_string(readerIndex.load()) + " 00 00";
+    return name + '\0' + '\0';
+}
+
+extern "C" {
+
+LONG SCardEstablishContext(DWORD, LPCVOID, LPCVOID, LPSCARDCONTEXT phContext) {
+    *phContext = 1;
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardReleaseContext(SCARDCONTEXT) {
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardListReaders(SCARDCONTEXT, LPCSTR, LPSTR mszReaders, LPDWORD pcchReaders) {
+    auto names = readers();
+    if (mszReaders != NULL) {
+        std::memcpy(mszReaders, names.data(), std::min<DWORD>(*pcchReaders, names.size()));
+    }
+    *pcchReaders = names.size();
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardConnect(SCARDCONTEXT, LPCSTR, DWORD, DWORD, LPSCARDHANDLE phCard, LPDWORD pdwActiveProtocol) {
+    *phCard = ++connections;
+    *pdwActiveProtocol = protocol;
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardReconnect(SCARDHANDLE, DWORD, DWORD, DWORD, LPDWORD pdwActiveProtocol) {
+    *pdwActiveProtocol = protocol;
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardDisconnect(SCARDHANDLE, DWORD dwDisposition) {
+    lastDisposition = dwDisposition;
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardStatus(SCARDHANDLE, LPSTR, LPDWORD, LPDWORD pdwState, LPDWORD pdwProtocol, LPBYTE pbAtr,
+                 LPDWORD pcbAtrLen) {
+    *pdwState = SCARD_PRESENT;
+    *pdwProtocol = protocol;
+    std::memcpy(pbAtr, CARD_ATR, sizeof(CARD_ATR));
+    *pcbAtrLen = sizeof(CARD_ATR);
+    return SCARD_S_SUCCESS;
+}
+
+LONG SCardControl(SCARDHANDLE, DWORD, LPCVOID, DWORD, LPVOID, DWORD, LPDWORD) {
+    return SCARD_E_UNSUPPORTED_FEATURE;
+}
+
+// The extended READ BINARY probe gets probeStatus, anything else 90 00
+LONG SCardTransmit(SCARDHANDLE, const SCARD_IO_REQUEST*, LPCBYTE pbSendBuffer, DWORD cbSendLength,
+                   SCARD_IO_REQUEST*, LPBYTE pbRecvBuffer, LPDWORD pcbRecvLength) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(transmitDelayMs.load()));
+    std::vector<octet> command(pbSendBuffer, pbSendBuffer + cbSendLength);
+    {
+        std::lock_guard<std::mutex> lock(commandsMutex);
+        commands.push_back(command);
+    }
+    uint16_t status = command.size() == 7 && command[1] == 0xB0 ? probeStatus.load() : 0x9000;
+    pbRecvBuffer[0] = static_cast<BYTE>(status >> 8);
+    pbRecvBuffer[1] = static_cast<BYTE>(status);
+    *pcbRecvLength = 2;
+    return SCARD_S_SUCCESS;
+}
+}
+
+static const std::vector<octet> SELECT_MF = {0x00, 0xA4, 0x00, 0x00, 0x02, 0x3F, 0x00};
+
+static bool settled() {
+    auto start = std::chrono::steady_clock::now();
+    while (TransmitWorker::retired() != 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return TransmitWorker::retired() == 0;
+}
+
+// The last reference leaves the card as is, unless the handle was abandoned
+static void releaseDisposition() {
+    auto registry = PcscRegistry::getInstance();
+    std::shared_ptr<CardHandle> handle;
+    CHECK(registry->connect("", handle) == SCARD_S_SUCCESS && handle != nullptr);
+    handle.reset();
+    CHECK(lastDisposition == SCARD_LEAVE_CARD);
+
+    CHECK(registry->connect("", handle) == SCARD_S_SUCCESS && handle != nullptr);
+    handle->abandon();
+    CHECK(!handle->isValid());
+    std::shared_ptr<CardHandle> next;
+    CHECK(registry->connect("", next) == SCARD_S_SUCCESS && next != handle);
+    handle.reset();
+    CHECK(lastDisposition == SCARD_RESET_CARD);
+    next.reset();
+    CHECK(lastDisposition == SCARD_LEAVE_CARD);
+}
+
+// An exchange given up on keeps its worker until the card answers, the card is reset once it has
+static void abandonedExchangeResetsCard() {
+    PCSC pcsc;
+    CHECK(pcsc.connect() == SCARD_S_SUCCESS);
+    CHECK(pcsc.sendCommandToCard(SELECT_MF).size() == 2);
+
+    lastDisposition = -1;
+    transmitDelayMs = 100;
+    auto start = std::chrono::steady_clock::now();
+    CHECK(pcsc.sendCommandToCard(SELECT_MF, Deadline::after(std::chrono::milliseconds(5))).empty());
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(80));
+    CHECK(pcsc.getLastError() == CardError::DeadlineExceeded);
+    CHECK(TransmitWorker::retired() == 1 && lastDisposition == -1);
+
+    CHECK(settled());
+    CHECK(lastDisposition == SCARD_RESET_CARD);
+
+    transmitDelayMs = 0;
+    CHECK(pcsc.sendCommandToCard(SELECT_MF).size() == 2);
+}
+
+// On T=1 without reader properties the card is probed with a READ BINARY, which does not change
+// its selection. Only statuses given after the extended length was parsed mean support.
+static bool probedExtended(uint16_t status) {
+    protocol = SCARD_PROTOCOL_T1;
+    probeStatus = status;
+    readerIndex++;
+    {
+        std::lock_guard<std::mutex> lock(commandsMutex);
+        commands.clear();
+    }
+    PCSC pcsc;
+    CHECK(pcsc.connect() == SCARD_S_SUCCESS);
+    std::lock_guard<std::mutex> lock(commandsMutex);
+    CHECK(commands.size() == 1);
+    for (auto& command : commands) {
+        CHECK(command[1] != 0xA4);
+    }
+    return pcsc.getLimits().extended;
+}
+
+static void extendedProbe() {
+    CHECK(probedExtended(0x9000));
+    CHECK(probedExtended(0x6282));
+    CHECK(probedExtended(0x6A82));
+    CHECK(!probedExtended(0x6700));
+    CHECK(!probedExtended(0x6E00));
+    CHECK(!probedExtended(0x6986));
+    CHECK(!probedExtended(0x6A86));
+    CHECK(!probedExtended(0x6F00));
+    protocol = SCARD_PROTOCOL_T0;
+}
+
+int main() {
+    std::string dir = tempDirectory();
+    setenv("CARDLIB_CACHE_DIR", dir.c_str(), 1);
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    releaseDisposition();
+    abandonedExchangeResetsCard();
+    extendedProbe();
+
+    std::filesystem::remove_all(dir);
+    return checkResult("pcscRegistry");
+}
@@ -0,0 +1,120 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <readCheckpoint.h>
+
+#include <mutex>
+#include <vector>
+
+static const size_t EF_SIZE = 2048;
+static const size_t FAIL_FROM = 1024;
+
+// Simulated card whose link drops for good once a READ BINARY reaches FAIL_FROM, until disarmed.
+// READ BINARY headers stay in clear under SM, so the offsets asked for are recorded.
+class FlakyCard : public CardTransport {
+public:
+    std::vector<octet> transmit(const std::vector<octet>& cmd) override {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (cmd.size() >= 4 && cmd[1] == static_cast<octet>(Instruction::ReadBinary)) {
+                size_t offset = ((cmd[2] & 0x7F) << 8) | cmd[3];
+                this->offsets.push_back(offset);
+                this->dropped = this->dropped || (this->armed && offset >= FAIL_FROM);
+            }
+            if (this->dropped) {
+                return {};
+            }
+        }
+        return this->card.transmit(cmd);
+    }
+
+    ApduLimits getLimits() override {
+        return this->card.getLimits();
+    }
+
+    boost::optional<ATR> getATR() override {
+        return this->card.getATR();
+    }
+
+    int reconnect(bool reset) override {
+        return this->card.reconnect(reset);
+    }
+
+    void disarm() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->armed = false;
+        this->dropped = false;
+        this->offsets.clear();
+    }
+
+    std::vector<size_t> readOffsets() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->offsets;
+    }
+
+private:
+    SimCard card{CAN, std::chrono::microseconds(0), EF_SIZE, false};
+    std::mutex mutex;
+    bool armed = true;
+    bool dropped = false;
+    std::vector<size_t> offsets;
+};
+
+// The read breaks half way and cannot be recovered, the next read of the same EF continues from there
+static void resumesInterruptedRead() {
+    auto flaky = std::make_shared<FlakyCard>();
+    Bpace bpace(CAN, Pwd::CAN, flaky);
+    CardSecure card;
+    CHECK(connect(bpace, card));
+    CHECK(bpace.readEF(card).empty());
+
+    flaky->disarm();
+    CardSecure resumed;
+    CHECK(connect(bpace, resumed));
+    CHECK(simulated(bpace.readEF(resumed), EF_SIZE));
+
+    auto offsets = flaky->readOffsets();
+    // The first read confirms the end of the kept prefix, which holds every chunk before the drop
+    CHECK(!offsets.empty() && offsets.front() + ReadCheckpoint::OVERLAP >= FAIL_FROM);
+    for (auto offset : offsets) {
+        CHECK(offset >= offsets.front());
+    }
+
+    // The checkpoint is used once, a further read starts at the beginning
+    flaky->disarm();
+    CHECK(simulated(bpace.readEF(resumed), EF_SIZE));
+    offsets = flaky->readOffsets();
+    CHECK(!offsets.empty() && offsets.front() == 0);
+}
+
+static void dropsMismatchedCheckpoint() {
+    std::vector<octet> prefix(100);
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        prefix[i] = static_cast<octet>(i);
+    }
+    ReadCheckpoint checkpoint;
+    checkpoint.save("3B8080010101", {0x01, 0x01}, prefix);
+    CHECK(checkpoint.overlap("3B8080010102", {0x01, 0x01}) == boost::none);
+    CHECK(checkpoint.overlap("3B8080010101", {0x01, 0x02}) == boost::none);
+
+    auto overlap = checkpoint.overlap("3B8080010101", {0x01, 0x01});
+    CHECK(overlap != boost::none && overlap->first == 84 && overlap->second == ReadCheckpoint::OVERLAP);
+    std::vector<octet> changed(prefix.end() - ReadCheckpoint::OVERLAP, prefix.end());
+    changed[0] ^= 0x01;
+    CHECK(checkpoint.resume(changed).empty());
+    CHECK(checkpoint.overlap("3B8080010101", {0x01, 0x01}) == boost::none);
+
+    checkpoint.save("3B8080010101", {0x01, 0x01}, prefix);
+    CHECK(checkpoint.resume(std::vector<octet>(prefix.end() - ReadCheckpoint::OVERLAP, prefix.end())) == prefix);
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    resumesInterruptedRead();
+    dropsMismatchedCheckpoint();
+
+    return checkResult("readCheckpoint");
+}
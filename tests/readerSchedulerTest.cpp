@@ -0,0 +1,125 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <apducmd.h>
+#include <readerScheduler.h>
+
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static const auto LATENCY = std::chrono::microseconds(1000);
+
+// Simulated card recording the P1 (session) and P2 (sequence) of every SELECT in arrival order
+class RecordingCard : public CardTransport {
+public:
+    std::vector<octet> transmit(const std::vector<octet>& cmd) override {
+        if (cmd.size() >= 4) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->exchanges.emplace_back(cmd[2], cmd[3]);
+        }
+        return this->card.transmit(cmd);
+    }
+
+    boost::optional<ATR> getATR() override {
+        return this->card.getATR();
+    }
+
+    std::vector<std::pair<octet, octet>> recorded() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->exchanges;
+    }
+
+private:
+    SimCard card{CAN, LATENCY};
+    std::mutex mutex;
+    std::vector<std::pair<octet, octet>> exchanges;
+};
+
+static bool select(ScheduledTransport& transport, octet session, octet sequence) {
+    auto response = transport.transmit(APDUEncode(APDU(Cla::Default, Instruction::FilesSelect, session, sequence)));
+    return response == std::vector<octet>({0x90, 0x00});
+}
+
+// Sessions queued behind a held reader go by priority, not by arrival
+static void interactiveGoesFirst() {
+    auto card = std::make_shared<RecordingCard>();
+    auto scheduler = ReaderScheduler::create(std::make_shared<PCSC>(card));
+    auto holder = scheduler->session(ReaderScheduler::Priority::Normal);
+
+    std::vector<std::thread> threads;
+    holder->hold();
+    for (octet i = 0; i < 3; ++i) {
+        auto background = scheduler->session(ReaderScheduler::Priority::Background);
+        threads.emplace_back([background, i]() { CHECK(select(*background, 2, i)); });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (octet i = 0; i < 3; ++i) {
+        auto interactive = scheduler->session(ReaderScheduler::Priority::Interactive);
+        threads.emplace_back([interactive, i]() { CHECK(select(*interactive, 1, i)); });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    holder->release();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto recorded = card->recorded();
+    CHECK(recorded.size() == 6);
+    for (size_t i = 0; i < recorded.size(); ++i) {
+        CHECK(recorded[i].first == (i < 3 ? 1 : 2));
+    }
+}
+
+// Two busy sessions of one class share the reader by weight, each keeps its own order
+static void weightedShare() {
+    auto card = std::make_shared<RecordingCard>();
+    auto scheduler = ReaderScheduler::create(std::make_shared<PCSC>(card));
+    auto heavy = scheduler->session(ReaderScheduler::Priority::Normal, 3);
+    auto light = scheduler->session(ReaderScheduler::Priority::Normal, 1);
+
+    const size_t exchanges = 120;
+    auto run = [&](ScheduledTransport& transport, octet session) {
+        for (size_t i = 0; i < exchanges; ++i) {
+            CHECK(select(transport, session, static_cast<octet>(i)));
+        }
+    };
+    std::thread heavyThread(run, std::ref(*heavy), 1);
+    std::thread lightThread(run, std::ref(*light), 2);
+    heavyThread.join();
+    lightThread.join();
+
+    auto recorded = card->recorded();
+    CHECK(recorded.size() == 2 * exchanges);
+    octet expected[3] = {0, 0, 0};
+    size_t heavyFirst = 0;
+    for (size_t i = 0; i < recorded.size(); ++i) {
+        auto [session, sequence] = recorded[i];
+        CHECK(sequence == expected[session]++);
+        // While both are busy the heavy session gets about three exchanges for every light one
+        if (i < exchanges && session == 1) {
+            heavyFirst++;
+        }
+    }
+    CHECK(heavyFirst >= exchanges * 2 / 3 && heavyFirst <= exchanges * 5 / 6);
+}
+
+// The ATR of the shared reader reaches a session's connection
+static void forwardsATR() {
+    auto card = std::make_shared<RecordingCard>();
+    auto scheduler = ReaderScheduler::create(std::make_shared<PCSC>(card));
+    PCSC session(scheduler->session(ReaderScheduler::Priority::Normal));
+    CHECK(session.connect() == 0);
+    CHECK(session.getATR() != boost::none && session.getATR()->toHex() == card->getATR()->toHex());
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    interactiveGoesFirst();
+    weightedShare();
+    forwardsATR();
+
+    return checkResult("readerScheduler");
+}
@@ -0,0 +1,197 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static const size_t EF_SIZE = 2048;
+static const std::vector<octet> FID_OTHER = {0x01, 0x02};
+
+// What happens to the READ BINARY a fault is armed for: the link drops it, the card answers with
+// a broken MAC, or the card lost its keys (as after a reset) and answers 69 88 in clear
+enum class Fault { None, Drop, Corrupt, LoseState };
+
+// Simulated card that fails one READ BINARY on request and records the reconnects asked for.
+// READ BINARY and SELECT headers stay in clear under SM.
+class FaultyCard : public CardTransport {
+public:
+    std::vector<octet> transmit(const std::vector<octet>& cmd) override {
+        Fault fault = Fault::None;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (cmd.size() >= 4 && cmd[1] == static_cast<octet>(Instruction::ReadBinary) && this->armed != Fault::None &&
+                this->skip-- == 0) {
+                fault = this->armed;
+                this->armed = Fault::None;
+            }
+            if (cmd.size() > 7 && (cmd[0] & 0x0C) == 0 && cmd[1] == static_cast<octet>(Instruction::FilesSelect) &&
+                cmd[2] == 0x04) {
+                this->appletSelects++;
+            }
+            if (cmd.size() >= 4 && cmd[1] == static_cast<octet>(Instruction::BPACEInit)) {
+                this->handshakes++;
+            }
+        }
+        if (fault == Fault::Drop) {
+            return {};
+        }
+        if (fault == Fault::LoseState) {
+            this->card.reconnect(true);
+        }
+        auto response = this->card.transmit(cmd);
+        // The MAC ends just before the status words
+        if (fault == Fault::Corrupt && response.size() > 2) {
+            response[response.size() - 3] ^= 0x01;
+        }
+        return response;
+    }
+
+    ApduLimits getLimits() override {
+        return this->card.getLimits();
+    }
+
+    boost::optional<ATR> getATR() override {
+        return this->card.getATR();
+    }
+
+    int reconnect(bool reset) override {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->reconnects.push_back(reset);
+        }
+        return this->card.reconnect(reset);
+    }
+
+    // Fails the READ BINARY after the next skip ones
+    void arm(Fault fault, size_t skip) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->armed = fault;
+        this->skip = skip;
+    }
+
+    // The card loses BPACE and SM as on a warm reset, without the host being told
+    void reset() {
+        this->card.reconnect(true);
+    }
+
+    bool fired() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->armed == Fault::None;
+    }
+
+    std::vector<bool> takeReconnects() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return std::exchange(this->reconnects, {});
+    }
+
+    size_t takeAppletSelects() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return std::exchange(this->appletSelects, 0);
+    }
+
+    size_t takeHandshakes() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return std::exchange(this->handshakes, 0);
+    }
+
+    SimCard card{CAN, 0us, EF_SIZE, false};
+
+private:
+    std::mutex mutex;
+    Fault armed = Fault::None;
+    size_t skip = 0;
+    std::vector<bool> reconnects;
+    size_t appletSelects = 0;
+    size_t handshakes = 0;
+};
+
+static void classifiesResults() {
+    CHECK(PCSC::classify(SCARD_S_SUCCESS) == CardError::None);
+    CHECK(PCSC::classify(SCARD_E_TIMEOUT) == CardError::Timeout);
+    CHECK(PCSC::classify(SCARD_E_CANCELLED) == CardError::Cancelled);
+    CHECK(PCSC::classify(SCARD_W_RESET_CARD) == CardError::CardReset);
+    CHECK(PCSC::classify(SCARD_W_REMOVED_CARD) == CardError::CardRemoved);
+    CHECK(PCSC::classify(SCARD_E_NO_SMARTCARD) == CardError::CardRemoved);
+    CHECK(PCSC::classify(SCARD_W_UNRESPONSIVE_CARD) == CardError::CardRemoved);
+    CHECK(PCSC::classify(SCARD_E_NO_SERVICE) == CardError::ReaderLost);
+    CHECK(PCSC::classify(SCARD_E_READER_UNAVAILABLE) == CardError::ReaderLost);
+    CHECK(PCSC::classify(SCARD_E_INVALID_HANDLE) == CardError::ReaderLost);
+    CHECK(PCSC::classify(SCARD_F_COMM_ERROR) == CardError::Transport);
+}
+
+// A read that fails on its first chunk or in the read-ahead is recovered and re-sent, the data
+// comes back whole and the session goes on
+static void recoversRead(Fault fault, size_t skip, std::vector<bool> reconnects) {
+    auto faulty = std::make_shared<FaultyCard>();
+    Bpace bpace(CAN, Pwd::CAN, faulty);
+    CardSecure card;
+    CHECK(connect(bpace, card));
+    faulty->takeReconnects();
+    faulty->takeHandshakes();
+
+    faulty->arm(fault, skip);
+    CHECK(simulated(bpace.readEF(card), EF_SIZE));
+    CHECK(faulty->fired());
+    CHECK(faulty->takeReconnects() == reconnects);
+    CHECK(faulty->takeHandshakes() == 1);
+
+    faulty->card.setEF(FID_OTHER, std::vector<octet>(300, 0x3C));
+    CHECK(bpace.chooseEF(card, FID_OTHER) && bpace.readEF(card) == std::vector<octet>(300, 0x3C));
+}
+
+// The failed exchange is reported when the command may not be sent twice, the session is restored
+static void keepsNonIdempotent() {
+    auto faulty = std::make_shared<FaultyCard>();
+    Bpace bpace(CAN, Pwd::CAN, faulty);
+    CardSecure card;
+    CHECK(connect(bpace, card));
+
+    faulty->arm(Fault::Corrupt, 0);
+    APDU read(Cla::Default, Instruction::ReadBinary, 0x00, 0x00, {}, 16);
+    CHECK(bpace.transmitSecure(card, read, false) == boost::none);
+    CHECK(bpace.getLastError() == CardError::SecureMessaging);
+    auto plain = bpace.transmitSecure(card, read, true);
+    CHECK(plain != boost::none && plain->size() == 18);
+    CHECK(simulated(bpace.readEF(card), EF_SIZE));
+}
+
+// A reset or a removed and reinserted card loses BPACE, SM and the selections. Recovery reconnects
+// the way the error calls for, selects the applet, runs BPACE again and selects the current EF.
+static void recoversCardEvent(CardError error, bool reset) {
+    auto faulty = std::make_shared<FaultyCard>();
+    Bpace bpace(CAN, Pwd::CAN, faulty);
+    CardSecure card;
+    CHECK(connect(bpace, card));
+    faulty->takeReconnects();
+    faulty->takeAppletSelects();
+    faulty->takeHandshakes();
+
+    faulty->reset();
+    CHECK(bpace.recover(error, card));
+    CHECK(faulty->takeReconnects() == std::vector<bool>({reset}));
+    CHECK(faulty->takeAppletSelects() == 1 && faulty->takeHandshakes() == 1);
+    CHECK(simulated(bpace.readEF(card), EF_SIZE));
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+
+    classifiesResults();
+    recoversRead(Fault::Drop, 0, {false});
+    recoversRead(Fault::Drop, 3, {false});
+    recoversRead(Fault::Corrupt, 0, {});
+    recoversRead(Fault::Corrupt, 3, {});
+    recoversRead(Fault::LoseState, 0, {});
+    recoversRead(Fault::LoseState, 3, {});
+    keepsNonIdempotent();
+    recoversCardEvent(CardError::CardReset, false);
+    recoversCardEvent(CardError::CardRemoved, true);
+
+    return checkResult("recovery");
+}
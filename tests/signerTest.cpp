@@ -0,0 +1,71 @@
+#include "check.h"
+#include "simSession.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <hasher.h>
+#include <signer.h>
+#include <verifier.h>
+
+#include <vector>
+
+static std::vector<octet> digest(octet seed) {
+    std::vector<octet> digest(32);
+    for (size_t i = 0; i < digest.size(); ++i) {
+        digest[i] = static_cast<octet>(seed + i);
+    }
+    return digest;
+}
+
+static bool signs(SignatureVerifier& verifier, const std::vector<octet>& pubkey, const std::vector<octet>& hash,
+                  const boost::optional<std::vector<octet>>& signature) {
+    if (signature == boost::none) {
+        return false;
+    }
+    VerifyRequest request;
+    request.pubkey = pubkey;
+    request.hash = hash;
+    request.signature = signature.get();
+    return verifier.verify(request);
+}
+
+int main() {
+    Logger::getInstance()->setLogPreferences("", LogLevel::NONE, LogOutput::CONSOLE);
+    auto sim = simCard();
+    auto pubkey = sim->getPublicKey();
+    SignatureVerifier verifier(2);
+
+    Bpace bpace(CAN, Pwd::CAN, sim);
+    CardSecure card;
+    CHECK(authorize(bpace, card));
+    Signer signer(bpace.getPCSC(), card);
+
+    auto signatures = signer.signDigests({digest(0), digest(1)});
+    CHECK(signatures.size() == 2);
+    CHECK(signs(verifier, pubkey, digest(0), signatures[0]) && signs(verifier, pubkey, digest(1), signatures[1]));
+
+    // Empty digests are skipped, the rest of the batch is signed
+    signatures = signer.signDigests({digest(2), {}, digest(3)});
+    CHECK(signatures[0] != boost::none && signatures[1] == boost::none && signatures[2] != boost::none);
+
+    // The card rejects the short digest: what came before is kept, the batch stops there
+    auto shortDigest = digest(5);
+    shortDigest.pop_back();
+    signatures = signer.signDigests({digest(4), shortDigest, digest(6)});
+    CHECK(signatures.size() == 3);
+    CHECK(signs(verifier, pubkey, digest(4), signatures[0]));
+    CHECK(signatures[1] == boost::none && signatures[2] == boost::none);
+
+    // The SM counters are still in step after the failure
+    CHECK(signs(verifier, pubkey, digest(6), signer.sign(digest(6))));
+
+    std::vector<octet> document(1000, 0x5A);
+    Hasher hasher;
+    hasher.update(document.data(), document.size());
+    signatures = signer.signDocuments({document});
+    CHECK(signs(verifier, pubkey, hasher.finish(), signatures[0]));
+
+    CHECK(bpace.chooseEF(card) && bpace.readEF(card).size() == 2048);
+
+    return checkResult("signer");
+}
@@ -0,0 +1,48 @@
+#ifndef SIMSESSION_H
+#define SIMSESSION_H
+
+#include "simCard.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Sessions with the simulated card shared by the tests
+inline constexpr const char* CAN = "334780";
+
+inline std::shared_ptr<SimCard> simCard(std::chrono::microseconds latency = std::chrono::microseconds(0),
+                                        size_t efSize = 2048, bool extended = true) {
+    return std::make_shared<SimCard>(CAN, latency, efSize, extended);
+}
+
+// BPACE with the CAN, then SM with the session key
+inline bool authorize(Bpace& bpace, CardSecure& card) {
+    if (bpace.open() != ERR_OK || !bpace.authorize()) {
+        return false;
+    }
+    card.initSecure(bpace.getKey().data());
+    return true;
+}
+
+// Authorized with the EF selected, ready for readEF
+inline bool connect(Bpace& bpace, CardSecure& card) {
+    return authorize(bpace, card) && bpace.chooseEF(card);
+}
+
+// The simulated EF holds the low byte of each offset
+inline bool simulated(const std::vector<octet>& data, size_t size) {
+    if (data.size() != size) {
+        return false;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != static_cast<octet>(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef TESTKEY_H
+#define TESTKEY_H
+
+#include <bee2/crypto/bign.h>
+#include <bee2/defs.h>
+
+#include <randomPool.h>
+#include <verifier.h>
+
+#include <vector>
+
+// bign key pair on the 128-bit curve, for signing certificates and security objects in tests
+struct TestKey {
+    bign_params params{};
+    std::vector<octet> privkey = std::vector<octet>(32);
+    std::vector<octet> pubkey = std::vector<octet>(64);
+
+    TestKey() {
+        bignParamsStd(&this->params, "1.2.112.0.2.0.34.101.45.3.1");
+        bignKeypairGen(this->privkey.data(), this->pubkey.data(), &this->params, RandomPool::stepR, nullptr);
+    }
+
+    std::vector<octet> sign(const std::vector<octet>& hash, const char* oid = OID_BELT_HASH) const {
+        octet der[128];
+        size_t len = sizeof(der);
+        std::vector<octet> signature(48);
+        bignOidToDER(der, &len, oid);
+        bignSign2(signature.data(), &this->params, der, len, hash.data(), this->privkey.data(), nullptr, 0);
+        return signature;
+    }
+};
+
+#endif
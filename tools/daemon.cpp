@@ -0,0 +1,337 @@
+#include "simCard.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <daemonProtocol.h>
+#include <randomPool.h>
+#include <signer.h>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+// Authenticated card session, shared by every connection that opens it with the same password
+struct Session {
+    std::unique_ptr<Bpace> bpace;
+    CardSecure card;
+    std::string key;
+    u32 id = 0;
+    size_t clients = 0;
+    Clock::time_point idleSince;
+    std::mutex mutex;
+};
+
+// The daemon serves one card, so one SM context at a time. Session ids are random and only valid
+// on the connections that opened them. The session outlives its last client, so the next Open
+// with the same password skips BPACE; it ends after the idle timeout, on a card reset or removal,
+// on Terminate, or when an Open with another password finds it idle.
+class Daemon {
+public:
+    Daemon(std::string transport, std::chrono::seconds idleTimeout)
+        : transport(transport), idleTimeout(idleTimeout) {
+        this->logger = Logger::getInstance();
+    }
+
+    int run(const std::string& path);
+
+private:
+    void serve(int fd);
+    DaemonFrame handle(const DaemonFrame& request, std::set<u32>& opened);
+    DaemonFrame open(const DaemonFrame& request, std::set<u32>& opened);
+    DaemonFrame exchange(Session& session, DaemonOp op, const DaemonFrame& request);
+    std::shared_ptr<Session> find(u32 id);
+    void release(u32 id);
+    void end(u32 id, const std::string& reason);
+    void expire();
+    u32 newId();
+
+    static DaemonFrame reply(DaemonStatus status, u32 session = 0, std::vector<octet> payload = {}) {
+        DaemonFrame frame;
+        frame.code = static_cast<octet>(status);
+        frame.session = session;
+        frame.payload = std::move(payload);
+        return frame;
+    }
+
+    std::string transport;
+    std::chrono::seconds idleTimeout;
+    std::shared_ptr<Session> active;
+    std::mutex mutex;
+    std::condition_variable idle;
+    // Held for the whole of an Open, so BPACE runs once per card however many clients ask
+    std::mutex openMutex;
+
+    std::shared_ptr<Logger> logger;
+};
+
+std::shared_ptr<Session> Daemon::find(u32 id) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->active != nullptr && this->active->id == id ? this->active : nullptr;
+}
+
+// The last connection holding the session closed it or went away, it stays open until it expires
+void Daemon::release(u32 id) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->active != nullptr && this->active->id == id && --this->active->clients == 0) {
+        logger->log(__FILE__, __LINE__, "Session idle", LogLevel::INFO);
+        this->active->idleSince = Clock::now();
+        this->idle.notify_all();
+    }
+}
+
+// Requests already running on the session finish, connections still holding its id get NoSession
+void Daemon::end(u32 id, const std::string& reason) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->active != nullptr && this->active->id == id) {
+        logger->log(__FILE__, __LINE__, "Closed session: " + reason, LogLevel::INFO);
+        this->active = nullptr;
+    }
+}
+
+// Ends the session once it has been idle for the timeout
+void Daemon::expire() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        if (this->active == nullptr || this->active->clients != 0) {
+            this->idle.wait(lock);
+            continue;
+        }
+        auto deadline = this->active->idleSince + this->idleTimeout;
+        if (Clock::now() < deadline) {
+            this->idle.wait_until(lock, deadline);
+            continue;
+        }
+        logger->log(__FILE__, __LINE__, "Closed session: idle timeout", LogLevel::INFO);
+        this->active = nullptr;
+    }
+}
+
+u32 Daemon::newId() {
+    u32 id = 0;
+    while (id == 0) {
+        RandomPool::getInstance().generate(&id, sizeof(id));
+    }
+    return id;
+}
+
+// Payload: password type (1) | password
+DaemonFrame Daemon::open(const DaemonFrame& request, std::set<u32>& opened) {
+    if (request.payload.size() < 2) {
+        return reply(DaemonStatus::BadRequest);
+    }
+    octet hash[32];
+    beltHash(hash, request.payload.data(), request.payload.size());
+    std::string key(hash, hash + sizeof(hash));
+
+    std::lock_guard<std::mutex> opening(this->openMutex);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->active != nullptr) {
+            // Another password runs BPACE again and invalidates the SM context of the session, so it
+            // only replaces a session no client holds
+            if (this->active->key != key && this->active->clients != 0) {
+                return reply(DaemonStatus::Busy);
+            }
+            if (this->active->key == key) {
+                if (opened.insert(this->active->id).second) {
+                    this->active->clients++;
+                }
+                return reply(DaemonStatus::Ok, this->active->id);
+            }
+            logger->log(__FILE__, __LINE__, "Closed session: opened with another password", LogLevel::INFO);
+            this->active = nullptr;
+        }
+    }
+
+    auto pwdType = static_cast<Pwd>(request.payload[0]);
+    std::string password(request.payload.begin() + 1, request.payload.end());
+    std::shared_ptr<CardTransport> cardTransport;
+    if (this->transport == "sim") {
+        cardTransport = std::make_shared<SimCard>(password, std::chrono::microseconds(0));
+    }
+
+    auto session = std::make_shared<Session>();
+    session->key = key;
+    session->bpace = std::make_unique<Bpace>(password, pwdType, cardTransport);
+    if (session->bpace->open() != ERR_OK || !session->bpace->authorize()) {
+        return reply(DaemonStatus::Error);
+    }
+    session->card.initSecure(session->bpace->getKey().data());
+    session->id = this->newId();
+    session->clients = 1;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->active = session;
+    opened.insert(session->id);
+    this->idle.notify_all();
+    logger->log(__FILE__, __LINE__, "Opened session", LogLevel::INFO);
+    return reply(DaemonStatus::Ok, session->id);
+}
+
+// A reset or removed card lost the SM context, the session cannot serve another request
+static bool cardLost(CardError error) {
+    return error == CardError::CardReset || error == CardError::CardRemoved || error == CardError::ReaderLost;
+}
+
+DaemonFrame Daemon::handle(const DaemonFrame& request, std::set<u32>& opened) {
+    auto op = static_cast<DaemonOp>(request.code);
+    if (op == DaemonOp::Open) {
+        return this->open(request, opened);
+    }
+
+    auto session = opened.count(request.session) != 0 ? this->find(request.session) : nullptr;
+    if (session == nullptr) {
+        return reply(DaemonStatus::NoSession, request.session);
+    }
+    if (op == DaemonOp::Close) {
+        opened.erase(request.session);
+        this->release(request.session);
+        return reply(DaemonStatus::Ok, request.session);
+    }
+    if (op == DaemonOp::Terminate) {
+        opened.erase(request.session);
+        this->end(request.session, "terminated by a client");
+        return reply(DaemonStatus::Ok, request.session);
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    auto response = this->exchange(*session, op, request);
+    if (response.code != static_cast<octet>(DaemonStatus::Ok) && cardLost(session->bpace->getPCSC().getLastError())) {
+        this->end(request.session, "card reset or removed");
+    }
+    return response;
+}
+
+DaemonFrame Daemon::exchange(Session& session, DaemonOp op, const DaemonFrame& request) {
+    auto& pcsc = session.bpace->getPCSC();
+
+    switch (op) {
+        case DaemonOp::Transmit: {
+            auto command = APDUDecode(request.payload);
+            if (command == boost::none) {
+                return reply(DaemonStatus::BadRequest, request.session);
+            }
+            auto wrapped = session.card.wrapCommand(command.get());
+            if (wrapped == boost::none) {
+                return reply(DaemonStatus::Error, request.session);
+            }
+            auto plain = session.card.unwrapResponse(pcsc.sendCommandToCard(wrapped.get()));
+            if (plain == boost::none) {
+                return reply(DaemonStatus::Error, request.session);
+            }
+            return reply(DaemonStatus::Ok, request.session, plain.get());
+        }
+        case DaemonOp::ReadEF: {
+            if (!session.bpace->chooseEF(session.card)) {
+                return reply(DaemonStatus::Error, request.session);
+            }
+            auto data = session.bpace->readEF(session.card);
+            if (data.empty()) {
+                return reply(DaemonStatus::Error, request.session);
+            }
+            return reply(DaemonStatus::Ok, request.session, data);
+        }
+        case DaemonOp::Sign: {
+            auto signature = Signer(pcsc, session.card).sign(request.payload);
+            if (signature == boost::none) {
+                return reply(DaemonStatus::Error, request.session);
+            }
+            return reply(DaemonStatus::Ok, request.session, signature.get());
+        }
+        default:
+            return reply(DaemonStatus::BadRequest, request.session);
+    }
+}
+
+void Daemon::serve(int fd) {
+    std::set<u32> opened;
+    while (auto request = recvFrame(fd)) {
+        if (!sendFrame(fd, this->handle(request.get(), opened))) {
+            break;
+        }
+    }
+    for (u32 id : opened) {
+        this->release(id);
+    }
+    close(fd);
+}
+
+int Daemon::run(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        logger->log(__FILE__, __LINE__, "Socket path is too long", LogLevel::ERROR);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    mode_t mask = umask(0077);
+    bool bound = listener >= 0 && bind(listener, (sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, 64) != 0) {
+        logger->log(__FILE__, __LINE__, "Cannot listen on " + path, LogLevel::ERROR);
+        return -1;
+    }
+    logger->log(__FILE__, __LINE__, "Listening on " + path, LogLevel::INFO);
+    std::thread(&Daemon::expire, this).detach();
+
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger->log(__FILE__, __LINE__, "accept failed: " + std::to_string(errno), LogLevel::ERROR);
+            break;
+        }
+        std::thread(&Daemon::serve, this, fd).detach();
+    }
+    close(listener);
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    std::string path = defaultDaemonSocket();
+    std::string transport = "pcsc";
+    size_t idleTimeout = 300;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        auto end = value.data() + value.size();
+        if (arg == "--socket") {
+            path = value;
+        } else if (arg == "--transport") {
+            transport = value;
+        } else if (arg == "--idle-timeout") {
+            auto res = std::from_chars(value.data(), end, idleTimeout);
+            if (res.ec != std::errc() || res.ptr != end) {
+                std::cerr << "usage: cardlibd [--socket PATH] [--transport pcsc|sim] [--idle-timeout SEC]" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "usage: cardlibd [--socket PATH] [--transport pcsc|sim] [--idle-timeout SEC]" << std::endl;
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    Logger::getInstance()->setLogPreferences("", LogLevel::INFO, LogOutput::CONSOLE);
+    Daemon daemon(transport, std::chrono::seconds(idleTimeout));
+    return daemon.run(path) == 0 ? 0 : 1;
+}
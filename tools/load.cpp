@@ -0,0 +1,369 @@
+#include "simCard.h"
+
+#include <bpace.h>
+#include <cardsecure.h>
+#include <protocolEngine.h>
+#include <tracer.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string transport = "sim";
+    size_t sessions = 1;
+    size_t reads = 4;
+    size_t duration = 60;
+    size_t interval = 10;
+    size_t latencyUs = 2000;
+    size_t efSize = 2048;
+    std::string can = "123456";
+    std::string engine = "threads";
+    size_t ioThreads = 0;
+    std::string trace;
+};
+
+// Log-linear histogram of microseconds: 16 sub-buckets per power of two, bounded memory for long runs
+class LatencyHistogram {
+public:
+    void record(uint64_t us) {
+        this->buckets[index(us)]++;
+        this->count++;
+    }
+
+    uint64_t percentile(double p) const {
+        if (this->count == 0) {
+            return 0;
+        }
+        uint64_t rank = std::ceil(p / 100.0 * this->count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += this->buckets[i];
+            if (seen >= rank) {
+                return upperBound(i);
+            }
+        }
+        return upperBound(BUCKETS - 1);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            this->buckets[i] += other.buckets[i];
+        }
+        this->count += other.count;
+    }
+
+    void clear() {
+        *this = LatencyHistogram();
+    }
+
+private:
+    static const size_t SUB = 16;
+    static const size_t BUCKETS = 64 * SUB;
+
+    static size_t index(uint64_t us) {
+        if (us < SUB) {
+            return us;
+        }
+        size_t exp = 63 - __builtin_clzll(us);
+        size_t sub = (us >> (exp - 4)) & (SUB - 1);
+        return std::min(BUCKETS - 1, (exp - 3) * SUB + sub);
+    }
+
+    static uint64_t upperBound(size_t i) {
+        if (i < SUB) {
+            return i;
+        }
+        size_t exp = i / SUB + 3;
+        size_t sub = i % SUB;
+        return ((SUB + sub + 1) << (exp - 4)) - 1;
+    }
+
+    uint64_t buckets[BUCKETS]{};
+    uint64_t count = 0;
+};
+
+enum Phase { Connect, Handshake, Read, PhaseCount };
+const char* PHASE_NAMES[] = {"connect", "bpace", "read"};
+
+struct Stats {
+    std::mutex mutex;
+    LatencyHistogram interval[PhaseCount], total[PhaseCount];
+    uint64_t errors[PhaseCount]{};
+    uint64_t attempts[PhaseCount]{};
+    std::atomic<uint64_t> sessions{0};
+    std::atomic<uint64_t> apdus{0};
+
+    void record(Phase phase, Clock::duration elapsed, bool ok) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->attempts[phase]++;
+        if (!ok) {
+            this->errors[phase]++;
+            return;
+        }
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        this->interval[phase].record(us);
+        this->total[phase].record(us);
+    }
+};
+
+static double rssMiB() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+// Each read of a session is of the next data group, EF.DG1 (01 01) to EF.DG16 (01 10)
+static const size_t MAX_READS = 16;
+
+static std::vector<octet> dataGroup(size_t i) {
+    return {0x01, static_cast<octet>(i + 1)};
+}
+
+// The simulated card holds every data group read, with --ef-size bytes each
+static std::shared_ptr<CardTransport> simTransport(const Options& options) {
+    if (options.transport != "sim") {
+        return nullptr;
+    }
+    auto card = std::make_shared<SimCard>(options.can, std::chrono::microseconds(options.latencyUs), options.efSize);
+    for (size_t i = 1; i < options.reads; ++i) {
+        std::vector<octet> data(options.efSize);
+        for (size_t j = 0; j < data.size(); ++j) {
+            data[j] = static_cast<octet>(i + j);
+        }
+        card->setEF(dataGroup(i), std::move(data));
+    }
+    return card;
+}
+
+static bool runSession(const Options& options, Stats& stats) {
+    auto transport = simTransport(options);
+
+    auto start = Clock::now();
+    Bpace bpace(options.can, Pwd::CAN, transport);
+    bool ok = bpace.open() == ERR_OK;
+    stats.record(Connect, Clock::now() - start, ok);
+
+    if (ok) {
+        start = Clock::now();
+        ok = bpace.authorize();
+        stats.record(Handshake, Clock::now() - start, ok);
+    }
+    if (ok) {
+        CardSecure card;
+        card.initSecure(bpace.getKey().data());
+        for (size_t i = 0; i < options.reads && ok; ++i) {
+            start = Clock::now();
+            ok = bpace.chooseEF(card, dataGroup(i)) && !bpace.readEF(card).empty();
+            stats.record(Read, Clock::now() - start, ok);
+        }
+    }
+    stats.apdus += bpace.getPCSC().getTransmitCount();
+    if (ok) {
+        stats.sessions++;
+    }
+    return ok;
+}
+
+// Same session as runSession, as a coroutine on the event loop
+static Task<bool> runSessionAsync(const Options& options, Stats& stats, EventLoop& loop) {
+    auto transport = simTransport(options);
+
+    auto start = Clock::now();
+    Bpace bpace(options.can, Pwd::CAN, transport);
+    bool ok = co_await bpace.open(loop) == ERR_OK;
+    stats.record(Connect, Clock::now() - start, ok);
+
+    if (ok) {
+        start = Clock::now();
+        ok = co_await bpace.authorize(loop);
+        stats.record(Handshake, Clock::now() - start, ok);
+    }
+    if (ok) {
+        CardSecure card;
+        card.initSecure(bpace.getKey().data());
+        for (size_t i = 0; i < options.reads && ok; ++i) {
+            start = Clock::now();
+            ok = co_await bpace.chooseEF(loop, card, dataGroup(i)) && !(co_await bpace.readEF(loop, card)).empty();
+            stats.record(Read, Clock::now() - start, ok);
+        }
+    }
+    stats.apdus += bpace.getPCSC().getTransmitCount();
+    if (ok) {
+        stats.sessions++;
+    }
+    co_return ok;
+}
+
+static Task<bool> runConversation(const Options& options, Stats& stats, EventLoop& loop, Clock::time_point end) {
+    while (Clock::now() < end) {
+        co_await runSessionAsync(options, stats, loop);
+    }
+    co_return true;
+}
+
+static void report(Stats& stats, const char* label, double seconds, uint64_t sessions, uint64_t apdus, bool total) {
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    uint64_t errors = 0, attempts = 0;
+    for (size_t p = 0; p < PhaseCount; ++p) {
+        errors += stats.errors[p];
+        attempts += stats.attempts[p];
+    }
+    std::printf("[%s] sessions/s=%.1f apdus/s=%.1f errors=%llu (%.2f%%) rss=%.1fMiB",
+                label,
+                sessions / seconds,
+                apdus / seconds,
+                (unsigned long long)errors,
+                attempts ? 100.0 * errors / attempts : 0.0,
+                rssMiB());
+    for (size_t p = 0; p < PhaseCount; ++p) {
+        auto& h = total ? stats.total[p] : stats.interval[p];
+        std::printf(" %s p50/p95/p99=%.2f/%.2f/%.2fms",
+                    PHASE_NAMES[p],
+                    h.percentile(50) / 1000.0,
+                    h.percentile(95) / 1000.0,
+                    h.percentile(99) / 1000.0);
+        if (!total) {
+            h.clear();
+        }
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+static void usage() {
+    std::cout << "usage: cardlib-load [--transport sim|pcsc] [--sessions N] [--reads K] [--duration SEC]\n"
+                 "                    [--interval SEC] [--latency-us US] [--ef-size BYTES] [--can CODE]\n"
+                 "                    [--engine threads|loop] [--io-threads N] [--trace FILE]\n"
+                 "--reads K reads data groups 1 to K (K <= 16), each must exist on a pcsc card\n";
+}
+
+// A decimal count and nothing else
+static bool parseCount(const std::string& value, size_t& count) {
+    auto end = value.data() + value.size();
+    auto res = std::from_chars(value.data(), end, count);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        bool valid = true;
+        if (arg == "--transport") {
+            options.transport = value;
+        } else if (arg == "--sessions") {
+            valid = parseCount(value, options.sessions);
+        } else if (arg == "--reads") {
+            valid = parseCount(value, options.reads);
+        } else if (arg == "--duration") {
+            valid = parseCount(value, options.duration);
+        } else if (arg == "--interval") {
+            valid = parseCount(value, options.interval);
+        } else if (arg == "--latency-us") {
+            valid = parseCount(value, options.latencyUs);
+        } else if (arg == "--ef-size") {
+            valid = parseCount(value, options.efSize);
+        } else if (arg == "--can") {
+            options.can = value;
+        } else if (arg == "--engine") {
+            options.engine = value;
+        } else if (arg == "--io-threads") {
+            valid = parseCount(value, options.ioThreads);
+        } else if (arg == "--trace") {
+            options.trace = value;
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            usage();
+            return 1;
+        }
+    }
+    if (options.reads > MAX_READS || (options.transport != "sim" && options.transport != "pcsc") ||
+        (options.engine != "threads" && options.engine != "loop") || options.interval == 0) {
+        usage();
+        return 1;
+    }
+    // Every session would open the first reader, one card cannot serve several of them
+    if (options.transport == "pcsc" && options.sessions > 1) {
+        std::cerr << "--transport pcsc supports a single session\n";
+        return 1;
+    }
+
+    Logger::getInstance()->setLogPreferences("", LogLevel::ERROR, LogOutput::CONSOLE);
+
+    if (!options.trace.empty()) {
+        Tracer::getInstance().start(options.trace);
+    }
+
+    Stats stats;
+    std::atomic<bool> running{true};
+    auto begin = Clock::now();
+    auto end = begin + std::chrono::seconds(options.duration);
+
+    // The loop engine drives every session from one thread, card I/O runs on --io-threads, by
+    // default one per session so that no card waits for another's exchange
+    std::vector<std::thread> workers;
+    std::unique_ptr<EventLoop> loop;
+    if (options.engine == "loop") {
+        loop = std::make_unique<EventLoop>(options.ioThreads == 0 ? options.sessions : options.ioThreads);
+        for (size_t i = 0; i < options.sessions; ++i) {
+            loop->spawn(runConversation(options, stats, *loop, end), [](bool) {});
+        }
+        workers.emplace_back([&]() { loop->run(); });
+    } else {
+        for (size_t i = 0; i < options.sessions; ++i) {
+            workers.emplace_back([&]() {
+                while (running && Clock::now() < end) {
+                    runSession(options, stats);
+                }
+            });
+        }
+    }
+
+    uint64_t lastSessions = 0, lastApdus = 0;
+    auto lastReport = begin;
+    while (Clock::now() < end) {
+        auto next = std::min(end, lastReport + std::chrono::seconds(options.interval));
+        std::this_thread::sleep_until(next);
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        uint64_t sessions = stats.sessions, apdus = stats.apdus;
+        std::string label = "t=" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now - begin).count()) + "s";
+        report(stats, label.c_str(), seconds, sessions - lastSessions, apdus - lastApdus, false);
+        lastSessions = sessions;
+        lastApdus = apdus;
+        lastReport = now;
+    }
+
+    running = false;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    report(stats, "total", seconds, stats.sessions, stats.apdus, true);
+    if (!options.trace.empty() && Tracer::getInstance().stop()) {
+        std::printf("trace written to %s\n", options.trace.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "simCard.h"
+
+#include <verifier.h>
+
+#include <thread>
+
+static const char* CURVE = "1.2.112.0.2.0.34.101.45.3.1";
+
+SimCard::SimCard(std::string password, std::chrono::microseconds latency, size_t efSize, bool extended)
+    : password(password), latency(latency), extended(extended) {
+    std::vector<octet> data(efSize);
+    for (size_t i = 0; i < efSize; ++i) {
+        data[i] = static_cast<octet>(i);
+    }
+    this->ef = &(this->files[{0x01, 0x01}] = std::move(data));
+}
+
+void SimCard::setEF(const std::vector<octet>& fid, std::vector<octet> data) {
+    this->files[fid] = std::move(data);
+}
+
+ApduLimits SimCard::getLimits() {
+    ApduLimits limits;
+    if (this->extended) {
+        limits.maxCommand = 65535;
+        limits.maxResponse = 65536;
+        limits.extended = true;
+    }
+    return limits;
+}
+
+// T=0 and T=1 without historical bytes
+boost::optional<ATR> SimCard::getATR() {
+    const octet atr[] = {0x3B, 0x80, 0x80, 0x01, 0x01};
+    return ATR::parse(atr, sizeof(atr));
+}
+
+std::vector<octet> SimCard::respond(const std::vector<octet>& data, octet sw1, octet sw2) {
+    std::vector<octet> res(data);
+    res.push_back(sw1);
+    res.push_back(sw2);
+    return res;
+}
+
+std::vector<octet> SimCard::transmit(const std::vector<octet>& cmd) {
+    // The simulated card is not charged to the transmit path of the host
+    CARDLIB_ALLOC_SCOPE(AllocSite::Other);
+    std::this_thread::sleep_for(this->latency);
+
+    size_t size = apduCmdDec(0, cmd.data(), cmd.size());
+    if (size == SIZE_MAX) {
+        return respond({}, 0x67, 0x00);
+    }
+    std::vector<octet> buffer(size);
+    apdu_cmd_t* apdu = (apdu_cmd_t*)buffer.data();
+    apduCmdDec(apdu, cmd.data(), cmd.size());
+
+    if (!(apdu->cla & 0x0C)) {
+        return this->process(apdu);
+    }
+    if (!this->secure) {
+        return respond({}, 0x69, 0x88);
+    }
+
+    btokSMCtrInc(this->smState.data());
+    if (btokSMCmdUnwrap(0, &size, cmd.data(), cmd.size(), this->smState.data()) != ERR_OK) {
+        this->secure = false;
+        return respond({}, 0x69, 0x88);
+    }
+    std::vector<octet> plainBuffer(size);
+    apdu_cmd_t* plain = (apdu_cmd_t*)plainBuffer.data();
+    btokSMCmdUnwrap(plain, &size, cmd.data(), cmd.size(), this->smState.data());
+
+    auto response = this->process(plain);
+    std::vector<octet> respBuffer(sizeof(apdu_resp_t) + response.size());
+    apdu_resp_t* resp = (apdu_resp_t*)respBuffer.data();
+    apduRespDec(resp, response.data(), response.size());
+
+    size_t count;
+    btokSMRespWrap(0, &count, resp, this->smState.data());
+    std::vector<octet> wrapped(count);
+    btokSMRespWrap(wrapped.data(), &count, resp, this->smState.data());
+    wrapped.resize(count);
+    return wrapped;
+}
+
+// A warm reset loses the BPACE and SM state, as on a real card
+int SimCard::reconnect(bool reset) {
+    if (reset) {
+        this->bakeState.clear();
+        this->secure = false;
+    }
+    return 0;
+}
+
+std::vector<octet> SimCard::process(const apdu_cmd_t* cmd) {
+    switch (static_cast<Instruction>(cmd->ins)) {
+        case Instruction::FilesSelect:
+            return this->select(cmd);
+        case Instruction::BPACEInit:
+            return this->bpaceInit(cmd);
+        case Instruction::BPACESteps:
+            return this->bpaceStep(cmd);
+        case Instruction::ReadBinary:
+            return this->readBinary(cmd);
+        case Instruction::PerformSecurityOperation:
+            return this->sign(cmd);
+        default:
+            return respond({}, 0x6D, 0x00);
+    }
+}
+
+// 80 protocol OID, 83 password type, then the CHATs that make up helloa
+std::vector<octet> SimCard::bpaceInit(const apdu_cmd_t* cmd) {
+    std::span<const octet> data(cmd->cdf, cmd->cdf_len);
+    this->helloa.clear();
+    u32 tag;
+    std::span<const octet> value;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t count = derTLV(data.subspan(pos), tag, value);
+        if (count == 0) {
+            return respond({}, 0x6A, 0x80);
+        }
+        if (tag != 0x80 && tag != 0x83) {
+            this->helloa.insert(this->helloa.end(), data.begin() + pos, data.begin() + pos + count);
+        }
+        pos += count;
+    }
+
+    if (bignParamsStd(&this->params, CURVE) != ERR_OK) {
+        return respond({}, 0x6F, 0x00);
+    }
+    this->settings.kca = TRUE;
+    this->settings.kcb = TRUE;
+    this->settings.helloa = this->helloa.data();
+    this->settings.helloa_len = this->helloa.size();
+    this->settings.hellob = "";
+    this->settings.hellob_len = 0;
+    this->settings.rng = RandomPool::stepR;
+    this->settings.rng_state = nullptr;
+
+    this->bakeState.assign(bakeBPACE_keep(this->params.l), 0);
+    this->secure = false;
+    if (bakeBPACEStart(this->bakeState.data(),
+                       &this->params,
+                       &this->settings,
+                       (const octet*)this->password.data(),
+                       this->password.size()) != ERR_OK) {
+        return respond({}, 0x6F, 0x00);
+    }
+    return respond({}, 0x90, 0x00);
+}
+
+std::vector<octet> SimCard::bpaceStep(const apdu_cmd_t* cmd) {
+    u32 tag;
+    std::span<const octet> outer, inner;
+    if (this->bakeState.empty() || derTLV(std::span<const octet>(cmd->cdf, cmd->cdf_len), tag, outer) == 0 ||
+        tag != 0x7C || derTLV(outer, tag, inner) == 0) {
+        return respond({}, 0x6A, 0x80);
+    }
+
+    size_t l = this->params.l;
+    if (tag == 0x80 && inner.size() == l / 8) {
+        std::vector<octet> message2(5 * l / 8);
+        if (bakeBPACEStep3(message2.data(), inner.data(), this->bakeState.data()) != ERR_OK) {
+            return respond({}, 0x69, 0x82);
+        }
+        return respond(derEncode(0x7C, derEncode(0x81, message2)), 0x90, 0x00);
+    }
+    if (tag == 0x82 && inner.size() == l / 2 + 8) {
+        std::vector<octet> message4(8);
+        octet key[32];
+        if (bakeBPACEStep5(message4.data(), inner.data(), this->bakeState.data()) != ERR_OK ||
+            bakeBPACEStepG(key, this->bakeState.data()) != ERR_OK) {
+            return respond({}, 0x63, 0x00);
+        }
+        this->smState.assign(btokSM_keep(), 0);
+        btokSMStart(this->smState.data(), key);
+        this->secure = true;
+        return respond(derEncode(0x7C, derEncode(0x83, message4)), 0x90, 0x00);
+    }
+    return respond({}, 0x6A, 0x80);
+}
+
+// A two byte file id selects an EF, anything else (MF, applets) is accepted as is
+std::vector<octet> SimCard::select(const apdu_cmd_t* cmd) {
+    if (cmd->cdf_len != 2) {
+        return respond({}, 0x90, 0x00);
+    }
+    auto file = this->files.find(std::vector<octet>(cmd->cdf, cmd->cdf + 2));
+    if (file == this->files.end()) {
+        return respond({}, 0x6A, 0x82);
+    }
+    this->ef = &file->second;
+    return respond({}, 0x90, 0x00);
+}
+
+std::vector<octet> SimCard::readBinary(const apdu_cmd_t* cmd) {
+    size_t offset = ((cmd->p1 & 0x7F) << 8) | cmd->p2;
+    if (offset > this->ef->size()) {
+        return respond({}, 0x6B, 0x00);
+    }
+    size_t len = std::min(cmd->rdf_len ? cmd->rdf_len : 256, this->ef->size() - offset);
+    std::vector<octet> data(this->ef->begin() + offset, this->ef->begin() + offset + len);
+    if (len < cmd->rdf_len) {
+        return respond(data, 0x62, 0x82);
+    }
+    return respond(data, 0x90, 0x00);
+}
+
+bool SimCard::signKey() {
+    if (!this->privkey.empty()) {
+        return true;
+    }
+    std::vector<octet> privkey(32), pubkey(64);
+    if (bignParamsStd(&this->signParams, CURVE) != ERR_OK ||
+        bignKeypairGen(privkey.data(), pubkey.data(), &this->signParams, RandomPool::stepR, nullptr) != ERR_OK) {
+        return false;
+    }
+    this->privkey = std::move(privkey);
+    this->pubkey = std::move(pubkey);
+    return true;
+}
+
+std::vector<octet> SimCard::getPublicKey() {
+    this->signKey();
+    return this->pubkey;
+}
+
+// COMPUTE DIGITAL SIGNATURE of a belt-hash value, only once BPACE is done
+std::vector<octet> SimCard::sign(const apdu_cmd_t* cmd) {
+    if (cmd->p1 != 0x9E || cmd->p2 != 0x9A) {
+        return respond({}, 0x6A, 0x86);
+    }
+    if (!this->secure) {
+        return respond({}, 0x69, 0x82);
+    }
+    if (cmd->cdf_len != 32) {
+        return respond({}, 0x6A, 0x80);
+    }
+    octet oid[128];
+    size_t oidLen = sizeof(oid);
+    std::vector<octet> signature(48);
+    if (!this->signKey() || bignOidToDER(oid, &oidLen, OID_BELT_HASH) != ERR_OK ||
+        bignSign2(signature.data(), &this->signParams, oid, oidLen, cmd->cdf, this->privkey.data(), nullptr, 0) !=
+            ERR_OK) {
+        return respond({}, 0x6F, 0x00);
+    }
+    return respond(signature, 0x90, 0x00);
+}
@@ -0,0 +1,64 @@
+#ifndef SIMCARD_H
+#define SIMCARD_H
+
+#include <bee2/core/apdu.h>
+#include <bee2/crypto/bake.h>
+#include <bee2/crypto/bign.h>
+#include <btok.h>
+
+#include <apducmd.h>
+#include <pcsc.h>
+#include <randomPool.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+// In-process card answering SELECT, BPACE (card side), READ BINARY and PSO COMPUTE DIGITAL
+// SIGNATURE under SM. Every APDU takes the configured latency, standing in for card processing time.
+// EF 01 01 holds efSize bytes, further EFs are added with setEF and selected by file id.
+class SimCard : public CardTransport {
+public:
+    SimCard(std::string password, std::chrono::microseconds latency, size_t efSize = 2048, bool extended = true);
+
+    std::vector<octet> transmit(const std::vector<octet>& cmd) override;
+    ApduLimits getLimits() override;
+    boost::optional<ATR> getATR() override;
+    int reconnect(bool reset) override;
+
+    void setEF(const std::vector<octet>& fid, std::vector<octet> data);
+
+    // Key the card signs with, made on first use
+    std::vector<octet> getPublicKey();
+
+private:
+    std::vector<octet> process(const apdu_cmd_t* cmd);
+    std::vector<octet> bpaceInit(const apdu_cmd_t* cmd);
+    std::vector<octet> bpaceStep(const apdu_cmd_t* cmd);
+    std::vector<octet> select(const apdu_cmd_t* cmd);
+    std::vector<octet> readBinary(const apdu_cmd_t* cmd);
+    std::vector<octet> sign(const apdu_cmd_t* cmd);
+    bool signKey();
+
+    static std::vector<octet> respond(const std::vector<octet>& data, octet sw1, octet sw2);
+
+    std::string password;
+    std::chrono::microseconds latency;
+    std::map<std::vector<octet>, std::vector<octet>> files;
+    std::vector<octet>* ef;
+    bool extended;
+
+    bign_params params{};
+    std::vector<octet> helloa;
+    bake_settings settings{};
+    std::vector<octet> bakeState;
+    std::vector<octet> smState;
+    bool secure = false;
+
+    bign_params signParams{};
+    std::vector<octet> privkey;
+    std::vector<octet> pubkey;
+};
+
+#endif